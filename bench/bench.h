@@ -0,0 +1,47 @@
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+/*
+ * Markers used by the micro-benchmark images. bench/runner watches writes to
+ * these registers under simavr:
+ *
+ *   GPIOR2 - Name of the next region, one character per write, ended by a 0
+ *   GPIOR0 - Written 1 at the start of a region and 0 at the end
+ *
+ * The cycle count between the two GPIOR0 writes is reported against the name.
+ * The compiler barriers keep the measured code from being moved across the
+ * markers.
+ */
+#define bench_barrier() __asm__ __volatile__ ("" ::: "memory")
+
+static inline void bench_begin(const char *name)
+{
+    while (*name)
+        GPIOR2 = *name++;
+
+    GPIOR2 = 0;
+
+    bench_barrier();
+    GPIOR0 = 1;
+    bench_barrier();
+}
+
+static inline void bench_end(void)
+{
+    bench_barrier();
+    GPIOR0 = 0;
+    bench_barrier();
+}
+
+/* Sleeping with interrupts off makes simavr stop the simulation */
+static inline void bench_exit(void)
+{
+    cli();
+    sleep_cpu();
+}
+
+#endif
@@ -0,0 +1,36 @@
+
+#include "../src/bt_gamepad.c"
+
+#include "bench.h"
+
+static void feed(const char *msg)
+{
+    while (*msg)
+        bt_gamepad_handle_char(*msg++, 0);
+}
+
+int main(void)
+{
+    struct car_state car = { .speed_scale = CAR_STATE_SCALE_ONE };
+
+    bench_begin("parse_axis");
+    feed("axis:0:-64:100\n");
+    bench_end();
+
+    bench_begin("parse_btn");
+    feed("btn:2:1\n");
+    bench_end();
+
+    bench_begin("parse_4_msgs");
+    feed("axis:0:-64:100\nbtn:1:1\nbtn:1:0\naxis:0:0:0\n");
+    bench_end();
+
+    gamepad_state.lr_axis = -64;
+    gamepad_state.ud_axis = 100;
+    bench_begin("apply");
+    bt_gamepad_apply(&car);
+    bench_end();
+
+    bench_exit();
+    return 0;
+}
@@ -0,0 +1,26 @@
+
+#include "../src/car_state.c"
+
+#include "bench.h"
+
+int main(void)
+{
+    struct car_state car = { .speed_scale = CAR_STATE_SCALE_ONE };
+
+    bench_begin("apply_unchanged");
+    car_state_apply(&car);
+    bench_end();
+
+    car_state_left_motor_set(&car, MOTOR_FOR);
+    car_state_right_motor_set(&car, MOTOR_BACK);
+    car_state_motor_left_speed_set(&car, 200);
+    car_state_motor_right_speed_set(&car, 180);
+    car_state_servo_degree_set(&car, 128);
+
+    bench_begin("apply_all_changed");
+    car_state_apply(&car);
+    bench_end();
+
+    bench_exit();
+    return 0;
+}
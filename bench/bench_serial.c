@@ -0,0 +1,63 @@
+#include "../src/serial.c"
+
+#include "bench.h"
+
+/*
+ * The RX handler as it was before the event queue, for comparison: the ISR
+ * called the BT parser's character handler through a pointer, and that
+ * stored the character in a ring of message buffers. It sits on the UDRE
+ * vector, which the firmware doesn't use, so it gets the same ISR
+ * prologue and epilogue.
+ */
+#define OLD_MSG_BUF_CNT 20
+#define OLD_MSG_LEN 20
+
+static volatile char old_msg_buf[OLD_MSG_BUF_CNT][OLD_MSG_LEN];
+static volatile uint16_t old_msg_len[OLD_MSG_BUF_CNT];
+static volatile uint16_t old_msg_write_idx;
+
+static void old_handle_serial_char(char ch)
+{
+    if (ch == '\n') {
+        if (old_msg_len[old_msg_write_idx] > 0) {
+            old_msg_write_idx++;
+            if (old_msg_write_idx == OLD_MSG_BUF_CNT)
+                old_msg_write_idx = 0;
+        }
+    } else if (old_msg_len[old_msg_write_idx] < OLD_MSG_LEN - 1) {
+        old_msg_buf[old_msg_write_idx][old_msg_len[old_msg_write_idx]] = ch;
+        old_msg_len[old_msg_write_idx]++;
+    }
+}
+
+/* Volatile, so the call isn't turned into a direct one as it could be here */
+static void (*volatile old_serial_callback)(char);
+
+ISR(USART_UDRE_vect)
+{
+    char c = UDR0;
+    old_serial_callback(c);
+}
+
+int main(void)
+{
+    serial_init();
+    old_serial_callback = old_handle_serial_char;
+
+    /* The ISRs are called directly, so this is the cost of the handlers
+     * themselves and not the hardware vectoring. They end with a reti, so
+     * interrupts have to be turned back off after. UDR0 reads as 0, which
+     * both take as a character to store. */
+    bench_begin("rx_isr");
+    USART_RX_vect();
+    bench_end();
+    cli();
+
+    bench_begin("rx_isr_callback");
+    USART_UDRE_vect();
+    bench_end();
+    cli();
+
+    bench_exit();
+    return 0;
+}
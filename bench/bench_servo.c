@@ -0,0 +1,31 @@
+
+#include "../src/servo.c"
+
+#include "bench.h"
+
+int main(void)
+{
+    servo_register(&PORTD, PORTD3);
+    servo_set(128);
+
+    /* The ISR is called directly, so the cost of the hardware vectoring is not
+     * included. It ends with a reti, so interrupts have to be turned back off
+     * after each call. */
+    bench_begin("isr_pulse_start");
+    TIMER1_COMPA_vect();
+    bench_end();
+    cli();
+
+    bench_begin("isr_pulse_end");
+    TIMER1_COMPA_vect();
+    bench_end();
+    cli();
+
+    bench_begin("isr_refresh");
+    TIMER1_COMPA_vect();
+    bench_end();
+    cli();
+
+    bench_exit();
+    return 0;
+}
@@ -0,0 +1,19 @@
+#include "../src/ultrasonic.c"
+
+#include "bench.h"
+
+int main(void)
+{
+    /* Roughly 1m. Volatile so the division isn't done at compile time */
+    volatile uint16_t us = 5800;
+    volatile uint16_t cm;
+
+    bench_begin("convert");
+    cm = ultrasonic_convert(us);
+    bench_end();
+
+    (void)cm;
+
+    bench_exit();
+    return 0;
+}
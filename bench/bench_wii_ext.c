@@ -0,0 +1,30 @@
+
+#include "../src/wii_ext.c"
+
+#include "bench.h"
+
+int main(void)
+{
+    struct wii_ext_state state;
+    struct wii_ext_decoder d;
+
+    /* Up, X and R held, the left stick pushed up and right, the right one
+     * centered, and the triggers released */
+    const unsigned char report[6] = { 0xb0, 0x3a, 0x10, 0x00, 0xfd, 0xf6 };
+    const unsigned char report_hires[8] = { 0xc0, 0x80, 0xe8, 0x80, 0x00, 0x00, 0xfd, 0xf6 };
+
+    memcpy_P(&d, &classic, sizeof(d));
+
+    bench_begin("decode");
+    wii_ext_decode(&d, &state, report);
+    bench_end();
+
+    memcpy_P(&d, &classic_hires, sizeof(d));
+
+    bench_begin("decode_hires");
+    wii_ext_decode(&d, &state, report_hires);
+    bench_end();
+
+    bench_exit();
+    return 0;
+}
@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# Runs every bench image given on the command line under bench/runner, adds
+# the flash/RAM usage of every ELF given, and compares the results against a
+# stored baseline.
+#
+#   check.sh <baseline> <elf>...
+#
+# The baseline is a list of "<metric> <value>" lines. A metric that grows by
+# more than BENCH_TOLERANCE percent (default 2) over its baseline fails the
+# run, and so does one the baseline doesn't have, or a missing baseline. With
+# BENCH_UPDATE=1 the baseline is rewritten with the current results instead.
+#
+# Cycle counts from the simulator are exact, so any change is a real change;
+# the tolerance only exists to let small, intended growth through.
+
+BASELINE=$1
+shift
+
+RUNNER=${RUNNER:-./bench/runner}
+AVRSIZE=${AVRSIZE:-avr-size}
+BENCH_TOLERANCE=${BENCH_TOLERANCE:-2}
+
+if [ "$BENCH_UPDATE" != 1 ] && [ ! -f "$BASELINE" ]; then
+    echo "$BASELINE: no baseline, record one with 'make bench_baseline'" >&2
+    exit 1
+fi
+
+RESULTS=$(mktemp)
+trap 'rm -f "$RESULTS"' EXIT
+
+for elf in "$@"; do
+    name=$(basename "$elf" .elf)
+    name=${name#bench_}
+
+    case "$elf" in
+    *bench_*)
+        "$RUNNER" "$elf" >> "$RESULTS" || exit 1
+        ;;
+    esac
+
+    # Flash is .text + .data, RAM is .data + .bss
+    "$AVRSIZE" "$elf" | awk -v n="$name" 'NR == 2 {
+        printf "%s.flash %d\n", n, $1 + $2
+        printf "%s.ram %d\n", n, $2 + $3
+    }' >> "$RESULTS"
+done
+
+if [ "$BENCH_UPDATE" = 1 ]; then
+    cp "$RESULTS" "$BASELINE"
+    echo "Wrote $BASELINE"
+    exit 0
+fi
+
+printf "%-36s %10s %10s\n" metric baseline current
+
+awk -v tol="$BENCH_TOLERANCE" -v baseline="$BASELINE" '
+    BEGIN {
+        while ((getline line < baseline) > 0) {
+            split(line, f, " ")
+            base[f[1]] = f[2]
+        }
+    }
+    {
+        if (!($1 in base)) {
+            printf "%-36s %10s %10d  NOT IN BASELINE\n", $1, "-", $2
+            failed = 1
+            next
+        }
+
+        delta = base[$1] ? ($2 - base[$1]) * 100.0 / base[$1] : 0
+        flag = ""
+        if (delta > tol) {
+            flag = "  REGRESSION"
+            failed = 1
+        }
+
+        printf "%-36s %10d %10d %+7.2f%%%s\n", $1, base[$1], $2, delta, flag
+    }
+    END { exit failed }
+' "$RESULTS"
@@ -0,0 +1,133 @@
+/*
+ * Runs one micro-benchmark image under simavr and prints the cycle count of
+ * every region marked with bench_begin()/bench_end() (see bench.h), one per
+ * line, as:
+ *
+ *   <image>.<region> <cycles>
+ *
+ * where <image> is the ELF name with the "bench_" prefix and ".elf" suffix
+ * stripped.
+ *
+ * This is built for the host, not the AVR.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+
+#define BENCH_MCU "atmega328p"
+#define BENCH_FREQUENCY 16000000UL
+
+/* Data-space addresses of the marker registers */
+#define GPIOR0_ADDR 0x3E
+#define GPIOR2_ADDR 0x4B
+
+/* Anything running longer than this is stuck */
+#define BENCH_CYCLE_LIMIT 100000000ULL
+
+static char image[64];
+
+static char region[64];
+static size_t region_len;
+
+static avr_cycle_count_t region_start;
+static int region_open;
+
+static void region_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    avr->data[addr] = v;
+
+    if (v) {
+        region_start = avr->cycle;
+        region_open = 1;
+    } else if (region_open) {
+        printf("%s.%s %llu\n", image, region,
+               (unsigned long long)(avr->cycle - region_start));
+        region_open = 0;
+    }
+}
+
+static void name_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    avr->data[addr] = v;
+
+    if (!v) {
+        region[region_len] = '\0';
+        region_len = 0;
+    } else if (region_len < sizeof(region) - 1) {
+        region[region_len++] = v;
+    }
+}
+
+static void set_image_name(const char *path)
+{
+    char tmp[256];
+    char *name;
+    size_t len;
+
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    name = basename(tmp);
+
+    if (strncmp(name, "bench_", 6) == 0)
+        name += 6;
+
+    snprintf(image, sizeof(image), "%s", name);
+
+    len = strlen(image);
+    if (len > 4 && strcmp(image + len - 4, ".elf") == 0)
+        image[len - 4] = '\0';
+}
+
+int main(int argc, char **argv)
+{
+    elf_firmware_t fw;
+    avr_t *avr;
+    int state;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <bench image>\n", argv[0]);
+        return 2;
+    }
+
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(argv[1], &fw)) {
+        fprintf(stderr, "%s: unable to load firmware\n", argv[1]);
+        return 2;
+    }
+
+    avr = avr_make_mcu_by_name(BENCH_MCU);
+    if (!avr) {
+        fprintf(stderr, "simavr has no " BENCH_MCU " core\n");
+        return 2;
+    }
+
+    avr_init(avr);
+    avr_load_firmware(avr, &fw);
+    avr->frequency = BENCH_FREQUENCY;
+
+    set_image_name(argv[1]);
+
+    avr_register_io_write(avr, GPIOR0_ADDR, region_write, NULL);
+    avr_register_io_write(avr, GPIOR2_ADDR, name_write, NULL);
+
+    do {
+        state = avr_run(avr);
+
+        if (avr->cycle > BENCH_CYCLE_LIMIT) {
+            fprintf(stderr, "%s: did not finish in %llu cycles\n", argv[1],
+                    (unsigned long long)BENCH_CYCLE_LIMIT);
+            return 1;
+        }
+    } while (state != cpu_Done && state != cpu_Crashed);
+
+    if (state == cpu_Crashed) {
+        fprintf(stderr, "%s: crashed\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
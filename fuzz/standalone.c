@@ -0,0 +1,34 @@
+/*
+ * Runs a libFuzzer harness over the files named on the command line, for
+ * builds without libFuzzer.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[1 << 16];
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        size_t len;
+
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+
+        len = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+
+    printf("%d inputs ok\n", argc - 1);
+    return 0;
+}
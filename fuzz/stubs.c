@@ -0,0 +1,135 @@
+/*
+ * What bt_gamepad.c calls into, for the host builds. The car_state setters
+ * just store the value, and the tuning, motion queue, serial link and
+ * fault recorder commands only count calls.
+ */
+
+#include <stdio.h>
+
+#include "car_state.h"
+#include "serial.h"
+#include "tune.h"
+#include "motion.h"
+#include "blackbox.h"
+#include "stubs.h"
+
+struct tune_params tune = {
+    .pwm_offset = 50,
+};
+
+FILE *serial_out;
+
+unsigned long stub_tune_calls;
+unsigned long stub_motion_calls;
+unsigned long stub_serial_calls;
+
+void serial_init(void)
+{
+}
+
+void serial_baud_try(const char *rate)
+{
+    stub_serial_calls++;
+}
+
+void serial_baud_confirm(void)
+{
+    stub_serial_calls++;
+}
+
+void serial_report(void)
+{
+    stub_serial_calls++;
+}
+
+void blackbox_report(void)
+{
+    stub_serial_calls++;
+}
+
+void blackbox_clear(void)
+{
+    stub_serial_calls++;
+}
+
+void tune_get(const char *name)
+{
+    stub_tune_calls++;
+}
+
+void tune_set(const char *name, const char *value)
+{
+    stub_tune_calls++;
+}
+
+void tune_list(void)
+{
+    stub_tune_calls++;
+}
+
+void tune_save(void)
+{
+    stub_tune_calls++;
+}
+
+void motion_add(uint16_t ms, int16_t left, int16_t right, int16_t servo)
+{
+    stub_motion_calls++;
+}
+
+void motion_run(void)
+{
+    stub_motion_calls++;
+}
+
+void motion_stop(void)
+{
+    stub_motion_calls++;
+}
+
+void motion_clear(void)
+{
+    stub_motion_calls++;
+}
+
+void motion_report(void)
+{
+    stub_motion_calls++;
+}
+
+void motion_abort(struct car_state *car)
+{
+    stub_motion_calls++;
+}
+
+void car_state_left_motor_set(struct car_state *car, enum motor_dir dir)
+{
+    car->motor_left = dir;
+}
+
+void car_state_right_motor_set(struct car_state *car, enum motor_dir dir)
+{
+    car->motor_right = dir;
+}
+
+void car_state_servo_degree_set(struct car_state *car, uint8_t servo)
+{
+    car->servo_degree = servo;
+}
+
+void car_state_motor_left_speed_set(struct car_state *car, uint8_t speed)
+{
+    car->motor_left_speed = speed;
+}
+
+void car_state_motor_right_speed_set(struct car_state *car, uint8_t speed)
+{
+    car->motor_right_speed = speed;
+}
+
+void car_state_input_tag(struct car_state *car, uint8_t source, uint16_t stamp)
+{
+    car->input_tagged = 1;
+    car->input_source = source;
+    car->input_stamp = stamp;
+}
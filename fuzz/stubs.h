@@ -0,0 +1,13 @@
+#ifndef FUZZ_STUBS_H
+#define FUZZ_STUBS_H
+
+/* Number of tuning commands the parser has dispatched */
+extern unsigned long stub_tune_calls;
+
+/* Number of motion queue commands the parser has dispatched */
+extern unsigned long stub_motion_calls;
+
+/* Number of serial link commands the parser has dispatched */
+extern unsigned long stub_serial_calls;
+
+#endif
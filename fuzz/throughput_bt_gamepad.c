@@ -0,0 +1,216 @@
+/*
+ * Correctness checks and throughput measurement for the BT gamepad line
+ * parser, built for the host.
+ *
+ * The checks run first, and any failure exits non-zero before anything is
+ * timed. Then a stream of well-formed messages and a stream of malformed
+ * ones are each fed through the parser for about a second, and the rate is
+ * printed as:
+ *
+ *   <stream> <messages/s> <MB/s>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/bt_gamepad.c"
+
+#include "stubs.h"
+
+#define STREAM_MSGS 4096
+
+struct parse_case {
+    const char *input;
+    int8_t lr_axis;
+    int8_t ud_axis;
+    uint8_t button;
+    uint8_t pressed;
+    uint8_t is_input;
+};
+
+/* Each case starts from a cleared state. Button 7 is never pressed by any
+ * of them, so it is used for cases that shouldn't touch the buttons */
+static const struct parse_case cases[] = {
+    { "axis:0:-64:100\n",          -64,  100, 7, 0, 1 },
+    { "axis:0:300:-300\n",         127, -128, 7, 0, 1 },
+    { "axis:0:-9999999:5\n",      -128,    5, 7, 0, 1 },
+    { "axis:0:100:100000000000\n", 100,  127, 7, 0, 1 },
+    { "axis:0:12x:5\n",              0,    0, 7, 0, 0 },
+    { "axis:0::5\n",                 0,    0, 7, 0, 0 },
+    { "axis:0:-:5\n",                0,    0, 7, 0, 0 },
+    { "axis:0:5\n",                  0,    0, 7, 0, 0 },
+    { "btn:3:1\n",                   0,    0, 3, 1, 1 },
+    { "btn:3:0\n",                   0,    0, 3, 0, 1 },
+    { "btn:8:1\n",                   0,    0, 7, 0, 0 },
+    { "btn:-1:1\n",                  0,    0, 7, 0, 0 },
+    { "btn:2x:1\n",                  0,    0, 7, 0, 0 },
+    { "btn:3\n",                     0,    0, 3, 0, 0 },
+    { "get:loop_ms\n",               0,    0, 7, 0, 0 },
+    { "\n\n\n",                      0,    0, 7, 0, 0 },
+};
+
+static void feed(const char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        bt_gamepad_handle_char(s[i], 0);
+}
+
+static int check_cases(void)
+{
+    int failed = 0;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        const struct parse_case *c = cases + i;
+        uint16_t stamp;
+
+        bt_gamepad_init();
+        feed(c->input, strlen(c->input));
+
+        uint8_t is_input = bt_gamepad_take_input(&stamp);
+
+        if (gamepad_state.lr_axis != c->lr_axis
+            || gamepad_state.ud_axis != c->ud_axis
+            || ((gamepad_state.buttons >> c->button) & 1) != c->pressed
+            || is_input != c->is_input) {
+            fprintf(stderr, "FAIL: \"%.*s\": axis %d:%d, btn %d = %d, input %d\n",
+                    (int)strlen(c->input) - 1, c->input,
+                    gamepad_state.lr_axis, gamepad_state.ud_axis,
+                    c->button, (gamepad_state.buttons >> c->button) & 1, is_input);
+            failed = 1;
+        }
+    }
+
+    bt_gamepad_init();
+    unsigned long calls = stub_tune_calls;
+    const char *cmds = "get:loop_ms\nset:spd_step:20\nlist\nsave\nset:x\n";
+    feed(cmds, strlen(cmds));
+    if (stub_tune_calls - calls != 4) {
+        fprintf(stderr, "FAIL: %lu tuning commands dispatched, expected 4\n",
+                stub_tune_calls - calls);
+        failed = 1;
+    }
+
+    /* A character lost on the link drops its whole message, and only that */
+    bt_gamepad_init();
+    uint16_t stamp;
+    feed("axis:0:1", 8);
+    bt_gamepad_handle_error();
+    feed("2:3\n", 4);
+    uint8_t dropped = !bt_gamepad_take_input(&stamp) && !gamepad_state.ud_axis;
+    feed("axis:0:4:5\n", 11);
+    if (!dropped || gamepad_state.ud_axis != 5) {
+        fprintf(stderr, "FAIL: message with a serial error not dropped, or the next one was\n");
+        failed = 1;
+    }
+
+    return failed;
+}
+
+static uint32_t lcg_state = 1;
+
+static uint32_t lcg(void)
+{
+    lcg_state = lcg_state * 1103515245 + 12345;
+    return lcg_state >> 16;
+}
+
+static size_t build_wellformed(char *buf, size_t size)
+{
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < STREAM_MSGS; i++) {
+        int n;
+
+        if (i % 4 == 3)
+            n = snprintf(buf + len, size - len, "btn:%u:%u\n", lcg() % 8, lcg() % 2);
+        else
+            n = snprintf(buf + len, size - len, "axis:0:%d:%d\n",
+                         (int)(lcg() % 256) - 128, (int)(lcg() % 256) - 128);
+
+        len += n;
+    }
+
+    return len;
+}
+
+static size_t build_malformed(char *buf, size_t size)
+{
+    static const char *const near_misses[] = {
+        "axis:0:1a:2\n", "axis:0:\n", "btn:99:1\n", "btn::\n",
+        "axis:0:-128:-99999999999999\n", "bogus:1:2:3\n", ":::::::\n",
+    };
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < STREAM_MSGS; i++) {
+        if (i % 2) {
+            const char *m = near_misses[lcg() % ARRAY_SIZE(near_misses)];
+            size_t n = strlen(m);
+
+            memcpy(buf + len, m, n);
+            len += n;
+        } else {
+            /* Random bytes, up to twice the line length */
+            int n = lcg() % (2 * MSG_LEN);
+
+            while (n--) {
+                char c = lcg();
+                buf[len++] = c == '\n' ? ':' : c;
+            }
+
+            buf[len++] = '\n';
+        }
+    }
+
+    return len;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void measure(const char *name, const char *stream, size_t len)
+{
+    struct car_state car = { .speed_scale = CAR_STATE_SCALE_ONE };
+    unsigned long rounds = 0;
+    double start = now_s(), elapsed;
+
+    bt_gamepad_init();
+
+    do {
+        feed(stream, len);
+        bt_gamepad_apply(&car);
+        rounds++;
+        elapsed = now_s() - start;
+    } while (elapsed < 1.0);
+
+    printf("%s %.0f %.2f\n", name, rounds * STREAM_MSGS / elapsed,
+           rounds * len / elapsed / 1e6);
+}
+
+int main(void)
+{
+    /* Longest message is well under 64 characters */
+    static char buf[STREAM_MSGS * 64];
+    size_t len;
+
+    if (check_cases())
+        return 1;
+
+    len = build_wellformed(buf, sizeof(buf));
+    measure("wellformed", buf, len);
+
+    len = build_malformed(buf, sizeof(buf));
+    measure("malformed", buf, len);
+
+    return 0;
+}
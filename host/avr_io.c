@@ -0,0 +1,83 @@
+/*
+ * Register storage and default hooks for the host builds. See
+ * host/include/avr/io.h.
+ *
+ * The hooks are weak, so a simulator linking this in can replace them.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+volatile uint8_t SREG;
+
+volatile uint8_t PORTB, DDRB, host_PINB;
+volatile uint8_t PORTC, DDRC, host_PINC;
+volatile uint8_t PORTD, DDRD, host_PIND;
+
+volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t OCR1A, OCR1B, host_TCNT1;
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, OCR2B, TIMSK2, TIFR2, TCNT2;
+
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L, UDR0;
+
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2;
+volatile uint8_t MCUSR, WDTCSR;
+
+__attribute__((weak)) volatile uint8_t *host_read_pin(volatile uint8_t *pin)
+{
+    return pin;
+}
+
+__attribute__((weak)) volatile uint16_t *host_read_tcnt1(void)
+{
+    return &host_TCNT1;
+}
+
+__attribute__((weak)) void host_delay_us(double us)
+{
+}
+
+/* The linker's bounds of the host_eeprom section. Weak, for builds without
+ * any EEPROM variables */
+extern uint8_t __start_host_eeprom[] __attribute__((weak));
+extern uint8_t __stop_host_eeprom[] __attribute__((weak));
+
+void host_eeprom_erase(void)
+{
+    if (__start_host_eeprom)
+        memset(__start_host_eeprom, 0xff, __stop_host_eeprom - __start_host_eeprom);
+}
+
+int host_fprintf_P(FILE *f, const char *fmt, ...)
+{
+    char host_fmt[128];
+    size_t i;
+    va_list args;
+    int ret;
+
+    for (i = 0; fmt[i] && i < sizeof(host_fmt) - 1; i++) {
+        host_fmt[i] = fmt[i];
+
+        if (fmt[i] == 'S' && i > 0 && fmt[i - 1] == '%')
+            host_fmt[i] = 's';
+    }
+    host_fmt[i] = '\0';
+
+    va_start(args, fmt);
+    ret = vfprintf(f, host_fmt, args);
+    va_end(args);
+
+    return ret;
+}
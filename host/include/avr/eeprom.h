@@ -0,0 +1,50 @@
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+/* Host stand-in for avr-libc's <avr/eeprom.h>. EEPROM variables are
+ * ordinary variables, so they start out zeroed on every run. They are kept
+ * in a section of their own, for host_eeprom_erase() */
+
+#include <inttypes.h>
+#include <string.h>
+
+#define EEMEM __attribute__((section("host_eeprom")))
+
+/* Sets every EEPROM variable to 0xff, as an erased EEPROM reads */
+void host_eeprom_erase(void);
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p)
+{
+    return *p;
+}
+
+static inline uint16_t eeprom_read_word(const uint16_t *p)
+{
+    return *p;
+}
+
+static inline void eeprom_update_byte(uint8_t *p, uint8_t v)
+{
+    *p = v;
+}
+
+static inline void eeprom_update_word(uint16_t *p, uint16_t v)
+{
+    *p = v;
+}
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t len)
+{
+    memcpy(dst, src, len);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t len)
+{
+    memcpy(dst, src, len);
+}
+
+#define eeprom_write_byte eeprom_update_byte
+#define eeprom_write_word eeprom_update_word
+#define eeprom_write_block eeprom_update_block
+
+#endif
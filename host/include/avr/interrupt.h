@@ -0,0 +1,14 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+/* Host stand-in for avr-libc's <avr/interrupt.h>. sei() and cli() only flip
+ * the I bit in SREG; a simulator checks it before calling an ISR */
+
+#include <avr/io.h>
+
+#define sei() (SREG |= _BV(SREG_I))
+#define cli() (SREG &= ~_BV(SREG_I))
+
+#define ISR(vector) void vector(void)
+
+#endif
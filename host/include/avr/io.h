@@ -0,0 +1,206 @@
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+/*
+ * Host stand-in for avr-libc's <avr/io.h>, for building firmware modules on
+ * the host. It covers the ATmega328P registers the modules use.
+ *
+ * Registers are plain variables, defined in host/avr_io.c. Reads of TCNT1
+ * and the PINx registers go through hooks instead, so a simulator can
+ * advance time and drive the inputs. Without a simulator, the hooks just
+ * return the variables.
+ *
+ * The interrupt vectors are named functions, so a simulator can call the
+ * firmware's ISRs.
+ */
+
+#include <inttypes.h>
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) (sfr)
+
+extern volatile uint8_t SREG;
+
+extern volatile uint8_t PORTB, DDRB, host_PINB;
+extern volatile uint8_t PORTC, DDRC, host_PINC;
+extern volatile uint8_t PORTD, DDRD, host_PIND;
+
+extern volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t OCR1A, OCR1B, host_TCNT1;
+extern volatile uint8_t TCCR2A, TCCR2B, OCR2A, OCR2B, TIMSK2, TIFR2, TCNT2;
+
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L, UDR0;
+
+extern volatile uint8_t GPIOR0, GPIOR1, GPIOR2;
+extern volatile uint8_t MCUSR, WDTCSR;
+
+volatile uint8_t *host_read_pin(volatile uint8_t *pin);
+volatile uint16_t *host_read_tcnt1(void);
+
+#define PINB  (*host_read_pin(&host_PINB))
+#define PINC  (*host_read_pin(&host_PINC))
+#define PIND  (*host_read_pin(&host_PIND))
+#define TCNT1 (*host_read_tcnt1())
+
+#define TIMER1_COMPA_vect host_isr_timer1_compa
+#define TIMER1_COMPB_vect host_isr_timer1_compb
+#define TIMER1_OVF_vect   host_isr_timer1_ovf
+#define TIMER2_COMPA_vect host_isr_timer2_compa
+#define TIMER2_COMPB_vect host_isr_timer2_compb
+#define PCINT1_vect       host_isr_pcint1
+#define USART_RX_vect     host_isr_usart_rx
+#define ADC_vect          host_isr_adc
+
+/* SREG */
+#define SREG_I 7
+
+/* Port bits */
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PINC4 4
+#define PINC5 5
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDC0 0
+#define DDC1 1
+#define DDC2 2
+#define DDC3 3
+#define DDC4 4
+#define DDC5 5
+#define DDD0 0
+#define DDD1 1
+#define DDD2 2
+#define DDD3 3
+#define DDD4 4
+#define DDD5 5
+#define DDD6 6
+#define DDD7 7
+
+/* TIMER0 */
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01  1
+#define WGM00  0
+#define WGM02  3
+#define CS02   2
+#define CS01   1
+#define CS00   0
+
+/* TIMER1 */
+#define WGM13  4
+#define WGM12  3
+#define CS12   2
+#define CS11   1
+#define CS10   0
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1  0
+#define OCF1B  2
+#define OCF1A  1
+#define TOV1   0
+
+/* TIMER2 */
+#define WGM21  1
+#define WGM20  0
+#define CS22   2
+#define CS21   1
+#define CS20   0
+#define OCIE2A 1
+#define OCIE2B 2
+#define OCF2B  2
+
+/* Pin change interrupts */
+#define PCIE2  2
+#define PCIE1  1
+#define PCIE0  0
+#define PCIF2  2
+#define PCIF1  1
+#define PCIF0  0
+
+/* ADC */
+#define REFS1  7
+#define REFS0  6
+#define ADLAR  5
+#define ADEN   7
+#define ADSC   6
+#define ADATE  5
+#define ADIF   4
+#define ADIE   3
+#define ADPS2  2
+#define ADPS1  1
+#define ADPS0  0
+#define ADC3D  3
+
+/* USART0 */
+#define RXC0   7
+#define TXC0   6
+#define UDRE0  5
+#define FE0    4
+#define DOR0   3
+#define UPE0   2
+#define U2X0   1
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ01 2
+#define UCSZ00 1
+
+/* Reset flags */
+#define WDRF   3
+#define BORF   2
+#define EXTRF  1
+#define PORF   0
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+/* Host stand-in for avr-libc's <avr/pgmspace.h>. There is only one address
+ * space, so flash data is ordinary const data */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_ptr(p)  (*(void * const *)(p))
+
+#define strcmp_P strcmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+/* avr-libc's "%S" is a string in flash, which glibc would take as a wide
+ * string, so these rewrite it to "%s" */
+int host_fprintf_P(FILE *f, const char *fmt, ...);
+
+#define fprintf_P host_fprintf_P
+#define printf_P(...) host_fprintf_P(stdout, __VA_ARGS__)
+
+#endif
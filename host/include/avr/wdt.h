@@ -0,0 +1,20 @@
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+/* Host stand-in for avr-libc's <avr/wdt.h>. There is no watchdog, so it
+ * never bites */
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+
+#define wdt_reset()     do { } while (0)
+#define wdt_enable(to)  do { (void)(to); } while (0)
+#define wdt_disable()   do { } while (0)
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+/* Host stand-in for avr-libc's <util/delay.h>. Delays go to a hook, so a
+ * simulator can advance time. Without one they return right away */
+
+void host_delay_us(double us);
+
+static inline void _delay_ms(double ms)
+{
+    host_delay_us(ms * 1000);
+}
+
+static inline void _delay_us(double us)
+{
+    host_delay_us(us);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef HOST_UTIL_SETBAUD_H
+#define HOST_UTIL_SETBAUD_H
+
+/* Host stand-in for avr-libc's <util/setbaud.h>. The UBRR value for BAUD
+ * at F_CPU, always in normal speed mode. Nothing on the host times the
+ * bits, so the rate error avr-libc checks for doesn't matter */
+
+#define UBRR_VALUE (((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+
+#define UBRRL_VALUE (UBRR_VALUE & 0xff)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+
+#define USE_2X 0
+
+#endif
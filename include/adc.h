@@ -0,0 +1,26 @@
+#ifndef INCLUDE_ADC_H
+#define INCLUDE_ADC_H
+
+#include <inttypes.h>
+
+/* MUX values of the sampled channels. ADC6 and ADC7 are analog-only pins */
+#define ADC_BATTERY_MUX     6
+#define ADC_SENSE_LEFT_MUX  3
+#define ADC_SENSE_RIGHT_MUX 7
+
+enum adc_channel {
+    ADC_BATTERY,
+    ADC_SENSE_LEFT,
+    ADC_SENSE_RIGHT,
+    ADC_CHANNELS,
+};
+
+/* Filtered 10-bit readings of every channel, taken at the same moment */
+struct adc_snapshot {
+    uint16_t value[ADC_CHANNELS];
+};
+
+void adc_init(void);
+void adc_read_snapshot(struct adc_snapshot *);
+
+#endif
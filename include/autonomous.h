@@ -0,0 +1,13 @@
+#ifndef INCLUDE_AUTONOMOUS_H
+#define INCLUDE_AUTONOMOUS_H
+
+#include "car_state.h"
+
+void autonomous_start(void);
+void autonomous_stop(struct car_state *);
+uint8_t autonomous_active(void);
+
+/* Runs one decision step. Call once per control loop tick, after scan_tick() */
+void autonomous_tick(struct car_state *);
+
+#endif
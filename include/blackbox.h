@@ -0,0 +1,76 @@
+#ifndef INCLUDE_BLACKBOX_H
+#define INCLUDE_BLACKBOX_H
+
+#include <inttypes.h>
+
+#include "car_state.h"
+
+/*
+ * Watchdog and fault recorder.
+ *
+ * The watchdog is fed once per control loop tick, and resets the car if a
+ * tick never ends. Until then, the loop keeps the last BLACKBOX_SNAPSHOTS
+ * car_state snapshots and the task it is in, in RAM that survives a reset.
+ *
+ * After a watchdog or brown-out reset, those are saved to EEPROM along with
+ * the reset flags, once the motors are stopped again. The record stays
+ * until the next fault, or "bbox:clear". Over the hardware serial:
+ *
+ *   bbox                   Query. Answered with:
+ *
+ *   bbox:reset:<MCUSR>     The reset flags of this boot (WDRF 8, BORF 4,
+ *                          EXTRF 2, PORF 1)
+ *   bbox:fault:<MCUSR>:<task>:<ticks>
+ *                          The last fault, the task it hit in, and the
+ *                          ticks the loop had run
+ *   bbox:snap:<tick>:<left>:<right>:<left speed>:<right speed>:<servo>
+ *                          The snapshots, oldest first
+ *   bbox:fault:none        If there is no record
+ *
+ *   bbox:clear             Erases the record
+ *
+ * "bbox:reset" is also sent at boot.
+ */
+
+#define BLACKBOX_SNAPSHOTS 8
+
+enum blackbox_task {
+    BLACKBOX_TASK_BOOT,
+    BLACKBOX_TASK_EVENTS,
+    BLACKBOX_TASK_EXT,
+    BLACKBOX_TASK_BT,
+    BLACKBOX_TASK_MOTION,
+    BLACKBOX_TASK_SCAN,
+    BLACKBOX_TASK_AUTO,
+    BLACKBOX_TASK_LINE,
+    BLACKBOX_TASK_POWER,
+    BLACKBOX_TASK_RECORDER,
+    BLACKBOX_TASK_IMU,
+    BLACKBOX_TASK_APPLY,
+    BLACKBOX_TASK_REPORT,
+    BLACKBOX_TASK_PROBE,
+    BLACKBOX_TASK_ULTRASONIC,
+    BLACKBOX_TASK_IDLE,
+};
+
+/* In RAM that isn't cleared at reset */
+extern uint8_t blackbox_current_task;
+
+/* Marks what the loop is about to do. A single byte store, so it can go
+ * anywhere */
+static inline void blackbox_task(enum blackbox_task task)
+{
+    blackbox_current_task = task;
+}
+
+/* Saves any fault from before the reset, and starts the watchdog. Call once
+ * the motors are stopped and the serial is up */
+void blackbox_init(void);
+
+/* Feeds the watchdog and takes a snapshot. Call once per tick */
+void blackbox_tick(const struct car_state *);
+
+void blackbox_report(void);
+void blackbox_clear(void);
+
+#endif
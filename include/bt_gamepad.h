@@ -3,9 +3,38 @@
 
 #include "car_state.h"
 
+/* Also clears the axes, the buttons and any message half received */
 void bt_gamepad_init(void);
 
-void bt_gamepad_update_state(void);
+/* Feeds one received serial character to the message parser. 'stamp' is
+ * the clock_stamp() of when it was received */
+void bt_gamepad_handle_char(char, uint16_t stamp);
+
+/* A character was lost or garbled. The message it was part of is dropped */
+void bt_gamepad_handle_error(void);
+
+/* Returns 1 if an axis or button message came in since the last call, and
+ * sets 'stamp' to when the last one was received */
+uint8_t bt_gamepad_take_input(uint16_t *stamp);
+
+#define BT_GAMEPAD_BUTTONS 8
+
+/* Sets the motors from the axes. The buttons are left to the caller */
 void bt_gamepad_apply(struct car_state *);
 
+/* Bit n is set while button n is held */
+uint8_t bt_gamepad_buttons(void);
+
+/* Returns 1 if the axes are centered and no button is held */
+uint8_t bt_gamepad_idle(void);
+
+/*
+ * The controller's part of a control loop tick, once the received
+ * characters have been handled. A new input that isn't all released aborts
+ * any motion script. Then, if 'manual_driving' says nothing else is
+ * driving, the axes set the motors and a new input is tagged for the
+ * latency trace. The buttons are left to the caller.
+ */
+void bt_gamepad_tick(struct car_state *, uint8_t (*manual_driving)(void));
+
 #endif
@@ -0,0 +1,60 @@
+#ifndef INCLUDE_BUTTON_MAP_H
+#define INCLUDE_BUTTON_MAP_H
+
+#include <inttypes.h>
+
+/*
+ * Table-driven button handling, for any controller that can give its
+ * buttons as a packed mask with one bit per button.
+ *
+ * Each entry in a map's action table (kept in flash) names one or more
+ * buttons, when its action runs, and the action. The press and release
+ * edges come from a single XOR against the mask of the last update.
+ *
+ * Repeats are timed on the clock, not counted in ticks, so a held button
+ * repeats at the same rate whatever the loop period is. If an update comes
+ * late, the missed repeats are run then, up to BUTTON_MAX_CATCH_UP of them.
+ */
+
+/* Run when any of the buttons is pressed */
+#define BUTTON_PRESS   (1 << 0)
+/* Run when any of the buttons is released */
+#define BUTTON_RELEASE (1 << 1)
+/* Run on press, then again every 'repeat_ms' after 'delay_ms' while held.
+ * For entries with a single button */
+#define BUTTON_REPEAT  (1 << 2)
+/* Only run while the controller is driving the car, and not some mode */
+#define BUTTON_DRIVING (1 << 3)
+
+#define BUTTON_MAX_CATCH_UP 4
+
+/* 'held' is the whole mask after this update */
+typedef void (*button_action_fn)(uint16_t held);
+
+struct button_action {
+    uint16_t buttons;
+    uint8_t flags;
+
+    uint16_t delay_ms;
+    uint16_t repeat_ms;
+
+    button_action_fn run;
+};
+
+struct button_map {
+    /* In flash */
+    const struct button_action *actions;
+    uint8_t actions_len;
+
+    /* When each repeating action runs next, in clock_micros(). Same
+     * length as 'actions' */
+    uint32_t *repeat_at;
+
+    uint16_t held;
+};
+
+/* Runs the actions for the change from the last update to 'buttons'.
+ * 'driving' is whether BUTTON_DRIVING actions can run */
+void button_map_update(struct button_map *, uint16_t buttons, uint8_t driving);
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef INCLUDE_CAR_STATE_H
 #define INCLUDE_CAR_STATE_H
 
+#include <inttypes.h>
+
+/* motor speed_scale value for no scaling */
+#define CAR_STATE_SCALE_ONE 128
+
 enum motor_dir {
     MOTOR_STOPPED,
     MOTOR_FOR,
@@ -14,20 +19,63 @@ struct car_state {
     uint8_t motor_right_changed :1;
     uint8_t servo_degree_changed :1;
 
+    /* Set by car_state_input_tag(), cleared by car_state_apply() */
+    uint8_t input_tagged :1;
+
     uint8_t motor_left_speed;
     uint8_t motor_right_speed;
     uint8_t servo_degree;
 
+    /* Added to the left and taken from the right motor speed on output */
+    int8_t motor_trim;
+
+    /* Both motor speeds are multiplied by this / CAR_STATE_SCALE_ONE on
+     * output, after the trim */
+    uint8_t speed_scale;
+
     enum motor_dir motor_left;
     enum motor_dir motor_right;
+
+    /* Direction each motor refuses after car_state_*_motor_cut(), or
+     * MOTOR_STOPPED */
+    enum motor_dir motor_left_cut;
+    enum motor_dir motor_right_cut;
+
+    /* Source and clock_stamp() of the input behind this tick's changes */
+    uint8_t input_source;
+    uint16_t input_stamp;
 };
 
 void car_state_init(void);
 void car_state_apply(struct car_state *);
+
+/*
+ * Writes motor settings straight to the outputs, with the trim and speed
+ * scale from 'car', leaving 'car' alone. This is for the motion queue's
+ * timer interrupt. The speed of a stopped motor isn't written.
+ */
+void car_state_output_motors(const struct car_state *car,
+                             enum motor_dir left, uint8_t left_speed,
+                             enum motor_dir right, uint8_t right_speed);
 void car_state_left_motor_set(struct car_state *car, enum motor_dir dir);
 void car_state_right_motor_set(struct car_state *car, enum motor_dir dir);
+
+/*
+ * Stops a motor, and keeps it stopped while it is set to the direction it
+ * had. Setting it to MOTOR_STOPPED or the other direction lifts the cut, so
+ * an input that sets the same direction every tick doesn't restart it.
+ */
+void car_state_left_motor_cut(struct car_state *car);
+void car_state_right_motor_cut(struct car_state *car);
+
 void car_state_servo_degree_set(struct car_state *car, uint8_t servo);
 void car_state_motor_left_speed_set(struct car_state *car, uint8_t speed);
 void car_state_motor_right_speed_set(struct car_state *car, uint8_t speed);
+void car_state_motor_trim_set(struct car_state *car, int8_t trim);
+void car_state_speed_scale_set(struct car_state *car, uint8_t scale);
+
+/* Marks this tick's changes as caused by an input from 'source' that arrived
+ * at 'stamp'. The latency is recorded when car_state_apply() writes them */
+void car_state_input_tag(struct car_state *car, uint8_t source, uint16_t stamp);
 
 #endif
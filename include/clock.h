@@ -0,0 +1,62 @@
+#ifndef INCLUDE_CLOCK_H
+#define INCLUDE_CLOCK_H
+
+#include <inttypes.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "irq_monitor.h"
+
+/*
+ * Monotonic time, built from the free-running TIMER1 plus a count of its
+ * overflows.
+ *
+ * Ticks are 0.5us and wrap every ~35 minutes; micros wrap every ~71 minutes.
+ * Both wrap cleanly, so the difference of two readings is always right as
+ * long as they are less than a wrap apart.
+ */
+
+#define CLOCK_TICKS_PER_US 2
+
+/* Microseconds per clock_stamp() unit */
+#define CLOCK_STAMP_US 4
+
+extern volatile uint32_t clock_overflows;
+
+void clock_init(void);
+
+uint32_t clock_ticks(void);
+uint32_t clock_micros(void);
+
+/*
+ * Short timestamp for tagging events, in CLOCK_STAMP_US units. It is the low
+ * 16 bits of clock_micros() / CLOCK_STAMP_US, so it wraps every ~262ms.
+ *
+ * This is inline so ISRs can use it without saving every register for a
+ * function call. See clock.c for the pending overflow check.
+ */
+static inline uint16_t clock_stamp(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    uint16_t count = TCNT1;
+    uint16_t ovf = clock_overflows;
+
+    if ((TIFR1 & _BV(TOV1)) && count < 0x8000)
+        ovf++;
+
+    IRQ_MONITOR_STOP(IRQ_CLI_CLOCK);
+    SREG = sreg;
+
+    return (ovf << 13) | (count >> 3);
+}
+
+/* Microseconds since 'stamp' was taken, if that was less than a wrap ago */
+static inline uint32_t clock_stamp_age_us(uint16_t stamp)
+{
+    return (uint32_t)(uint16_t)(clock_stamp() - stamp) * CLOCK_STAMP_US;
+}
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef INCLUDE_DEBUG_SERIAL_H
 #define INCLUDE_DEBUG_SERIAL_H
 
+#include <inttypes.h>
+
 void debug_serial_init(void);
 
+/* Characters lost because the output queue was full */
+uint16_t debug_serial_dropped(void);
+
 #endif
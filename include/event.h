@@ -0,0 +1,65 @@
+#ifndef INCLUDE_EVENT_H
+#define INCLUDE_EVENT_H
+
+#include <inttypes.h>
+
+#include "clock.h"
+
+/*
+ * Queue of events from the ISRs to the main loop.
+ *
+ * ISRs post with event_post(), and the main loop takes them off in order
+ * with event_get(). ISRs never nest, so all of them together count as a
+ * single producer and the main loop is the single consumer. That means the
+ * head and tail indexes only ever have one writer each, and no locking is
+ * needed. The indexes are single bytes, so reading them is atomic.
+ */
+
+/* Must be a power of 2 */
+#define EVENT_QUEUE_LEN 32
+
+enum event_type {
+    /* 'data' is the received character */
+    EVENT_SERIAL_RX,
+    /* A character was lost or garbled. 'data' is UCSR0A */
+    EVENT_SERIAL_RX_ERROR,
+};
+
+struct event {
+    uint8_t type;
+    uint8_t data;
+
+    /* clock_stamp() of when the event was posted */
+    uint16_t stamp;
+};
+
+extern volatile struct event event_queue[EVENT_QUEUE_LEN];
+extern volatile uint8_t event_head;
+extern volatile uint8_t event_tail;
+
+/* Number of events lost because the queue was full */
+extern volatile uint8_t event_dropped;
+
+/* Only to be called from an ISR. This is inline so the ISRs posting events
+ * don't have to save every register for a function call */
+static inline void event_post(uint8_t type, uint8_t data)
+{
+    uint8_t head = event_head;
+    uint8_t next = (head + 1) & (EVENT_QUEUE_LEN - 1);
+
+    if (next == event_tail) {
+        event_dropped++;
+        return ;
+    }
+
+    event_queue[head].type = type;
+    event_queue[head].data = data;
+    event_queue[head].stamp = clock_stamp();
+
+    event_head = next;
+}
+
+/* Returns 1 and fills in 'ev' if there was an event waiting */
+uint8_t event_get(struct event *ev);
+
+#endif
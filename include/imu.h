@@ -0,0 +1,25 @@
+#ifndef INCLUDE_IMU_H
+#define INCLUDE_IMU_H
+
+#include <inttypes.h>
+
+#include "car_state.h"
+
+/* Yaw is kept as raw gyro LSBs times milliseconds. The gyro is set to
+ * 131 LSB per degree/s, so one degree is 131000 units */
+#define IMU_YAW_UNITS_PER_DEG 131000L
+
+/* Returns 0 if an IMU was found. It only counts as present, and heading hold
+ * only starts, once the bias has been measured over the following updates */
+int imu_init(void);
+uint8_t imu_present(void);
+
+/* Reads the gyro and integrates yaw over the time since the last update */
+void imu_update(void);
+int32_t imu_yaw(void);
+
+/* Trims the motor PWM to hold the heading while the car is driving straight
+ * forward, and clears the trim otherwise */
+void imu_heading_hold(struct car_state *);
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef INCLUDE_IRQ_MONITOR_H
+#define INCLUDE_IRQ_MONITOR_H
+
+#include <inttypes.h>
+#include <avr/io.h>
+
+#include "tune.h"
+
+/*
+ * Interrupt timing monitor, built in with "make IRQ_MONITOR=1". Without it
+ * everything here compiles to nothing.
+ *
+ * Each ISR and each section that runs with interrupts off is timed on the
+ * free-running TIMER1, in 0.5us ticks:
+ *
+ *   - Execution time: from the top of the ISR body (or the cli()) to the end
+ *     of it. The register saving and restoring around an ISR body isn't
+ *     included.
+ *   - Entry latency, for the interrupts that know when they were due: the
+ *     TIMER1 compare and overflow interrupts, and the TIMER2 compare. This
+ *     is the time from the hardware event to the top of the ISR body, which
+ *     includes any time interrupts were held off by something else.
+ *     TIMER2 compare B has OCR2B at 0, so it counts like compare A.
+ *
+ * Anything that takes longer than the irq_bud tuning parameter, either to
+ * run or to get started, is counted as over budget.
+ *
+ * The monitor adds a few us to each ISR, so the numbers are a little
+ * pessimistic.
+ */
+
+enum irq_source {
+    /* ISRs */
+    IRQ_SERVO,          /* TIMER1_COMPA */
+    IRQ_LINE,           /* TIMER1_COMPB */
+    IRQ_CLOCK,          /* TIMER1_OVF */
+    IRQ_DEBUG_TX,       /* TIMER2_COMPA */
+    IRQ_SERIAL_RX,      /* USART_RX */
+    IRQ_ADC,            /* ADC */
+    IRQ_MOTION,         /* TIMER2_COMPB */
+    IRQ_ULTRASONIC,     /* PCINT1 */
+
+    /* Sections with interrupts off */
+    IRQ_CLI_SERVO,      /* servo_set() and friends */
+    IRQ_CLI_CLOCK,      /* Reading the clock */
+    IRQ_CLI_DEBUG_TX,   /* Starting the debug serial */
+    IRQ_CLI_LINE,       /* line_sensor_read() */
+    IRQ_CLI_MOTION,     /* The motion queue's state */
+    IRQ_CLI_ULTRASONIC, /* Starting and collecting pings */
+    IRQ_CLI_SERIAL,     /* The receive error counters */
+
+    IRQ_SOURCES,
+};
+
+/* Bucket 0 is under 1us, each next one doubles, and the last one is
+ * everything from 64us up */
+#define IRQ_MONITOR_BUCKETS 8
+
+#ifdef IRQ_MONITOR
+
+#define IRQ_NO_LATENCY 0xFFFF
+
+struct irq_stats {
+    uint16_t count;
+    uint16_t over_budget;
+
+    /* TIMER1 ticks */
+    uint16_t max_latency;
+    uint16_t max_exec;
+
+    uint16_t latency_buckets[IRQ_MONITOR_BUCKETS];
+    uint16_t exec_buckets[IRQ_MONITOR_BUCKETS];
+};
+
+/* Only written with interrupts off */
+extern struct irq_stats irq_stats[IRQ_SOURCES];
+
+static inline void irq_monitor_count(uint16_t *bucket)
+{
+    if (*bucket != UINT16_MAX)
+        (*bucket)++;
+}
+
+static inline uint8_t irq_monitor_bucket(uint16_t ticks)
+{
+    uint8_t b = 0;
+
+    ticks >>= 1;
+    while (ticks && b < IRQ_MONITOR_BUCKETS - 1) {
+        ticks >>= 1;
+        b++;
+    }
+
+    return b;
+}
+
+/*
+ * Inline, like event_post(), so an ISR being timed doesn't have to save
+ * every call-clobbered register just for the monitor.
+ */
+static inline void irq_monitor_record(uint8_t source, uint16_t latency, uint16_t exec)
+{
+    struct irq_stats *s = irq_stats + source;
+    uint16_t budget = (uint16_t)tune.irq_budget_us * 2;
+
+    irq_monitor_count(&s->count);
+
+    if (exec > s->max_exec)
+        s->max_exec = exec;
+    irq_monitor_count(s->exec_buckets + irq_monitor_bucket(exec));
+
+    if (latency != IRQ_NO_LATENCY) {
+        if (latency > s->max_latency)
+            s->max_latency = latency;
+        irq_monitor_count(s->latency_buckets + irq_monitor_bucket(latency));
+    }
+
+    if (exec > budget || (latency != IRQ_NO_LATENCY && latency > budget))
+        irq_monitor_count(&s->over_budget);
+}
+
+/*
+ * IRQ_MONITOR_START() goes at the top of an ISR body, or right after a
+ * cli(). IRQ_MONITOR_STOP() goes at the end of the ISR, or right before
+ * interrupts are turned back on.
+ *
+ * IRQ_MONITOR_START_DUE() is for interrupts that were due when TIMER1 hit
+ * 'due', and IRQ_MONITOR_START_LATE() for ones that know how many ticks ago
+ * they were due.
+ */
+#define IRQ_MONITOR_START() \
+    uint16_t irq_monitor_start = TCNT1; \
+    uint16_t irq_monitor_latency = IRQ_NO_LATENCY
+
+#define IRQ_MONITOR_START_DUE(due) \
+    uint16_t irq_monitor_start = TCNT1; \
+    uint16_t irq_monitor_latency = irq_monitor_start - (due)
+
+#define IRQ_MONITOR_START_LATE(ticks) \
+    uint16_t irq_monitor_latency = (ticks); \
+    uint16_t irq_monitor_start = TCNT1
+
+#define IRQ_MONITOR_STOP(source) \
+    irq_monitor_record((source), irq_monitor_latency, TCNT1 - irq_monitor_start)
+
+/* Called every tick. Reports and clears the stats every
+ * IRQ_MONITOR_REPORT_TICKS ticks */
+void irq_monitor_tick(void);
+
+#else
+
+#define IRQ_MONITOR_START() do { } while (0)
+#define IRQ_MONITOR_START_DUE(due) do { } while (0)
+#define IRQ_MONITOR_START_LATE(ticks) do { } while (0)
+#define IRQ_MONITOR_STOP(source) do { } while (0)
+
+static inline void irq_monitor_tick(void)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef INCLUDE_LATENCY_H
+#define INCLUDE_LATENCY_H
+
+#include <inttypes.h>
+
+/*
+ * Input-to-actuation latency tracing.
+ *
+ * Inputs are stamped with clock_stamp() where they arrive: the byte in the
+ * serial RX interrupt for the BT gamepad, or the end of the TWI read for the
+ * SNES controller. The stamp is handed to car_state along with the state
+ * change it causes, and car_state_apply() records the latency once the
+ * change has been written to the motors or servo. Inputs that don't change
+ * any output aren't recorded.
+ */
+
+enum latency_source {
+    LATENCY_BT,
+    LATENCY_SNES,
+    LATENCY_SOURCES,
+};
+
+/* Bucket 0 is under 1ms, each next one doubles, and the last one is
+ * everything from 64ms up */
+#define LATENCY_BUCKETS 8
+
+void latency_record(uint8_t source, uint16_t stamp);
+
+/* Called every tick. Reports and clears the histograms every
+ * LATENCY_REPORT_TICKS ticks */
+void latency_tick(void);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef INCLUDE_LINE_FOLLOW_H
+#define INCLUDE_LINE_FOLLOW_H
+
+#include "car_state.h"
+
+void line_follow_start(void);
+void line_follow_stop(struct car_state *);
+uint8_t line_follow_active(void);
+
+/* Steers from the line sensor. Call once per control loop tick */
+void line_follow_tick(struct car_state *);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef INCLUDE_LINE_SENSOR_H
+#define INCLUDE_LINE_SENSOR_H
+
+#include <inttypes.h>
+
+/*
+ * IR reflectance array for line following. Every channel is on the same
+ * port, so one read of LINE_SENSOR_PIN samples all of them at once. A
+ * channel reads 1 over the line.
+ *
+ * PB2, PB4 and PB5 are the only pins left free on a single port, so the
+ * array has three channels, left to right. Wiring more channels to a port
+ * of their own means changing these and the table in line_sensor.c.
+ */
+#define LINE_SENSOR_PIN  PINB
+#define LINE_SENSOR_DDR  DDRB
+#define LINE_SENSOR_PORT PORTB
+#define LINE_SENSOR_MASK (_BV(PINB2) | _BV(PINB4) | _BV(PINB5))
+#define LINE_SENSOR_SHIFT 2
+
+/* Positions go from -100, under the leftmost channel, to 100 under the
+ * rightmost one */
+#define LINE_POSITION_MAX 100
+#define LINE_POSITION_LOST INT8_MIN
+
+void line_sensor_init(void);
+
+/* Average line position over the samples since the last call, or
+ * LINE_POSITION_LOST if none of them saw the line */
+int8_t line_sensor_read(void);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef INCLUDE_MOTION_H
+#define INCLUDE_MOTION_H
+
+#include <inttypes.h>
+
+#include "car_state.h"
+
+/*
+ * Scripted motion: a queue of timed steps, each setting both motors and
+ * optionally the servo, run back to back on a timer rather than on the
+ * control loop ticks.
+ *
+ * Steps are loaded and run over the hardware serial (see bt_gamepad.c):
+ *
+ *   mq:<ms>:<left>:<right>[:<servo>]   Add a step. Speeds are -255..255,
+ *                                      negative is backward, and 0 stops
+ *                                      that motor. Without a servo degree
+ *                                      the servo is left where it is
+ *   mq:run                             Run the queue from the top
+ *   mq:stop                            Stop running and stop the motors
+ *   mq:clear                           Empty the queue
+ *   mq:stat                            Report the queue state
+ *
+ * and report back as:
+ *
+ *   mq:ok:<steps queued>
+ *   mq:err:<full|busy|bad>
+ *   mq:run:<steps>
+ *   mq:done:<steps run>:<max late us>
+ *   mq:stop:<steps run>:<max late us>
+ *   mq:abort:<steps run>:<max late us>
+ *   mq:stat:<running>:<step>:<steps queued>:<max late us>
+ *
+ * A running queue is aborted by anything else setting the motors, such as
+ * the stall cutoff or a mode, and by any live controller input. The queue
+ * itself is kept, so it can be run again.
+ */
+
+#define MOTION_QUEUE_LEN 16
+
+/* The car the steps are written to, from the timer interrupt */
+void motion_init(struct car_state *);
+
+/* The serial commands. These only touch the queue, motion_tick() does the
+ * rest, except that motion_stop() stops the motors itself */
+void motion_add(uint16_t ms, int16_t left, int16_t right, int16_t servo);
+void motion_run(void);
+void motion_stop(void);
+void motion_clear(void);
+void motion_report(void);
+
+uint8_t motion_running(void);
+
+/* Stops the queue and the motors right away, for live controller input */
+void motion_abort(struct car_state *);
+
+/* Call once per tick before anything else sets the motors. Mirrors the
+ * step being run into car_state, and handles a queue that ended */
+void motion_tick(struct car_state *);
+
+/* Called by car_state_apply() before it writes the motors. Returns 1 if the
+ * queue still has the motors, and they should be left alone */
+uint8_t motion_owns_motors(struct car_state *);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef INCLUDE_POWER_H
+#define INCLUDE_POWER_H
+
+#include "car_state.h"
+
+/* The battery is read through a divider, so that a full pack reads below
+ * the 5V AVcc reference */
+#define POWER_BATTERY_DIVIDER 3
+#define POWER_NOMINAL_MV 7400
+
+/* The L298N sense pins go to ground through these */
+#define POWER_SENSE_MILLIOHM 500
+
+void power_init(void);
+
+/* Compensates the motor PWM for battery sag, and cuts any motor that has
+ * been stalled. Call once per control loop tick, after the inputs */
+void power_update(struct car_state *);
+
+uint16_t power_battery_mv(void);
+
+#endif
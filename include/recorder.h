@@ -0,0 +1,40 @@
+#ifndef INCLUDE_RECORDER_H
+#define INCLUDE_RECORDER_H
+
+#include "car_state.h"
+
+/* Saves each recording to EEPROM over the ticks after it stops, and loads
+ * it back at boot */
+#define RECORDER_EEPROM
+
+/* Bytes of recording kept in RAM. Each change takes 2 bytes */
+#define RECORDER_BUF_LEN 256
+
+enum recorder_field {
+    REC_LEFT_DIR,
+    REC_RIGHT_DIR,
+    REC_SERVO,
+    REC_LEFT_SPEED,
+    REC_RIGHT_SPEED,
+    REC_WAIT = 7,
+};
+
+void recorder_init(void);
+
+void recorder_start(struct car_state *);
+void recorder_stop(void);
+uint8_t recorder_recording(void);
+
+void recorder_replay_start(void);
+void recorder_replay_stop(struct car_state *);
+uint8_t recorder_replaying(void);
+
+/* Called from the car_state setters whenever a field changes */
+void recorder_log(enum recorder_field field, uint8_t value);
+
+/* Advances the recording clock, while replaying applies every change that
+ * is due, and saves the next chunk of a stopped recording. Call once per
+ * control loop tick */
+void recorder_tick(struct car_state *);
+
+#endif
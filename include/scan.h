@@ -0,0 +1,35 @@
+#ifndef INCLUDE_SCAN_H
+#define INCLUDE_SCAN_H
+
+#include "car_state.h"
+
+/* Number of sectors the servo range is split into */
+#define SCAN_SECTORS 16
+
+/* Sector values are the distance in cm / 2, saturated at 255. A sector that
+ * has not been measured yet holds SCAN_UNKNOWN. */
+#define SCAN_UNKNOWN 0
+
+/* Returned by scan_updated_sector() when the last tick did not range */
+#define SCAN_NONE 0xFF
+
+void scan_init(void);
+
+void scan_start(void);
+void scan_stop(void);
+uint8_t scan_active(void);
+
+/* Limits the sweep to sectors 'first' to 'last'. scan_start() sweeps them
+ * all */
+void scan_set_range(uint8_t first, uint8_t last);
+
+/* Advances the scan by one step. Call once per control loop tick */
+void scan_tick(struct car_state *);
+
+uint8_t scan_sector(uint8_t sector);
+uint8_t scan_sector_degree(uint8_t sector);
+
+/* The sector that was ranged during the last scan_tick(), or SCAN_NONE */
+uint8_t scan_updated_sector(void);
+
+#endif
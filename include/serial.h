@@ -1,7 +1,44 @@
 #ifndef INCLUDE_SERIAL_H
 #define INCLUDE_SERIAL_H
 
-void serial_init(void (*char_callback) (char c));
+#include <stdio.h>
+
+/* Stream writing to the hardware serial, for telemetry */
+extern FILE *serial_out;
+
+/* Received characters are posted as EVENT_SERIAL_RX events, and characters
+ * that came in corrupted, or after lost ones, as EVENT_SERIAL_RX_ERROR */
+void serial_init(void);
 void serial_send_char(char);
 
+/*
+ * Runtime baud rate switching, over the link itself. The rate always starts
+ * out as the Makefile's BAUD, and one of 38400, 57600 or 115200 can be
+ * switched to:
+ *
+ *   -> baud:<rate>          Asks for a switch
+ *   <- baud:try:<rate>      Sent at the old rate, then the car switches
+ *   -> baud:ok              Sent at the new rate within SERIAL_BAUD_CONFIRM_MS
+ *   <- baud:ok:<rate>       The new rate is kept
+ *
+ * If the confirmation doesn't come through in time, the car switches back
+ * and sends "baud:revert:<rate>" at the old rate. "baud:err:<rate>" means
+ * the rate isn't supported, or a switch is already waiting.
+ *
+ * The error counters are cleared on every switch, so "uart" shows how well
+ * the current rate is doing.
+ */
+#define SERIAL_BAUD_CONFIRM_MS 2000
+
+void serial_baud_try(const char *rate);
+void serial_baud_confirm(void);
+
+/* Reverts an unconfirmed switch once it times out. Call once per tick */
+void serial_tick(void);
+
+/* Sends "uart:<baud>:<framing>:<overrun>:<parity>:<dropped>": the receive
+ * errors since the last switch, and the events the queue dropped since
+ * boot */
+void serial_report(void);
+
 #endif
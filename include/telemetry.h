@@ -0,0 +1,49 @@
+#ifndef INCLUDE_TELEMETRY_H
+#define INCLUDE_TELEMETRY_H
+
+#include <inttypes.h>
+
+/*
+ * Binary telemetry frames, sent over the hardware serial mixed in with the
+ * text telemetry lines. A frame is:
+ *
+ *   TELEMETRY_SYNC, type, payload length, payload..., check
+ *
+ * where 'check' is the XOR of the type, length and payload bytes. The text
+ * lines are plain ASCII, so they never contain TELEMETRY_SYNC. Multi-byte
+ * payload fields are little-endian.
+ *
+ * This header is also used by the host tools, so it must not depend on
+ * anything AVR specific.
+ */
+
+#define TELEMETRY_SYNC 0xA5
+
+enum telemetry_type {
+    /* Sent at the end of every control loop tick */
+    TELEMETRY_TICK = 1,
+
+    /* Sent when an input has made it out to the motors or servo */
+    TELEMETRY_LATENCY = 2,
+};
+
+struct telemetry_tick {
+    /* clock_micros() at the start of the tick */
+    uint32_t start_us;
+
+    /* How long the tick's work took */
+    uint16_t work_us;
+} __attribute__((packed));
+
+struct telemetry_latency {
+    uint8_t source;
+
+    /* clock_micros() when the input arrived, and when the output it caused
+     * was written */
+    uint32_t input_us;
+    uint32_t actuate_us;
+} __attribute__((packed));
+
+void telemetry_send_frame(uint8_t type, const void *payload, uint8_t len);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef INCLUDE_TUNE_H
+#define INCLUDE_TUNE_H
+
+#include <inttypes.h>
+
+/* Parameters that can be changed at runtime over the serial link */
+struct tune_params {
+    /* Length of one control loop tick */
+    uint8_t loop_period_ms;
+
+    /* Quiet time in ms between the end of one ultrasonic ping and the start
+     * of the next, for the echoes of the last one to die down */
+    uint8_t ultrasonic_gap_ms;
+
+    /* Motor speed and servo change per press of the controller buttons.
+     * Held, they repeat on a timer, at the same rate whatever the loop
+     * period (see button_map.h) */
+    uint8_t speed_step;
+    uint8_t servo_step;
+
+    /* Added to the BT gamepad motor PWM, to get over the motor deadband */
+    uint8_t pwm_offset;
+
+    /* Send the binary telemetry frames (see telemetry.h) */
+    uint8_t telemetry_frames;
+
+    /*
+     * Obstacle avoidance: driving PWM, how close something in front has to
+     * be to turn away from it, and how much room a direction needs to be
+     * taken (see autonomous.c)
+     */
+    uint8_t auto_speed;
+    uint8_t auto_obstacle_cm;
+    uint8_t auto_clear_cm;
+
+    /* Line following: PWM and PD gains in 1/16ths (see line_follow.c) */
+    uint8_t line_speed;
+    uint8_t line_kp;
+    uint8_t line_kd;
+
+    /* Interrupt timing budget in us, for builds with the monitor in
+     * irq_monitor.h */
+    uint8_t irq_budget_us;
+};
+
+extern struct tune_params tune;
+
+/* Sets every parameter to its default, or to the value committed to
+ * EEPROM if there is one */
+void tune_init(void);
+
+/*
+ * The commands. Results are sent over the hardware serial as
+ * "tune:<name>:<value>", or "tune:err:<name>" if something went wrong.
+ */
+void tune_get(const char *name);
+void tune_set(const char *name, const char *value);
+void tune_list(void);
+void tune_save(void);
+
+#endif
@@ -3,6 +3,15 @@
 
 #include <inttypes.h>
 
+/* Status codes returned by the transfer functions */
+enum twi_status {
+    TWI_OK,
+    TWI_ADDR_NACK,  /* Nothing answered at the address */
+    TWI_DATA_NACK,  /* The device refused a byte we wrote */
+    TWI_TIMEOUT,    /* A device held SCL low too long */
+    TWI_ARB_LOST,   /* SDA was low when we let it go high */
+};
+
 void twi_master_init(void);
 
 /* Writes 'count' bytes from 'data' to address */
@@ -13,4 +22,13 @@ uint8_t twi_write_reg_data(uint8_t address, uint8_t reg, const uint8_t *data, ui
 uint8_t twi_read_data(uint8_t address, uint8_t *data, uint8_t count);
 uint8_t twi_read_reg_data(uint8_t address, uint8_t reg, uint8_t *data, uint8_t count);
 
+/*
+ * The transfer functions above retry a few times with backoff, and recover
+ * the bus if a device is holding SDA low, before returning an error.
+ *
+ * Failed attempts are counted per address, for the first few addresses used.
+ */
+uint16_t twi_error_count(uint8_t address);
+uint8_t twi_last_status(uint8_t address);
+
 #endif
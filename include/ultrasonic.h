@@ -1,15 +1,70 @@
 #ifndef INCLUDE_ULTRASONIC_H
 #define INCLUDE_ULTRASONIC_H
 
-#define ULTRASONIC_TRIG_PORT  PORTC
-#define ULTRASONIC_TRIG_PIN_N PORTC5
+#include <inttypes.h>
 
+/*
+ * The sensors, in the order they are pinged. The front one is on the servo,
+ * the left and right ones are fixed, pointing sideways.
+ */
+enum ultrasonic_sensor {
+    ULTRASONIC_FRONT,
+    ULTRASONIC_LEFT,
+    ULTRASONIC_RIGHT,
+
+    ULTRASONIC_SENSORS,
+};
+
+#define ULTRASONIC_FRONT_TRIG_PORT  PORTC
+#define ULTRASONIC_FRONT_TRIG_DDR   DDRC
+#define ULTRASONIC_FRONT_TRIG_PIN_N PORTC5
+
+#define ULTRASONIC_LEFT_TRIG_PORT   PORTD
+#define ULTRASONIC_LEFT_TRIG_DDR    DDRD
+#define ULTRASONIC_LEFT_TRIG_PIN_N  PORTD2
+
+#define ULTRASONIC_RIGHT_TRIG_PORT  PORTD
+#define ULTRASONIC_RIGHT_TRIG_DDR   DDRD
+#define ULTRASONIC_RIGHT_TRIG_PIN_N PORTD4
+
+/*
+ * Every echo is on one port, so a single pin change interrupt times them
+ * all. Port C has no pins left, so the left and right echoes are diode-ORed
+ * onto the front one. Only one sensor pings at a time, so sharing the pin
+ * costs nothing.
+ */
 #define ULTRASONIC_ECHO_PIN   PINC
-#define ULTRASONIC_ECHO_PIN_N PINC4
+#define ULTRASONIC_ECHO_DDR   DDRC
+#define ULTRASONIC_ECHO_PCMSK PCMSK1
+#define ULTRASONIC_ECHO_PCIE  PCIE1
+#define ULTRASONIC_ECHO_vect  PCINT1_vect
+
+#define ULTRASONIC_FRONT_ECHO_PIN_N PINC4
+#define ULTRASONIC_LEFT_ECHO_PIN_N  PINC4
+#define ULTRASONIC_RIGHT_ECHO_PIN_N PINC4
 
 void ultrasonic_init(void);
 
-/* Returned value is in cm */
-uint16_t ultrasonic_read_distance(void);
+/* Starts the next ping once the last one is done and its sound has died
+ * down, and collects finished ones. Never blocks, so it can be called as
+ * often as possible. The main loop calls it while waiting for the next
+ * tick */
+void ultrasonic_poll(void);
+
+/* ultrasonic_poll(), plus the per-sensor report. Call once per tick */
+void ultrasonic_tick(void);
+
+/* A distance of ULTRASONIC_NO_ECHO means no echo came back */
+#define ULTRASONIC_NO_ECHO 0
+
+/* Returns 1, and sets 'cm', if a ping of 'sensor' triggered at or after
+ * clock_micros() 'since' has finished */
+uint8_t ultrasonic_read(uint8_t sensor, uint32_t since, uint16_t *cm);
+
+/* Latest distance from 'sensor' in cm */
+uint16_t ultrasonic_distance(uint8_t sensor);
+
+/* clock_micros() at the end of the last successful reading of 'sensor' */
+uint32_t ultrasonic_last_reading_time(uint8_t sensor);
 
 #endif
@@ -0,0 +1,77 @@
+#ifndef WII_EXT_H
+#define WII_EXT_H
+
+#include <inttypes.h>
+
+/*
+ * Wii extension controllers on the TWI bus. The Classic Controller, the
+ * Classic Controller Pro and the SNES Classic all report the same buttons,
+ * and the first two also have two sticks and two analog triggers. The
+ * Nunchuk has a stick and the C and Z buttons.
+ *
+ * Bits of the button mask. These are the bits of the Classic Controller's
+ * button bytes, low then high, which are active-low.
+ */
+#define WII_BUTTON_R      (1 << 1)
+#define WII_BUTTON_START  (1 << 2)
+#define WII_BUTTON_HOME   (1 << 3)
+#define WII_BUTTON_SELECT (1 << 4)
+#define WII_BUTTON_L      (1 << 5)
+#define WII_BUTTON_DOWN   (1 << 6)
+#define WII_BUTTON_RIGHT  (1 << 7)
+#define WII_BUTTON_UP     (1 << 8)
+#define WII_BUTTON_LEFT   (1 << 9)
+#define WII_BUTTON_ZR     (1 << 10)
+#define WII_BUTTON_X      (1 << 11)
+#define WII_BUTTON_A      (1 << 12)
+#define WII_BUTTON_Y      (1 << 13)
+#define WII_BUTTON_B      (1 << 14)
+#define WII_BUTTON_ZL     (1 << 15)
+
+#define WII_BUTTONS_ALL 0xFFFE
+
+/* Where the Nunchuk's buttons show up */
+#define WII_BUTTON_C WII_BUTTON_A
+#define WII_BUTTON_Z WII_BUTTON_B
+
+enum wii_ext_stick {
+    WII_EXT_LX,
+    WII_EXT_LY,
+    WII_EXT_RX,
+    WII_EXT_RY,
+
+    WII_EXT_STICKS,
+};
+
+enum wii_ext_trigger {
+    WII_EXT_LT,
+    WII_EXT_RT,
+
+    WII_EXT_TRIGGERS,
+};
+
+struct wii_ext_state {
+    /* WII_BUTTON_* bits of the buttons held */
+    uint16_t buttons;
+
+    /* Scaled to 8 bits whatever the controller's resolution, and centered
+     * at 0. Right and up are positive. A stick the controller doesn't have
+     * reads 0 */
+    int8_t stick[WII_EXT_STICKS];
+
+    /* 0 released, 255 all the way in */
+    uint8_t trigger[WII_EXT_TRIGGERS];
+
+    /* clock_stamp() of when the read finished */
+    uint16_t stamp;
+};
+
+/* Identifies the controller, and switches it to high resolution reports if
+ * it has them. Returns 0 if a known controller answered */
+int wii_ext_init(void);
+
+/* Returns a TWI status. If it isn't 0, every button reads as released and
+ * every stick as centered */
+int wii_ext_read_state(struct wii_ext_state *);
+
+#endif
@@ -0,0 +1,517 @@
+/*
+ * Replays captured BT serial sessions against the host build of the serial
+ * receiver, the BT gamepad parser and car_state, and checks the motor and
+ * servo commands they come up with against a golden copy.
+ *
+ * A capture is text, a line per burst of received bytes:
+ *
+ *   <us> <byte> <byte>...
+ *
+ * '<us>' is when the first byte was received, from the start of the
+ * session. The bytes are in hex, each received a character time after the
+ * one before it at the current baud rate. A byte that came in with receive
+ * errors has their flags after a '/': 'f' framing, 'o' overrun, 'p' parity,
+ * as in "3a/f". Lines starting with '#' are comments.
+ *
+ * Every byte goes through the firmware's USART_RX_vect, with UCSR0A and
+ * UDR0 set the way the receiver leaves them, so the event queue overflows
+ * and errors drop messages just like on the car. The control loop runs
+ * every 'loop_ms' the way main.c's BT branch does. The button actions are
+ * main.c's, so they aren't replayed, the held buttons are in the output
+ * instead:
+ *
+ *   <ms> out:<left>:<left pwm>:<right>:<right pwm>:<servo>:<buttons>
+ *                          After each tick that changed any of them
+ *   <ms> tx:<line>         A line the car sent back
+ *
+ * The golden output of "x.cap" is "x.golden". With -u it is written instead
+ * of checked. The sessions run as fast as they go, or with -x at that
+ * multiple of the recorded speed, 1 being real time.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "car_state.h"
+#include "l298n.h"
+#include "servo.h"
+#include "event.h"
+#include "latency.h"
+#include "recorder.h"
+#include "motion.h"
+#include "blackbox.h"
+#include "bt_gamepad.h"
+#include "tune.h"
+
+/* Included, for the rate it is at. serial.c sets up its stream with
+ * avr-libc's macros, serial_out is pointed at the output instead */
+#define FDEV_SETUP_STREAM(put, get, flags) { 0 }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "../src/serial.c"
+#pragma GCC diagnostic pop
+
+#define TICKS_PER_US 2
+#define TICKS_PER_MS (1000 * TICKS_PER_US)
+
+/* The transmitter is always done, replies go straight to the output */
+#define UCSR0A_TX_IDLE (_BV(UDRE0) | _BV(TXC0))
+
+/* Long enough for an unconfirmed baud switch to revert */
+#define TAIL_MS (SERIAL_BAUD_CONFIRM_MS + 100)
+
+void host_isr_usart_rx(void);
+void host_isr_timer1_ovf(void);
+
+static struct replay {
+    /* In clock ticks */
+    uint64_t now;
+    uint64_t next_tick;
+
+    /* Pacing against the wall clock, 0 for none */
+    double speed;
+    struct timespec start;
+
+    FILE *out;
+    int tx_line_start;
+
+    /* What the stubs below were last told to do */
+    enum motor_dir left, right;
+    int servo;
+
+    /* As of the last "out" line */
+    char last[64];
+} replay;
+
+/* Stand-ins for the modules car_state.c drives */
+
+void l298n_init(void) {}
+void l298n_left_stop(void) { replay.left = MOTOR_STOPPED; }
+void l298n_left_forward(void) { replay.left = MOTOR_FOR; }
+void l298n_left_backward(void) { replay.left = MOTOR_BACK; }
+void l298n_right_stop(void) { replay.right = MOTOR_STOPPED; }
+void l298n_right_forward(void) { replay.right = MOTOR_FOR; }
+void l298n_right_backward(void) { replay.right = MOTOR_BACK; }
+
+void servo_init(void) {}
+int servo_register(uint8_t volatile *port, uint8_t pin) { return 0; }
+void servo_set(int v) { replay.servo = v; }
+
+void recorder_log(enum recorder_field field, uint8_t value) {}
+void latency_record(uint8_t source, uint16_t stamp) {}
+
+/* The commands that go elsewhere only show up as a line in the output */
+
+void motion_add(uint16_t ms, int16_t left, int16_t right, int16_t servo)
+{
+    fprintf(serial_out, "stub:mq:%u:%d:%d:%d\n", ms, left, right, servo);
+}
+
+void motion_run(void) { fprintf(serial_out, "stub:mq:run\n"); }
+void motion_stop(void) { fprintf(serial_out, "stub:mq:stop\n"); }
+void motion_clear(void) { fprintf(serial_out, "stub:mq:clear\n"); }
+void motion_report(void) { fprintf(serial_out, "stub:mq:stat\n"); }
+uint8_t motion_owns_motors(struct car_state *car) { return 0; }
+
+/* The queue never runs, so there is never anything to abort */
+void motion_abort(struct car_state *car) {}
+
+void blackbox_report(void) { fprintf(serial_out, "stub:bbox\n"); }
+void blackbox_clear(void) { fprintf(serial_out, "stub:bbox:clear\n"); }
+
+volatile uint16_t *host_read_tcnt1(void)
+{
+    host_TCNT1 = replay.now;
+    return &host_TCNT1;
+}
+
+static unsigned long now_ms(void)
+{
+    return replay.now / TICKS_PER_MS;
+}
+
+/* Prefixes each line the car sends with the time */
+static ssize_t serial_write(void *cookie, const char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (replay.tx_line_start)
+            fprintf(replay.out, "%lu tx:", now_ms());
+
+        fputc(buf[i], replay.out);
+        replay.tx_line_start = buf[i] == '\n';
+    }
+
+    return len;
+}
+
+static void pace(void)
+{
+    struct timespec due = replay.start;
+    double s = replay.now / (TICKS_PER_MS * 1000.0) / replay.speed;
+
+    due.tv_sec += (time_t)s;
+    due.tv_nsec += (long)((s - (time_t)s) * 1e9);
+    if (due.tv_nsec >= 1000000000L) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+}
+
+/* Moves the clock forward, with the overflow interrupts on the way */
+static void advance_to(uint64_t t)
+{
+    while ((replay.now >> 16) != (t >> 16)) {
+        replay.now = (replay.now | 0xffff) + 1;
+        host_isr_timer1_ovf();
+    }
+
+    replay.now = t;
+
+    if (replay.speed > 0)
+        pace();
+}
+
+static void receive(uint8_t data, uint8_t status)
+{
+    UCSR0A = (UCSR0A & _BV(U2X0)) | UCSR0A_TX_IDLE | status;
+    UDR0 = data;
+
+    if (SREG & _BV(SREG_I))
+        host_isr_usart_rx();
+
+    UCSR0A = (UCSR0A & _BV(U2X0)) | UCSR0A_TX_IDLE;
+}
+
+/* Nothing else drives here, the modes and the motion queue aren't built */
+static uint8_t manual_driving(void)
+{
+    return 1;
+}
+
+/* The BT half of a main.c tick */
+static void tick(struct car_state *car)
+{
+    struct event ev;
+    char line[sizeof(replay.last)];
+
+    UCSR0A |= UCSR0A_TX_IDLE;
+
+    while (event_get(&ev)) {
+        if (ev.type == EVENT_SERIAL_RX)
+            bt_gamepad_handle_char(ev.data, ev.stamp);
+        else if (ev.type == EVENT_SERIAL_RX_ERROR)
+            bt_gamepad_handle_error();
+    }
+
+    serial_tick();
+    bt_gamepad_tick(car, manual_driving);
+    car_state_apply(car);
+
+    snprintf(line, sizeof(line), "out:%u:%u:%u:%u:%d:%u", replay.left, OCR0B,
+             replay.right, OCR0A, replay.servo, bt_gamepad_buttons());
+
+    if (strcmp(line, replay.last) != 0) {
+        fprintf(replay.out, "%lu %s\n", now_ms(), line);
+        strcpy(replay.last, line);
+    }
+}
+
+static void ticks_until(struct car_state *car, uint64_t t)
+{
+    while (replay.next_tick <= t) {
+        advance_to(replay.next_tick);
+        tick(car);
+        replay.next_tick += (uint64_t)tune.loop_period_ms * TICKS_PER_MS;
+    }
+}
+
+/* Back to how the car boots, as in main.c */
+static void reset(struct car_state *car)
+{
+    struct car_state boot = {
+        .motor_left_speed_changed = 1,
+        .motor_right_speed_changed = 1,
+        .motor_left_changed = 1,
+        .motor_right_changed = 1,
+        .servo_degree_changed = 1,
+
+        .motor_left_speed = 200,
+        .motor_right_speed = 200,
+        .servo_degree = 128,
+        .speed_scale = CAR_STATE_SCALE_ONE,
+        .motor_left = MOTOR_STOPPED,
+        .motor_right = MOTOR_STOPPED,
+    };
+
+    *car = boot;
+
+    replay.now = 0;
+    replay.next_tick = 0;
+    replay.left = MOTOR_STOPPED;
+    replay.right = MOTOR_STOPPED;
+    replay.servo = -1;
+    replay.last[0] = '\0';
+    replay.tx_line_start = 1;
+    clock_gettime(CLOCK_MONOTONIC, &replay.start);
+
+    SREG = 0;
+    UCSR0A = 0;
+    UCSR0B = 0;
+    UCSR0C = 0;
+    OCR0A = 0;
+    OCR0B = 0;
+
+    event_head = 0;
+    event_tail = 0;
+    event_dropped = 0;
+
+    host_eeprom_erase();
+
+    clock_init();
+    tune_init();
+    bt_gamepad_init();
+    car_state_init();
+    sei();
+}
+
+static uint8_t parse_status(const char *s)
+{
+    uint8_t status = 0;
+
+    for (; *s; s++) {
+        if (*s == 'f')
+            status |= _BV(FE0);
+        else if (*s == 'o')
+            status |= _BV(DOR0);
+        else if (*s == 'p')
+            status |= _BV(UPE0);
+        else
+            return 0xff;
+    }
+
+    return status;
+}
+
+/* Returns 0 if the capture could be read */
+static int run(const char *path, FILE *out)
+{
+    static struct car_state car;
+    char line[4096];
+    unsigned lineno = 0;
+    uint64_t last = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    replay.out = out;
+    reset(&car);
+
+    while (fgets(line, sizeof(line), f)) {
+        char *tok, *save;
+        unsigned long long us;
+        uint64_t at;
+
+        lineno++;
+
+        tok = strtok_r(line, " \t\r\n", &save);
+        if (!tok || *tok == '#')
+            continue;
+
+        if (sscanf(tok, "%llu", &us) != 1)
+            goto bad;
+
+        at = us * TICKS_PER_US;
+
+        while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+            char *end;
+            unsigned long data = strtoul(tok, &end, 16);
+            uint8_t status = 0;
+
+            if (end == tok || data > 0xff)
+                goto bad;
+
+            if (*end == '/' && (status = parse_status(end + 1)) == 0xff)
+                goto bad;
+            else if (*end && *end != '/')
+                goto bad;
+
+            /* A character can't arrive before the one before it is done */
+            if (at < last)
+                at = last;
+
+            ticks_until(&car, at);
+            advance_to(at);
+            receive(data, status);
+
+            last = at + 10 * TICKS_PER_US * 1000000ULL / baud_state.baud;
+            at = last;
+        }
+    }
+
+    fclose(f);
+
+    ticks_until(&car, last + TAIL_MS * TICKS_PER_MS);
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%u: bad capture line\n", path, lineno);
+    fclose(f);
+    return -1;
+}
+
+static char *golden_path(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    size_t len = dot && !strchr(dot, '/') ? (size_t)(dot - path) : strlen(path);
+    char *golden = malloc(len + sizeof(".golden"));
+
+    memcpy(golden, path, len);
+    strcpy(golden + len, ".golden");
+
+    return golden;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "r");
+    char *buf = NULL;
+    size_t cap = 0;
+
+    *len = 0;
+
+    if (!f)
+        return NULL;
+
+    for (;;) {
+        if (*len == cap) {
+            cap = cap ? cap * 2 : 4096;
+            buf = realloc(buf, cap);
+        }
+
+        size_t n = fread(buf + *len, 1, cap - *len, f);
+        if (!n)
+            break;
+
+        *len += n;
+    }
+
+    fclose(f);
+    return buf;
+}
+
+/* Prints where 'got' first differs from 'want' */
+static void show_diff(const char *path, const char *want, size_t want_len,
+                      const char *got, size_t got_len)
+{
+    size_t i, start = 0;
+    unsigned lineno = 1;
+
+    for (i = 0; i < want_len && i < got_len && want[i] == got[i]; i++) {
+        if (want[i] == '\n') {
+            start = i + 1;
+            lineno++;
+        }
+    }
+
+    const char *w = start < want_len ? want + start : "";
+    const char *g = start < got_len ? got + start : "";
+
+    fprintf(stderr, "%s:%u: differs\n", path, lineno);
+    fprintf(stderr, "  want: %.*s\n", (int)strcspn(w, "\n"), w);
+    fprintf(stderr, "  got:  %.*s\n", (int)strcspn(g, "\n"), g);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-u] [-x speed] <capture>...\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int update = 0, failed = 0, opt, i;
+
+    while ((opt = getopt(argc, argv, "ux:")) != -1) {
+        switch (opt) {
+        case 'u':
+            update = 1;
+            break;
+
+        case 'x':
+            replay.speed = atof(optarg);
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind == argc)
+        usage(argv[0]);
+
+    cookie_io_functions_t serial_io = { .write = serial_write };
+    serial_out = fopencookie(NULL, "w", serial_io);
+    setvbuf(serial_out, NULL, _IONBF, 0);
+
+    for (i = optind; i < argc; i++) {
+        char *got = NULL, *want, *golden = golden_path(argv[i]);
+        size_t got_len, want_len;
+        FILE *out = open_memstream(&got, &got_len);
+
+        if (run(argv[i], out)) {
+            fclose(out);
+            free(got);
+            free(golden);
+            failed++;
+            continue;
+        }
+
+        fclose(out);
+
+        if (update) {
+            FILE *f = fopen(golden, "w");
+
+            if (!f || fwrite(got, 1, got_len, f) != got_len || fclose(f)) {
+                perror(golden);
+                failed++;
+            }
+        } else {
+            want = read_file(golden, &want_len);
+
+            if (!want) {
+                perror(golden);
+                failed++;
+            } else if (want_len != got_len || memcmp(want, got, got_len) != 0) {
+                show_diff(argv[i], want, want_len, got, got_len);
+                failed++;
+            }
+
+            free(want);
+        }
+
+        free(got);
+        free(golden);
+    }
+
+    printf("%d sessions %s, %d failed\n", argc - optind - failed,
+           update ? "recorded" : "ok", failed);
+
+    return failed ? 1 : 0;
+}
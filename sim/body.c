@@ -0,0 +1,84 @@
+#include <inttypes.h>
+#include <math.h>
+
+#include "body.h"
+
+#define NOMINAL_MV 7400.0
+
+/* Wheel speed at full duty and nominal voltage */
+#define WHEEL_MAX_CM_S 80.0
+
+#define MOTOR_DEADBAND 40
+#define MOTOR_TAU_S    0.08
+
+#define MOTOR_RUN_MA   250.0
+#define MOTOR_STALL_MA 2200.0
+
+void body_init(struct body *b, const struct world *w)
+{
+    b->x = w->start_x;
+    b->y = w->start_y;
+    b->heading = w->start_heading;
+    b->v_left = b->v_right = 0;
+    b->blocked = 0;
+    b->left_ma = b->right_ma = 0;
+    b->charge_mah = 0;
+    b->distance_cm = 0;
+    b->collisions = 0;
+}
+
+static double target_speed(struct motor_input m, double battery_mv)
+{
+    if (!m.dir || m.duty <= MOTOR_DEADBAND)
+        return 0;
+
+    return m.dir * WHEEL_MAX_CM_S * (m.duty - MOTOR_DEADBAND) / (255 - MOTOR_DEADBAND)
+        * battery_mv / NOMINAL_MV;
+}
+
+static double current(struct motor_input m, int stalled)
+{
+    if (!m.dir)
+        return 0;
+
+    return (stalled ? MOTOR_STALL_MA : MOTOR_RUN_MA) * m.duty / 255;
+}
+
+void body_step(struct body *b, const struct world *w, double dt, double battery_mv,
+               struct motor_input left, struct motor_input right)
+{
+    double k = dt / MOTOR_TAU_S;
+
+    b->v_left += (target_speed(left, battery_mv) - b->v_left) * k;
+    b->v_right += (target_speed(right, battery_mv) - b->v_right) * k;
+
+    double v = (b->v_left + b->v_right) / 2;
+    double omega = (b->v_right - b->v_left) / BODY_TRACK_CM;
+
+    double heading = b->heading + omega * dt;
+    double x = b->x + v * cos(heading) * dt;
+    double y = b->y + v * sin(heading) * dt;
+
+    /* Moves away from a wall are always allowed, so the car can back off */
+    double before = world_clearance(w, b->x, b->y);
+    double after = world_clearance(w, x, y);
+    int blocked = after < BODY_RADIUS_CM && after <= before;
+
+    if (blocked) {
+        if (!b->blocked)
+            b->collisions++;
+
+        b->v_left = b->v_right = 0;
+        b->heading = heading;
+    } else {
+        b->distance_cm += hypot(x - b->x, y - b->y);
+        b->x = x;
+        b->y = y;
+        b->heading = heading;
+    }
+
+    b->blocked = blocked;
+    b->left_ma = current(left, blocked);
+    b->right_ma = current(right, blocked);
+    b->charge_mah += (b->left_ma + b->right_ma) * dt / 3600;
+}
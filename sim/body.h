@@ -0,0 +1,51 @@
+#ifndef SIM_BODY_H
+#define SIM_BODY_H
+
+#include "world.h"
+
+/*
+ * Differential drive model of the car.
+ *
+ * Each wheel's speed follows its command with a first order lag, and the
+ * command is proportional to the PWM duty above the motor deadband and to
+ * the battery voltage. The car is a circle for collisions: a move that would
+ * take it closer to a wall than its radius doesn't happen, and the motors
+ * driving it stall.
+ */
+
+#define BODY_RADIUS_CM 10.0
+#define BODY_TRACK_CM  13.0
+
+/* Where the ultrasonic sensor sits, ahead of the center */
+#define BODY_SENSOR_OFFSET_CM 6.0
+
+struct motor_input {
+    /* -1 backward, 0 stopped, 1 forward */
+    int dir;
+    uint8_t duty;
+};
+
+struct body {
+    double x, y, heading;
+
+    /* Wheel speeds, cm/s */
+    double v_left, v_right;
+
+    int blocked;
+
+    /* Motor currents, mA */
+    double left_ma, right_ma;
+
+    /* Charge drawn by both motors, mAh */
+    double charge_mah;
+
+    double distance_cm;
+    unsigned collisions;
+};
+
+void body_init(struct body *, const struct world *);
+
+void body_step(struct body *, const struct world *, double dt, double battery_mv,
+               struct motor_input left, struct motor_input right);
+
+#endif
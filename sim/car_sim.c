@@ -0,0 +1,396 @@
+/*
+ * Host simulator for the car.
+ *
+ * The firmware's control modules run unchanged against the simulated
+ * hardware in hw.c: the control loop below calls them in the same order
+ * main.c does. Input comes from the chosen mode instead of a controller.
+ *
+ * Usage:
+ *   car_sim [options] <map file>
+ *
+ *   -m auto|line|drive  What drives the car (default auto). 'drive' holds
+ *                       both motors forward at -v, for the failsafes
+ *   -v <duty>           Motor duty for 'drive' (default 200)
+ *   -T <seconds>        Simulated time to run (default 60)
+ *   -B <mV>             Battery voltage (default 7400)
+ *   -t <name>=<value>   Set a tuning parameter, can be repeated
+ *   -o <file>           Write the serial telemetry to a file
+ *   -p <file>           Write the path as CSV, one row per tick
+ *   -d                  Show the firmware's debug output
+ *   -c                  Fail if the car hits anything
+ *   -s                  Fail unless a motor stall cutoff happened
+ *   -g                  End the run when the car reaches the map's goal
+ *
+ * A JSON summary of the run is printed at the end. It only depends on the
+ * inputs, so it can be compared against a known good one. goal_s is when
+ * the car first reached the goal, or -1 if it didn't, and readings is the
+ * ultrasonic readings of all the sensors. How much faster
+ * than real time the run went goes to stderr.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/interrupt.h>
+
+#include "autonomous.h"
+#include "car_state.h"
+#include "clock.h"
+#include "irq_monitor.h"
+#include "latency.h"
+#include "line_follow.h"
+#include "line_sensor.h"
+#include "power.h"
+#include "recorder.h"
+#include "scan.h"
+#include "serial.h"
+#include "telemetry.h"
+#include "tune.h"
+#include "ultrasonic.h"
+
+#include "body.h"
+#include "hw.h"
+#include "world.h"
+
+/* How often the idle wait polls the ultrasonic sensors. The firmware polls
+ * much more often, but only the time from an echo to the next ping depends
+ * on it */
+#define SIM_POLL_US 100
+
+enum sim_mode {
+    SIM_AUTO,
+    SIM_LINE,
+    SIM_DRIVE,
+};
+
+static struct car_state car_state = {
+    .motor_left_speed_changed = 1,
+    .motor_right_speed_changed = 1,
+    .motor_left_changed = 1,
+    .motor_right_changed = 1,
+    .servo_degree_changed = 1,
+
+    .motor_left_speed = 200,
+    .motor_right_speed = 200,
+    .servo_degree = 128,
+    .speed_scale = CAR_STATE_SCALE_ONE,
+    .motor_left = MOTOR_STOPPED,
+    .motor_right = MOTOR_STOPPED,
+};
+
+/*
+ * The hardware serial. Lines are counted as they go by, and copied to the
+ * -o file if there is one.
+ */
+static struct serial_sink {
+    FILE *copy;
+
+    char line[64];
+    size_t line_len;
+
+    unsigned long stalls;
+    unsigned long turns;
+    unsigned long readings;
+    unsigned long tune_errors;
+} serial_sink;
+
+FILE *serial_out;
+
+static void serial_line(const char *line)
+{
+    unsigned long readings;
+
+    if (strncmp(line, "pwr:stall:", 10) == 0)
+        serial_sink.stalls++;
+    else if (strncmp(line, "auto:turn:", 10) == 0)
+        serial_sink.turns++;
+    else if (sscanf(line, "ult:%*u:%lu:", &readings) == 1)
+        serial_sink.readings += readings;
+    else if (strncmp(line, "tune:err:", 9) == 0)
+        serial_sink.tune_errors++;
+}
+
+static ssize_t serial_write(void *cookie, const char *buf, size_t len)
+{
+    size_t i;
+
+    if (serial_sink.copy)
+        fwrite(buf, 1, len, serial_sink.copy);
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] == '\n') {
+            serial_sink.line[serial_sink.line_len] = '\0';
+            serial_line(serial_sink.line);
+            serial_sink.line_len = 0;
+        } else if (serial_sink.line_len < sizeof(serial_sink.line) - 1) {
+            serial_sink.line[serial_sink.line_len++] = buf[i];
+        }
+    }
+
+    return len;
+}
+
+void serial_send_char(char c)
+{
+    fputc(c, serial_out);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-m auto|line|drive] [-v duty] [-T seconds] [-B mV] "
+            "[-t name=value]... [-o telemetry] [-p path.csv] [-d] [-c] [-s] [-g] <map>\n", prog);
+    exit(2);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    enum sim_mode mode = SIM_AUTO;
+    int drive_duty = 200;
+    double seconds = 60;
+    double battery_mv = 7400;
+    const char *tunes[16];
+    int tunes_len = 0;
+    const char *telemetry_path = NULL, *path_path = NULL;
+    int debug = 0, fail_on_collision = 0, need_stall = 0, stop_at_goal = 0;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "m:v:T:B:t:o:p:dcsg")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "auto") == 0)
+                mode = SIM_AUTO;
+            else if (strcmp(optarg, "line") == 0)
+                mode = SIM_LINE;
+            else if (strcmp(optarg, "drive") == 0)
+                mode = SIM_DRIVE;
+            else
+                usage(argv[0]);
+            break;
+
+        case 'v':
+            drive_duty = atoi(optarg);
+            break;
+
+        case 'T':
+            seconds = atof(optarg);
+            break;
+
+        case 'B':
+            battery_mv = atof(optarg);
+            break;
+
+        case 't':
+            if (tunes_len == sizeof(tunes) / sizeof(*tunes) || !strchr(optarg, '='))
+                usage(argv[0]);
+            tunes[tunes_len++] = optarg;
+            break;
+
+        case 'o':
+            telemetry_path = optarg;
+            break;
+
+        case 'p':
+            path_path = optarg;
+            break;
+
+        case 'd':
+            debug = 1;
+            break;
+
+        case 'c':
+            fail_on_collision = 1;
+            break;
+
+        case 's':
+            need_stall = 1;
+            break;
+
+        case 'g':
+            stop_at_goal = 1;
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usage(argv[0]);
+
+    static struct world world;
+    struct body body;
+
+    if (world_load(&world, argv[optind]))
+        return 1;
+
+    /* The firmware's stdout is the debug serial. Keep it out of the summary */
+    FILE *summary = fdopen(dup(STDOUT_FILENO), "w");
+    if (!debug)
+        freopen("/dev/null", "w", stdout);
+
+    if (telemetry_path) {
+        serial_sink.copy = fopen(telemetry_path, "w");
+        if (!serial_sink.copy) {
+            perror(telemetry_path);
+            return 1;
+        }
+    }
+
+    FILE *path = NULL;
+    if (path_path) {
+        path = fopen(path_path, "w");
+        if (!path) {
+            perror(path_path);
+            return 1;
+        }
+
+        fprintf(path, "time_ms,x_cm,y_cm,heading_deg,left_cm_s,right_cm_s,servo_deg,blocked\n");
+    }
+
+    cookie_io_functions_t serial_io = { .write = serial_write };
+    serial_out = fopencookie(NULL, "w", serial_io);
+    setvbuf(serial_out, NULL, _IONBF, 0);
+
+    body_init(&body, &world);
+    hw_init(&world, &body, battery_mv);
+
+    /* Same order as main.c, less the devices that aren't simulated */
+    clock_init();
+    tune_init();
+    car_state_init();
+    power_init();
+    sei();
+
+    ultrasonic_init();
+    scan_init();
+    recorder_init();
+    line_sensor_init();
+
+    for (i = 0; i < tunes_len; i++) {
+        char name[16];
+        const char *eq = strchr(tunes[i], '=');
+
+        snprintf(name, sizeof(name), "%.*s", (int)(eq - tunes[i]), tunes[i]);
+        tune_set(name, eq + 1);
+    }
+
+    if (serial_sink.tune_errors) {
+        fprintf(stderr, "%s: bad tuning parameter\n", argv[0]);
+        return 2;
+    }
+
+    if (mode == SIM_AUTO)
+        autonomous_start();
+    else if (mode == SIM_LINE)
+        line_follow_start();
+
+    double min_clearance = INFINITY;
+    double goal_s = -1;
+    uint64_t end_us = seconds * 1e6;
+    double wall_start = now_s();
+    unsigned long ticks = 0;
+
+    uint32_t next_tick = clock_micros();
+    while (hw_time_us() < end_us) {
+        if (mode == SIM_DRIVE) {
+            car_state_left_motor_set(&car_state, MOTOR_FOR);
+            car_state_right_motor_set(&car_state, MOTOR_FOR);
+            car_state_motor_left_speed_set(&car_state, drive_duty);
+            car_state_motor_right_speed_set(&car_state, drive_duty);
+        }
+
+        scan_tick(&car_state);
+        autonomous_tick(&car_state);
+        line_follow_tick(&car_state);
+
+        power_update(&car_state);
+        recorder_tick(&car_state);
+
+        car_state_apply(&car_state);
+        latency_tick();
+        irq_monitor_tick();
+
+        ultrasonic_tick();
+
+        double clearance = world_clearance(&world, body.x, body.y);
+        if (clearance < min_clearance)
+            min_clearance = clearance;
+
+        if (goal_s < 0 && world_at_goal(&world, body.x, body.y)) {
+            goal_s = hw_time_us() / 1e6;
+            if (stop_at_goal)
+                break;
+        }
+
+        if (path)
+            fprintf(path, "%.1f,%.2f,%.2f,%.1f,%.1f,%.1f,%.1f,%d\n",
+                    hw_time_us() / 1e3, body.x, body.y, body.heading * 180 / M_PI,
+                    body.v_left, body.v_right, hw_servo_angle() * 180 / M_PI,
+                    body.blocked);
+
+        ticks++;
+
+        /* The firmware polls the ultrasonic sensors while it busy-waits
+         * here. The simulation skips ahead, polling every SIM_POLL_US */
+        next_tick += (uint32_t)tune.loop_period_ms * 1000;
+
+        int32_t wait = next_tick - clock_micros();
+        if (wait <= 0)
+            next_tick = clock_micros();
+
+        while (wait > 0) {
+            ultrasonic_poll();
+            hw_advance_us(wait < SIM_POLL_US ? wait : SIM_POLL_US);
+            wait = next_tick - clock_micros();
+        }
+    }
+
+    double wall = now_s() - wall_start;
+    double sim_s = hw_time_us() / 1e6;
+
+    fprintf(stderr, "sim: %.1fs in %.3fs, %.0fx real time\n", sim_s, wall,
+            wall > 0 ? sim_s / wall : 0);
+
+    fprintf(summary, "{\n");
+    fprintf(summary, "  \"sim_seconds\": %.3f,\n", sim_s);
+    fprintf(summary, "  \"ticks\": %lu,\n", ticks);
+    fprintf(summary, "  \"distance_cm\": %.1f,\n", body.distance_cm);
+    fprintf(summary, "  \"collisions\": %u,\n", body.collisions);
+    fprintf(summary, "  \"min_clearance_cm\": %.1f,\n", min_clearance);
+    fprintf(summary, "  \"stalls\": %lu,\n", serial_sink.stalls);
+    fprintf(summary, "  \"turns\": %lu,\n", serial_sink.turns);
+    fprintf(summary, "  \"readings\": %lu,\n", serial_sink.readings);
+    fprintf(summary, "  \"goal_s\": %.3f,\n", goal_s);
+    fprintf(summary, "  \"charge_mah\": %.2f,\n", body.charge_mah);
+    fprintf(summary, "  \"final\": { \"x_cm\": %.1f, \"y_cm\": %.1f, \"heading_deg\": %.1f }\n",
+            body.x, body.y, body.heading * 180 / M_PI);
+    fprintf(summary, "}\n");
+    fflush(summary);
+
+    if (path)
+        fclose(path);
+    if (serial_sink.copy)
+        fclose(serial_sink.copy);
+
+    if (fail_on_collision && body.collisions)
+        return 1;
+
+    if (need_stall && !serial_sink.stalls)
+        return 1;
+
+    return 0;
+}
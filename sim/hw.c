@@ -0,0 +1,463 @@
+#include <math.h>
+#include <stdio.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "l298n.h"
+#include "line_sensor.h"
+#include "ultrasonic.h"
+#include "hw.h"
+
+#define TICKS_PER_US 2
+
+#define PHYSICS_TICKS (1000 * TICKS_PER_US)
+
+/* 13 ADC clocks at 125kHz */
+#define ADC_CONVERSION_TICKS (104 * TICKS_PER_US)
+
+#define ADC_REF_MV 5000.0
+#define BATTERY_DIVIDER 3
+#define SENSE_MILLIOHM 500
+
+#define SERVO_PORT PORTD
+#define SERVO_PIN  PORTD3
+
+/* Servo pulse widths for full right and full left, and how fast it turns */
+#define SERVO_MIN_US 500.0
+#define SERVO_MAX_US 2500.0
+#define SERVO_RAD_PER_S (M_PI / 0.3)
+
+#define SONAR_RISE_US 400
+#define SONAR_US_PER_CM 58
+#define SONAR_MAX_CM 400.0
+#define SONAR_NO_ECHO_US 38000
+
+/* Line sensor channels, ahead of the center and left of it */
+#define LINE_AHEAD_CM 8.0
+#define LINE_SPACING_CM 1.5
+
+/* The ultrasonic sensors, as wired in ultrasonic.h. 'angle' is from the
+ * heading, and the front one turns with the servo on top of that */
+static const struct sonar {
+    volatile uint8_t *trig_port;
+    uint8_t trig_pin;
+    uint8_t echo_pin;
+    double angle;
+    int on_servo;
+} sonars[ULTRASONIC_SENSORS] = {
+    [ULTRASONIC_FRONT] = {
+        &ULTRASONIC_FRONT_TRIG_PORT, ULTRASONIC_FRONT_TRIG_PIN_N,
+        ULTRASONIC_FRONT_ECHO_PIN_N, 0, 1,
+    },
+    [ULTRASONIC_LEFT] = {
+        &ULTRASONIC_LEFT_TRIG_PORT, ULTRASONIC_LEFT_TRIG_PIN_N,
+        ULTRASONIC_LEFT_ECHO_PIN_N, M_PI / 2, 0,
+    },
+    [ULTRASONIC_RIGHT] = {
+        &ULTRASONIC_RIGHT_TRIG_PORT, ULTRASONIC_RIGHT_TRIG_PIN_N,
+        ULTRASONIC_RIGHT_ECHO_PIN_N, -M_PI / 2, 0,
+    },
+};
+
+void host_isr_pcint1(void);
+void host_isr_timer1_compa(void);
+void host_isr_timer1_compb(void);
+void host_isr_timer1_ovf(void);
+void host_isr_adc(void);
+
+static struct hw {
+    const struct world *world;
+    struct body *body;
+    double battery_mv;
+
+    uint64_t now;
+    uint16_t tcnt_offset;
+    uint16_t tcnt_last;
+    uint8_t tifr1;
+    uint8_t pcifr;
+    int in_isr;
+
+    uint64_t next_physics;
+
+    uint64_t next_adc;
+    uint8_t adc_converting_mux;
+
+    uint8_t servo_was_high;
+    uint64_t servo_rise;
+    double servo_target;
+    double servo_angle;
+
+    uint8_t trig_was_high[ULTRASONIC_SENSORS];
+    uint64_t echo_rise[ULTRASONIC_SENSORS], echo_fall[ULTRASONIC_SENSORS];
+
+    /* Echo bits on PINC, as of the last pin change check */
+    uint8_t echo_bits;
+} hw;
+
+static uint16_t tcnt(void)
+{
+    return (uint16_t)hw.now + hw.tcnt_offset;
+}
+
+/* Ticks until TCNT1 next reaches 'match' */
+static uint64_t ticks_to(uint16_t match)
+{
+    uint16_t d = match - tcnt();
+
+    return d ? d : 0x10000;
+}
+
+static uint16_t mv_to_adc(double mv)
+{
+    double v = mv / ADC_REF_MV * 1024;
+
+    if (v > 1023)
+        return 1023;
+
+    return v;
+}
+
+static uint16_t adc_value(uint8_t mux)
+{
+    switch (mux) {
+    case 6:
+        return mv_to_adc(hw.battery_mv / BATTERY_DIVIDER);
+    case 3:
+        return mv_to_adc(hw.body->left_ma * SENSE_MILLIOHM / 1000);
+    case 7:
+        return mv_to_adc(hw.body->right_ma * SENSE_MILLIOHM / 1000);
+    }
+
+    return 0;
+}
+
+static void check_servo_pin(void)
+{
+    uint8_t high = !!(SERVO_PORT & _BV(SERVO_PIN));
+
+    if (high && !hw.servo_was_high) {
+        hw.servo_rise = hw.now;
+    } else if (!high && hw.servo_was_high) {
+        double us = (double)(hw.now - hw.servo_rise) / TICKS_PER_US;
+        double frac = (us - SERVO_MIN_US) / (SERVO_MAX_US - SERVO_MIN_US);
+
+        if (frac < 0)
+            frac = 0;
+        if (frac > 1)
+            frac = 1;
+
+        hw.servo_target = (frac - 0.5) * M_PI;
+    }
+
+    hw.servo_was_high = high;
+}
+
+static void run_isr(void (*isr)(void))
+{
+    uint8_t sreg = SREG;
+
+    hw.in_isr = 1;
+    SREG &= ~_BV(SREG_I);
+
+    isr();
+
+    SREG = sreg;
+    hw.in_isr = 0;
+
+    check_servo_pin();
+}
+
+/* Runs every pending interrupt that is enabled, in vector priority order */
+static void dispatch(void)
+{
+    int ran;
+
+    if (hw.in_isr)
+        return ;
+
+    do {
+        ran = 0;
+
+        if (!(SREG & _BV(SREG_I)))
+            break;
+
+        if ((hw.pcifr & _BV(PCIF1)) && (PCICR & _BV(PCIE1))) {
+            hw.pcifr &= ~_BV(PCIF1);
+            run_isr(host_isr_pcint1);
+            ran = 1;
+        } else if ((hw.tifr1 & _BV(OCF1A)) && (TIMSK1 & _BV(OCIE1A))) {
+            hw.tifr1 &= ~_BV(OCF1A);
+            run_isr(host_isr_timer1_compa);
+            ran = 1;
+        } else if ((hw.tifr1 & _BV(OCF1B)) && (TIMSK1 & _BV(OCIE1B))) {
+            hw.tifr1 &= ~_BV(OCF1B);
+            run_isr(host_isr_timer1_compb);
+            ran = 1;
+        } else if ((hw.tifr1 & _BV(TOV1)) && (TIMSK1 & _BV(TOIE1))) {
+            hw.tifr1 &= ~_BV(TOV1);
+            run_isr(host_isr_timer1_ovf);
+            ran = 1;
+        } else if ((ADCSRA & _BV(ADIF)) && (ADCSRA & _BV(ADIE))) {
+            ADCSRA &= ~_BV(ADIF);
+            run_isr(host_isr_adc);
+            ran = 1;
+        }
+    } while (ran);
+
+    TIFR1 = hw.tifr1;
+    PCIFR = hw.pcifr;
+}
+
+static struct motor_input motor(uint8_t duty, uint8_t pwm_on, uint8_t enable,
+                                uint8_t forward, uint8_t backward)
+{
+    struct motor_input m;
+
+    m.duty = pwm_on ? duty : (enable ? 255 : 0);
+    m.dir = forward == backward ? 0 : (forward ? 1 : -1);
+
+    return m;
+}
+
+static void physics_step(void)
+{
+    double dt = (double)PHYSICS_TICKS / TICKS_PER_US / 1e6;
+    double step = SERVO_RAD_PER_S * dt;
+
+    /* OCR0A drives the right motor and OCR0B the left, see car_state.c */
+    struct motor_input right = motor(OCR0A, TCCR0A & _BV(COM0A1),
+                                     L298N_ENA_PORT & _BV(L298N_ENA_PIN),
+                                     L298N_RIGHT_FOR_PORT & _BV(L298N_RIGHT_FOR_PIN),
+                                     L298N_RIGHT_BACK_PORT & _BV(L298N_RIGHT_BACK_PIN));
+    struct motor_input left = motor(OCR0B, TCCR0A & _BV(COM0B1),
+                                    L298N_ENB_PORT & _BV(L298N_ENB_PIN),
+                                    L298N_LEFT_FOR_PORT & _BV(L298N_LEFT_FOR_PIN),
+                                    L298N_LEFT_BACK_PORT & _BV(L298N_LEFT_BACK_PIN));
+
+    body_step(hw.body, hw.world, dt, hw.battery_mv, left, right);
+
+    if (fabs(hw.servo_target - hw.servo_angle) <= step)
+        hw.servo_angle = hw.servo_target;
+    else if (hw.servo_target > hw.servo_angle)
+        hw.servo_angle += step;
+    else
+        hw.servo_angle -= step;
+}
+
+static uint8_t echo_bits(void)
+{
+    uint8_t bits = 0;
+    int i;
+
+    for (i = 0; i < ULTRASONIC_SENSORS; i++)
+        if (hw.now >= hw.echo_rise[i] && hw.now < hw.echo_fall[i])
+            bits |= _BV(sonars[i].echo_pin);
+
+    return bits;
+}
+
+/* Sets the pin change flag if an enabled echo pin changed */
+static void check_echo_change(void)
+{
+    uint8_t bits = echo_bits();
+
+    if ((bits ^ hw.echo_bits) & PCMSK1)
+        hw.pcifr |= _BV(PCIF1);
+
+    hw.echo_bits = bits;
+}
+
+/* The next echo edge after now, or 'limit' if there is none before it */
+static uint64_t next_echo_edge(uint64_t limit)
+{
+    int i;
+
+    for (i = 0; i < ULTRASONIC_SENSORS; i++) {
+        if (hw.echo_rise[i] > hw.now && hw.echo_rise[i] < limit)
+            limit = hw.echo_rise[i];
+        if (hw.echo_fall[i] > hw.now && hw.echo_fall[i] < limit)
+            limit = hw.echo_fall[i];
+    }
+
+    return limit;
+}
+
+static void advance_to(uint64_t target)
+{
+    while (hw.now < target) {
+        uint64_t ovf = hw.now + ticks_to(0);
+        uint64_t cmp_a = hw.now + ticks_to(OCR1A);
+        uint64_t cmp_b = hw.now + ticks_to(OCR1B);
+        uint64_t next = target;
+        int adc_running = (ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADATE));
+
+        if (ovf < next)
+            next = ovf;
+        if (cmp_a < next)
+            next = cmp_a;
+        if (cmp_b < next)
+            next = cmp_b;
+        if (hw.next_physics < next)
+            next = hw.next_physics;
+        if (adc_running && hw.next_adc < next)
+            next = hw.next_adc;
+        next = next_echo_edge(next);
+
+        hw.now = next;
+        check_echo_change();
+
+        if (next == ovf)
+            hw.tifr1 |= _BV(TOV1);
+        if (next == cmp_a)
+            hw.tifr1 |= _BV(OCF1A);
+        if (next == cmp_b)
+            hw.tifr1 |= _BV(OCF1B);
+
+        if (next == hw.next_physics) {
+            physics_step();
+            hw.next_physics += PHYSICS_TICKS;
+        }
+
+        if (!adc_running) {
+            hw.next_adc = hw.now + ADC_CONVERSION_TICKS;
+        } else if (next == hw.next_adc) {
+            /* The next conversion starts right away, on the channel ADMUX
+             * selects before the ISR changes it */
+            ADC = adc_value(hw.adc_converting_mux);
+            ADCSRA |= _BV(ADIF);
+            hw.adc_converting_mux = ADMUX & 0x0F;
+            hw.next_adc += ADC_CONVERSION_TICKS;
+        }
+
+        TIFR1 = hw.tifr1;
+        PCIFR = hw.pcifr;
+        dispatch();
+    }
+}
+
+/* Starts an echo when a trigger pin drops */
+static void check_trigger(void)
+{
+    int i;
+
+    for (i = 0; i < ULTRASONIC_SENSORS; i++) {
+        const struct sonar *s = sonars + i;
+        uint8_t high = !!(*s->trig_port & _BV(s->trig_pin));
+
+        if (!high && hw.trig_was_high[i]) {
+            struct body *b = hw.body;
+            double angle = b->heading + s->angle + (s->on_servo ? hw.servo_angle : 0);
+            double x = b->x + BODY_SENSOR_OFFSET_CM * cos(b->heading);
+            double y = b->y + BODY_SENSOR_OFFSET_CM * sin(b->heading);
+            double cm = world_ray(hw.world, x, y, angle, SONAR_MAX_CM);
+            double us = cm < SONAR_MAX_CM ? cm * SONAR_US_PER_CM : SONAR_NO_ECHO_US;
+
+            hw.echo_rise[i] = hw.now + SONAR_RISE_US * TICKS_PER_US;
+            hw.echo_fall[i] = hw.echo_rise[i] + (uint64_t)(us * TICKS_PER_US);
+        }
+
+        hw.trig_was_high[i] = high;
+    }
+}
+
+/* Anything the firmware writes to TIFR1 or PCIFR is dropped. On the chip,
+ * writing a 1 clears a flag, which only the init code does, before the flag
+ * could have been set */
+static void firmware_wait(uint64_t ticks)
+{
+    TIFR1 = hw.tifr1;
+    PCIFR = hw.pcifr;
+
+    check_trigger();
+    dispatch();
+
+    if (!hw.in_isr)
+        advance_to(hw.now + ticks);
+}
+
+volatile uint16_t *host_read_tcnt1(void)
+{
+    /* Pick up a write to TCNT1 since the last read */
+    if (host_TCNT1 != hw.tcnt_last)
+        hw.tcnt_offset = host_TCNT1 - (uint16_t)hw.now;
+
+    firmware_wait(HW_READ_TICKS);
+
+    host_TCNT1 = hw.tcnt_last = tcnt();
+    return &host_TCNT1;
+}
+
+static uint8_t line_bits(void)
+{
+    struct body *b = hw.body;
+    double fx = b->x + LINE_AHEAD_CM * cos(b->heading);
+    double fy = b->y + LINE_AHEAD_CM * sin(b->heading);
+    double lx = -sin(b->heading) * LINE_SPACING_CM;
+    double ly = cos(b->heading) * LINE_SPACING_CM;
+    uint8_t bits = 0;
+
+    if (world_on_tape(hw.world, fx + lx, fy + ly))
+        bits |= _BV(PINB2);
+    if (world_on_tape(hw.world, fx, fy))
+        bits |= _BV(PINB4);
+    if (world_on_tape(hw.world, fx - lx, fy - ly))
+        bits |= _BV(PINB5);
+
+    return bits;
+}
+
+volatile uint8_t *host_read_pin(volatile uint8_t *pin)
+{
+    uint8_t inputs = 0;
+    uint8_t port = 0, ddr = 0;
+
+    firmware_wait(HW_READ_TICKS);
+
+    if (pin == &host_PINB) {
+        inputs = line_bits();
+        port = PORTB;
+        ddr = DDRB;
+    } else if (pin == &host_PINC) {
+        /* The TWI lines idle high, and nothing answers on them */
+        inputs = _BV(PINC0) | _BV(PINC1) | echo_bits();
+        port = PORTC;
+        ddr = DDRC;
+    } else if (pin == &host_PIND) {
+        inputs = _BV(PIND0);
+        port = PORTD;
+        ddr = DDRD;
+    }
+
+    *pin = (port & ddr) | (inputs & ~ddr);
+    return pin;
+}
+
+void host_delay_us(double us)
+{
+    firmware_wait(us * TICKS_PER_US);
+}
+
+void hw_advance_us(uint32_t us)
+{
+    firmware_wait((uint64_t)us * TICKS_PER_US);
+}
+
+uint64_t hw_time_us(void)
+{
+    return hw.now / TICKS_PER_US;
+}
+
+double hw_servo_angle(void)
+{
+    return hw.servo_angle;
+}
+
+void hw_init(const struct world *w, struct body *b, double battery_mv)
+{
+    hw.world = w;
+    hw.body = b;
+    hw.battery_mv = battery_mv;
+    hw.next_physics = PHYSICS_TICKS;
+}
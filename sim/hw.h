@@ -0,0 +1,44 @@
+#ifndef SIM_HW_H
+#define SIM_HW_H
+
+#include <inttypes.h>
+
+#include "body.h"
+#include "world.h"
+
+/*
+ * Model of the ATmega328P peripherals and the devices wired to them, behind
+ * the hooks in host/include/avr/io.h.
+ *
+ * Time is virtual and counted in TIMER1 ticks (0.5us). It only moves when
+ * the firmware waits: every TCNT1 or PINx read outside an ISR takes
+ * HW_READ_TICKS, a _delay_us() takes its length, and the control loop's idle
+ * wait at the end of a tick is skipped over with hw_advance_us(). As time
+ * passes, the TIMER1 overflow and compare interrupts, the ADC conversion
+ * interrupt, the echo pin change interrupt and the physics steps happen in
+ * order. Nothing depends on the host's clock, so a run always comes out the
+ * same.
+ *
+ * What's modelled:
+ *  - Motors from OCR0A/OCR0B and the L298N direction pins, into body.c
+ *  - The servo angle, from the pulse width it gets on PD3
+ *  - The HC-SR04s in ultrasonic.h. An echo comes back on the sensor's echo
+ *    pin after a trigger pulse, ray-cast from where the sensor points, and
+ *    the edges raise the pin change interrupt
+ *  - The line sensor channels on PINB, from the tape in the map
+ *  - Battery voltage and motor current on the ADC channels
+ */
+
+#define HW_READ_TICKS 8
+
+void hw_init(const struct world *, struct body *, double battery_mv);
+
+void hw_advance_us(uint32_t us);
+
+/* Time since the start, in us */
+uint64_t hw_time_us(void);
+
+/* Servo angle in radians, 0 is straight ahead and positive is left */
+double hw_servo_angle(void);
+
+#endif
@@ -0,0 +1,149 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "world.h"
+
+static int add_segment(struct segment *list, int *len, const struct segment *s,
+                       const char *path, int line)
+{
+    if (*len == WORLD_MAX_SEGMENTS) {
+        fprintf(stderr, "%s:%d: more than %d segments\n", path, line, WORLD_MAX_SEGMENTS);
+        return -1;
+    }
+
+    list[(*len)++] = *s;
+    return 0;
+}
+
+int world_load(struct world *w, const char *path)
+{
+    char buf[256];
+    int line = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    memset(w, 0, sizeof(*w));
+
+    while (fgets(buf, sizeof(buf), f)) {
+        char kind[16];
+        struct segment s = { 0 };
+        double heading;
+        int n;
+
+        line++;
+
+        char *comment = strchr(buf, '#');
+        if (comment)
+            *comment = '\0';
+
+        n = sscanf(buf, "%15s", kind);
+        if (n != 1)
+            continue;
+
+        if (strcmp(kind, "wall") == 0
+            && sscanf(buf, "%*s %lf %lf %lf %lf", &s.x1, &s.y1, &s.x2, &s.y2) == 4) {
+            if (add_segment(w->walls, &w->walls_len, &s, path, line))
+                goto err;
+        } else if (strcmp(kind, "tape") == 0
+                   && sscanf(buf, "%*s %lf %lf %lf %lf %lf",
+                             &s.x1, &s.y1, &s.x2, &s.y2, &s.width) == 5) {
+            if (add_segment(w->tape, &w->tape_len, &s, path, line))
+                goto err;
+        } else if (strcmp(kind, "start") == 0
+                   && sscanf(buf, "%*s %lf %lf %lf", &w->start_x, &w->start_y, &heading) == 3) {
+            w->start_heading = heading * M_PI / 180;
+        } else if (strcmp(kind, "goal") == 0
+                   && sscanf(buf, "%*s %lf %lf %lf",
+                             &w->goal_x, &w->goal_y, &w->goal_radius) == 3) {
+            w->has_goal = 1;
+        } else {
+            fprintf(stderr, "%s:%d: can't parse '%s'\n", path, line, kind);
+            goto err;
+        }
+    }
+
+    fclose(f);
+    return 0;
+
+  err:
+    fclose(f);
+    return -1;
+}
+
+double world_ray(const struct world *w, double x, double y, double angle, double max)
+{
+    double dx = cos(angle), dy = sin(angle);
+    double best = max;
+    int i;
+
+    for (i = 0; i < w->walls_len; i++) {
+        const struct segment *s = w->walls + i;
+        double ex = s->x2 - s->x1, ey = s->y2 - s->y1;
+        double denom = dx * ey - dy * ex;
+
+        if (fabs(denom) < 1e-12)
+            continue;
+
+        /* Ray: p + t*d, segment: a + u*e */
+        double ax = s->x1 - x, ay = s->y1 - y;
+        double t = (ax * ey - ay * ex) / denom;
+        double u = (ax * dy - ay * dx) / denom;
+
+        if (t >= 0 && u >= 0 && u <= 1 && t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+static double point_segment_distance(const struct segment *s, double x, double y)
+{
+    double ex = s->x2 - s->x1, ey = s->y2 - s->y1;
+    double len2 = ex * ex + ey * ey;
+    double u = 0;
+
+    if (len2 > 0) {
+        u = ((x - s->x1) * ex + (y - s->y1) * ey) / len2;
+        if (u < 0)
+            u = 0;
+        if (u > 1)
+            u = 1;
+    }
+
+    return hypot(s->x1 + u * ex - x, s->y1 + u * ey - y);
+}
+
+double world_clearance(const struct world *w, double x, double y)
+{
+    double best = INFINITY;
+    int i;
+
+    for (i = 0; i < w->walls_len; i++) {
+        double d = point_segment_distance(w->walls + i, x, y);
+        if (d < best)
+            best = d;
+    }
+
+    return best;
+}
+
+int world_on_tape(const struct world *w, double x, double y)
+{
+    int i;
+
+    for (i = 0; i < w->tape_len; i++)
+        if (point_segment_distance(w->tape + i, x, y) <= w->tape[i].width / 2)
+            return 1;
+
+    return 0;
+}
+
+int world_at_goal(const struct world *w, double x, double y)
+{
+    return w->has_goal && hypot(x - w->goal_x, y - w->goal_y) <= w->goal_radius;
+}
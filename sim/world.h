@@ -0,0 +1,52 @@
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+/*
+ * The 2D world the simulated car drives in. Distances are in cm and angles
+ * in radians, counter-clockwise from the x axis.
+ *
+ * Map files are text, one item per line, with '#' starting a comment:
+ *
+ *   wall <x1> <y1> <x2> <y2>            Something the ultrasonic sees and
+ *                                       the car can hit
+ *   tape <x1> <y1> <x2> <y2> <width>    Line on the floor for the line sensor
+ *   start <x> <y> <heading degrees>     Where the car starts
+ *   goal <x> <y> <radius>               Where the car should get to, for
+ *                                       scoring runs (optional)
+ */
+
+#define WORLD_MAX_SEGMENTS 256
+
+struct segment {
+    double x1, y1, x2, y2;
+    double width;
+};
+
+struct world {
+    struct segment walls[WORLD_MAX_SEGMENTS];
+    int walls_len;
+
+    struct segment tape[WORLD_MAX_SEGMENTS];
+    int tape_len;
+
+    double start_x, start_y, start_heading;
+
+    int has_goal;
+    double goal_x, goal_y, goal_radius;
+};
+
+/* Returns 0 on success, or prints what went wrong and returns -1 */
+int world_load(struct world *, const char *path);
+
+/* Distance along the ray to the nearest wall, or 'max' if none is closer */
+double world_ray(const struct world *, double x, double y, double angle, double max);
+
+/* Distance from the point to the nearest wall */
+double world_clearance(const struct world *, double x, double y);
+
+int world_on_tape(const struct world *, double x, double y);
+
+/* Whether the point is within the goal. Never true without a goal */
+int world_at_goal(const struct world *, double x, double y);
+
+#endif
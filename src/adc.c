@@ -0,0 +1,93 @@
+
+#include "common.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "adc.h"
+#include "irq_monitor.h"
+
+/*
+ * The ADC runs in free-running mode and the conversion complete interrupt
+ * moves ADMUX on to the next channel, so all the channels are sampled
+ * round-robin without the main loop doing anything.
+ *
+ * In free-running mode the next conversion has already started by the time
+ * the interrupt runs, so a new ADMUX value only applies to the conversion
+ * after that. 'convert_idx' tracks which channel the completed conversion was
+ * for, and 'next_idx' which channel the already started one is for.
+ *
+ * Each channel is run through an exponential filter, kept as the reading
+ * times 16 so the low bits aren't lost.
+ *
+ * The main loop reads the filtered values through a sequence counter instead
+ * of turning off interrupts: the ISR bumps 'seq' after every update, and the
+ * reader copies again if it changed while copying.
+ */
+
+/* A 128 prescaler gives a 125kHz ADC clock, around 9600 conversions/s */
+#define ADC_PRESCALER_BITS (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))
+
+#define ADC_FILTER_SHIFT 3
+
+static const uint8_t adc_mux[ADC_CHANNELS] = {
+    [ADC_BATTERY] = ADC_BATTERY_MUX,
+    [ADC_SENSE_LEFT] = ADC_SENSE_LEFT_MUX,
+    [ADC_SENSE_RIGHT] = ADC_SENSE_RIGHT_MUX,
+};
+
+static volatile uint16_t filtered[ADC_CHANNELS];
+static volatile uint8_t seq;
+
+static uint8_t convert_idx;
+static uint8_t next_idx;
+
+ISR(ADC_vect)
+{
+    IRQ_MONITOR_START();
+
+    int16_t sample = ADC << 4;
+    uint16_t f = filtered[convert_idx];
+
+    filtered[convert_idx] = f + ((sample - (int16_t)f) >> ADC_FILTER_SHIFT);
+    seq++;
+
+    convert_idx = next_idx;
+
+    next_idx++;
+    if (next_idx == ADC_CHANNELS)
+        next_idx = 0;
+
+    ADMUX = _BV(REFS0) | adc_mux[next_idx];
+
+    IRQ_MONITOR_STOP(IRQ_ADC);
+}
+
+void adc_read_snapshot(struct adc_snapshot *snap)
+{
+    uint8_t start;
+    uint8_t i;
+
+    do {
+        start = seq;
+
+        for (i = 0; i < ADC_CHANNELS; i++)
+            snap->value[i] = filtered[i] >> 4;
+    } while (start != seq);
+}
+
+void adc_init(void)
+{
+    convert_idx = 0;
+    next_idx = 0;
+
+    /* Only ADC3 has a digital input buffer to turn off */
+    DIDR0 |= _BV(ADC3D);
+
+    /* AVcc reference */
+    ADMUX = _BV(REFS0) | adc_mux[0];
+    ADCSRB = 0;
+
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | ADC_PRESCALER_BITS;
+    ADCSRA |= _BV(ADSC);
+}
@@ -0,0 +1,346 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <avr/pgmspace.h>
+
+#include "serial.h"
+#include "clock.h"
+#include "ultrasonic.h"
+#include "car_state.h"
+#include "scan.h"
+#include "autonomous.h"
+#include "tune.h"
+
+/*
+ * Obstacle-avoidance driving.
+ *
+ * While the car drives forward the scan only sweeps the sectors in front of
+ * it, so each of them is read again every few hundred ms. When a reading
+ * puts something in the car's path closer than the auto_obs tuning
+ * parameter, the car stops and the scan sweeps every sector. Once each has
+ * been read since the stop, the car picks the direction with the most room
+ * and pivots toward it, at a fixed speed for a time proportional to the
+ * angle. If no direction has at least auto_clr of room it turns a right
+ * angle toward the side with more, and looks again. The car can't see
+ * behind it, so it never backs up, and it pivots about its middle, so a
+ * turn never takes it closer to anything.
+ *
+ * A reading is only in the path of a direction if it is within the car's
+ * half width of the line the car would drive along, so the car is taken to
+ * be as wide as it is rather than as wide as a sensor ray. Directions are
+ * sector centers, and angles are counted in half sectors.
+ *
+ * The speed drops with the nearest thing in the path, and the car only
+ * crawls until every front sector has been read since the last turn, since
+ * the readings from before it point somewhere else.
+ *
+ * A sector without an echo has nothing in range, so it never counts as an
+ * obstacle.
+ *
+ * Every step is a fixed amount of work (at most SCAN_SECTORS squared
+ * multiplies, when deciding), so a tick always takes bounded time.
+ *
+ * The reaction latency is the time from the end of the echo that detected
+ * the obstacle to the stop being commanded. Each turn is reported over the
+ * hardware serial as:
+ *
+ *   auto:turn:<sector>:<latency us>:<max latency us>
+ */
+
+/* The scan sectors hold cm / 2 */
+#define AUTO_OBSTACLE_HALF_CM (tune.auto_obstacle_cm / 2)
+#define AUTO_CLEAR_HALF_CM    (tune.auto_clear_cm / 2)
+
+/* Half the car's width plus some margin, in cm / 2. The sensor sits a few
+ * cm ahead of the pivot point, which the margin covers too */
+#define AUTO_HALF_WIDTH_HALF_CM 8
+
+/* Sectors watched while driving, either side of the center */
+#define AUTO_FRONT_SECTORS 3
+#define AUTO_CENTER_SECTOR (SCAN_SECTORS / 2)
+#define AUTO_FRONT_FIRST   (AUTO_CENTER_SECTOR - AUTO_FRONT_SECTORS)
+#define AUTO_FRONT_LAST    (AUTO_CENTER_SECTOR + AUTO_FRONT_SECTORS - 1)
+
+#define AUTO_FRONT_MASK \
+    ((uint16_t)((1UL << (AUTO_FRONT_LAST + 1)) - (1UL << AUTO_FRONT_FIRST)))
+#define AUTO_ALL_MASK ((uint16_t)((1UL << SCAN_SECTORS) - 1))
+
+/* Half sectors in a right angle */
+#define AUTO_RIGHT_ANGLE SCAN_SECTORS
+
+/* Full speed from this many times the obstacle distance out, down to a
+ * crawl at the obstacle distance */
+#define AUTO_SLOW_RANGE  4
+#define AUTO_CRAWL_SPEED 90
+
+/* Turns go at this PWM whatever auto_spd is, so the time a turn takes
+ * gives its angle */
+#define AUTO_TURN_SPEED 120
+#define AUTO_TURN_MS_PER_HALF_SECTOR 21
+
+/* No path limit */
+#define AUTO_ROOM_MAX 255
+
+/* sin() of 0 to AUTO_RIGHT_ANGLE half sectors, in 1/256ths */
+static const uint8_t sin_half_sector[AUTO_RIGHT_ANGLE + 1] PROGMEM = {
+    0, 25, 50, 74, 98, 120, 142, 162, 180, 197, 212, 225, 236, 244, 250, 254, 255,
+};
+
+enum auto_step {
+    AUTO_DRIVE,
+    AUTO_LOOK,
+    AUTO_TURN,
+};
+
+static struct auto_state {
+    uint8_t active :1;
+
+    /* Turning away one right angle at a time, and which way. It stays the
+     * same way until the car drives again, so a boxed in car goes all the
+     * way round rather than back and forth */
+    uint8_t turning_away :1;
+    uint8_t away_left :1;
+
+    enum auto_step step;
+    uint16_t countdown;
+
+    /* Bit n is set once sector n has been read in this step */
+    uint16_t seen;
+
+    /* Of the last stop for an obstacle */
+    uint32_t latency;
+    uint32_t max_latency;
+} auto_state;
+
+static void drive(struct car_state *car, enum motor_dir left, enum motor_dir right,
+                  uint8_t speed)
+{
+    car_state_motor_left_speed_set(car, speed);
+    car_state_motor_right_speed_set(car, speed);
+    car_state_left_motor_set(car, left);
+    car_state_right_motor_set(car, right);
+}
+
+static void stop(struct car_state *car)
+{
+    drive(car, MOTOR_STOPPED, MOTOR_STOPPED, tune.auto_speed);
+}
+
+static void start_step(enum auto_step step)
+{
+    auto_state.step = step;
+    auto_state.seen = 0;
+
+    if (step == AUTO_DRIVE)
+        scan_set_range(AUTO_FRONT_FIRST, AUTO_FRONT_LAST);
+    else if (step == AUTO_LOOK)
+        scan_set_range(0, SCAN_SECTORS - 1);
+}
+
+/* Records that the sector read this tick, if any, has been seen. Returns
+ * it, or SCAN_NONE */
+static uint8_t see_sector(void)
+{
+    uint8_t sector = scan_updated_sector();
+
+    if (sector != SCAN_NONE)
+        auto_state.seen |= 1U << sector;
+
+    return sector;
+}
+
+static uint8_t is_front_sector(uint8_t sector)
+{
+    return sector >= AUTO_FRONT_FIRST && sector <= AUTO_FRONT_LAST;
+}
+
+/* Half sectors from straight ahead to the middle of 'sector' */
+static int8_t sector_angle(uint8_t sector)
+{
+    return 2 * sector + 1 - SCAN_SECTORS;
+}
+
+/*
+ * How far along a path 'angle' half sectors off the reading in 'sector' the
+ * car gets before it hits what was read, or AUTO_ROOM_MAX if it misses it.
+ * In cm / 2.
+ */
+static uint8_t room_past(uint8_t sector, int8_t angle)
+{
+    uint8_t cm = scan_sector(sector);
+
+    if (angle < 0)
+        angle = -angle;
+
+    if (cm == SCAN_UNKNOWN || angle > AUTO_RIGHT_ANGLE)
+        return AUTO_ROOM_MAX;
+
+    /* What was read can be anywhere across the sector, so the side of it
+     * nearest the path counts. The products take 16 unsigned bits */
+    if (((uint16_t)cm * pgm_read_byte(&sin_half_sector[angle ? angle - 1 : 0]) >> 8)
+        >= AUTO_HALF_WIDTH_HALF_CM)
+        return AUTO_ROOM_MAX;
+
+    return (uint16_t)cm * pgm_read_byte(&sin_half_sector[AUTO_RIGHT_ANGLE - angle]) >> 8;
+}
+
+/* Room along a path 'angle' half sectors left of straight ahead, going by
+ * the sectors 'first' to 'last' */
+static uint8_t path_room(int8_t angle, uint8_t first, uint8_t last)
+{
+    uint8_t room = AUTO_ROOM_MAX;
+    uint8_t i;
+
+    for (i = first; i <= last; i++) {
+        uint8_t r = room_past(i, sector_angle(i) - angle);
+
+        if (r < room)
+            room = r;
+    }
+
+    return room;
+}
+
+/* The speed to drive at with what is known of the front sectors */
+static uint8_t drive_speed(void)
+{
+    uint8_t crawl = tune.auto_speed < AUTO_CRAWL_SPEED ? tune.auto_speed : AUTO_CRAWL_SPEED;
+    uint16_t slow = AUTO_OBSTACLE_HALF_CM * AUTO_SLOW_RANGE;
+    uint16_t room = path_room(0, AUTO_FRONT_FIRST, AUTO_FRONT_LAST);
+
+    if ((auto_state.seen & AUTO_FRONT_MASK) != AUTO_FRONT_MASK
+        || room <= AUTO_OBSTACLE_HALF_CM)
+        return crawl;
+
+    if (room >= slow)
+        return tune.auto_speed;
+
+    return crawl + (uint32_t)(tune.auto_speed - crawl) * (room - AUTO_OBSTACLE_HALF_CM)
+                 / (slow - AUTO_OBSTACLE_HALF_CM);
+}
+
+static uint16_t ms_to_ticks(uint16_t ms)
+{
+    uint16_t ticks = (ms + tune.loop_period_ms / 2) / tune.loop_period_ms;
+
+    return ticks ? ticks : 1;
+}
+
+/* Pivots 'angle' half sectors, left if it is positive */
+static void turn(struct car_state *car, int8_t angle)
+{
+    /* Low servo degrees point right, high degrees point left */
+    if (angle < 0) {
+        angle = -angle;
+        drive(car, MOTOR_FOR, MOTOR_BACK, AUTO_TURN_SPEED);
+    } else {
+        drive(car, MOTOR_BACK, MOTOR_FOR, AUTO_TURN_SPEED);
+    }
+
+    auto_state.countdown = ms_to_ticks(angle * AUTO_TURN_MS_PER_HALF_SECTOR);
+    start_step(AUTO_TURN);
+}
+
+static void decide(struct car_state *car)
+{
+    uint8_t best = 0;
+    uint8_t best_room = 0;
+    uint8_t i;
+
+    if (path_room(0, 0, SCAN_SECTORS - 1) >= AUTO_CLEAR_HALF_CM) {
+        auto_state.turning_away = 0;
+        start_step(AUTO_DRIVE);
+        return ;
+    }
+
+    for (i = 0; i < SCAN_SECTORS; i++) {
+        uint8_t room = path_room(sector_angle(i), 0, SCAN_SECTORS - 1);
+
+        if (room > best_room) {
+            best = i;
+            best_room = room;
+        }
+    }
+
+    if (best_room < AUTO_CLEAR_HALF_CM) {
+        if (!auto_state.turning_away) {
+            auto_state.turning_away = 1;
+            auto_state.away_left = best >= AUTO_CENTER_SECTOR;
+        }
+
+        turn(car, auto_state.away_left ? AUTO_RIGHT_ANGLE : -AUTO_RIGHT_ANGLE);
+        return ;
+    }
+
+    auto_state.turning_away = 0;
+    turn(car, sector_angle(best));
+
+    fprintf(serial_out, "auto:turn:%d:%lu:%lu\n", best, auto_state.latency,
+            auto_state.max_latency);
+}
+
+void autonomous_tick(struct car_state *car)
+{
+    if (!auto_state.active)
+        return ;
+
+    switch (auto_state.step) {
+    case AUTO_DRIVE: {
+        uint8_t sector = see_sector();
+
+        if (sector != SCAN_NONE
+            && is_front_sector(sector)
+            && room_past(sector, sector_angle(sector)) < AUTO_OBSTACLE_HALF_CM) {
+            uint32_t latency = clock_micros() - ultrasonic_last_reading_time(ULTRASONIC_FRONT);
+
+            if (latency > auto_state.max_latency)
+                auto_state.max_latency = latency;
+            auto_state.latency = latency;
+
+            stop(car);
+            start_step(AUTO_LOOK);
+            break;
+        }
+
+        drive(car, MOTOR_FOR, MOTOR_FOR, drive_speed());
+        break;
+    }
+
+    case AUTO_LOOK:
+        see_sector();
+
+        if (auto_state.seen == AUTO_ALL_MASK)
+            decide(car);
+        break;
+
+    case AUTO_TURN:
+        if (!--auto_state.countdown) {
+            stop(car);
+            start_step(AUTO_LOOK);
+        }
+        break;
+    }
+}
+
+void autonomous_start(void)
+{
+    auto_state.active = 1;
+    auto_state.turning_away = 0;
+    auto_state.max_latency = 0;
+
+    scan_start();
+    start_step(AUTO_DRIVE);
+}
+
+void autonomous_stop(struct car_state *car)
+{
+    auto_state.active = 0;
+
+    stop(car);
+    scan_stop();
+}
+
+uint8_t autonomous_active(void)
+{
+    return auto_state.active;
+}
@@ -0,0 +1,177 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+
+#include "serial.h"
+#include "blackbox.h"
+
+/*
+ * The ring and the task ID live in .noinit, which the C runtime leaves
+ * alone, so after a reset they still hold what the loop last wrote. After a
+ * power-on they hold garbage, which the magic number catches.
+ *
+ * The watchdog times out after 500ms. That is long enough for the slowest
+ * legitimate tick, which is an IRQ monitor report at 38400 baud (the
+ * recorder saves to EEPROM a little per tick). A hung car has its
+ * motors stopped again well within a second: the timeout, then the few ms
+ * the boot takes to get to car_state_init(). The fault is only written to
+ * EEPROM after that.
+ */
+
+#define BLACKBOX_RING_MAGIC 0xB10C
+
+struct blackbox_snapshot {
+    uint16_t tick;
+    uint8_t motor_left;
+    uint8_t motor_right;
+    uint8_t motor_left_speed;
+    uint8_t motor_right_speed;
+    uint8_t servo_degree;
+};
+
+static struct blackbox_ring {
+    uint16_t magic;
+    uint8_t head;
+
+    /* Ticks the loop has run, wrapping */
+    uint16_t ticks;
+
+    struct blackbox_snapshot snaps[BLACKBOX_SNAPSHOTS];
+} ring __attribute__((section(".noinit")));
+
+uint8_t blackbox_current_task __attribute__((section(".noinit")));
+
+/* MCUSR, as it was at reset */
+static uint8_t reset_flags __attribute__((section(".noinit")));
+
+struct blackbox_record {
+    uint8_t reset_flags;
+    uint8_t task;
+    uint16_t ticks;
+
+    /* Oldest first */
+    struct blackbox_snapshot snaps[BLACKBOX_SNAPSHOTS];
+};
+
+/* The magic holds a layout version, so a record from an older layout is
+ * never read. Bump BLACKBOX_VERSION on every change to struct
+ * blackbox_record, even one that keeps its size. Older firmware used
+ * 0x80 | size, which always has bit 7 set */
+#define BLACKBOX_VERSION 1
+#define BLACKBOX_MAGIC (0x40 | BLACKBOX_VERSION)
+
+static uint8_t EEMEM blackbox_eeprom_magic;
+static struct blackbox_record EEMEM blackbox_eeprom;
+
+/*
+ * Runs from .init3, before main() and before .data and .bss are set up. A
+ * watchdog reset leaves the watchdog running at its shortest timeout, so it
+ * has to be stopped here or the boot never gets anywhere.
+ *
+ * Optiboot clears MCUSR before starting the firmware, but leaves a copy of
+ * it in r2.
+ */
+void blackbox_early(void) __attribute__((naked, used, section(".init3")));
+void blackbox_early(void)
+{
+    uint8_t flags = MCUSR;
+
+    if (!flags)
+        __asm__ __volatile__ ("mov %0, r2" : "=r" (flags));
+
+    MCUSR = 0;
+    wdt_disable();
+
+    reset_flags = flags & (_BV(WDRF) | _BV(BORF) | _BV(EXTRF) | _BV(PORF));
+}
+
+static uint8_t ring_valid(void)
+{
+    return ring.magic == BLACKBOX_RING_MAGIC && ring.head < BLACKBOX_SNAPSHOTS;
+}
+
+static void save_fault(void)
+{
+    struct blackbox_record rec;
+    uint8_t i;
+
+    rec.reset_flags = reset_flags;
+    rec.task = blackbox_current_task;
+    rec.ticks = ring.ticks;
+
+    /* The head is the oldest, it gets written next */
+    for (i = 0; i < BLACKBOX_SNAPSHOTS; i++)
+        rec.snaps[i] = ring.snaps[(ring.head + i) % BLACKBOX_SNAPSHOTS];
+
+    eeprom_update_block(&rec, &blackbox_eeprom, sizeof(rec));
+    eeprom_update_byte(&blackbox_eeprom_magic, BLACKBOX_MAGIC);
+}
+
+void blackbox_init(void)
+{
+    if ((reset_flags & (_BV(WDRF) | _BV(BORF))) && ring_valid())
+        save_fault();
+
+    fprintf(serial_out, "bbox:reset:%u\n", reset_flags);
+
+    memset(&ring, 0, sizeof(ring));
+    ring.magic = BLACKBOX_RING_MAGIC;
+    blackbox_task(BLACKBOX_TASK_BOOT);
+
+    wdt_enable(WDTO_500MS);
+}
+
+void blackbox_tick(const struct car_state *car)
+{
+    struct blackbox_snapshot *s = ring.snaps + ring.head;
+
+    wdt_reset();
+
+    s->tick = ring.ticks;
+    s->motor_left = car->motor_left;
+    s->motor_right = car->motor_right;
+    s->motor_left_speed = car->motor_left_speed;
+    s->motor_right_speed = car->motor_right_speed;
+    s->servo_degree = car->servo_degree;
+
+    if (++ring.head == BLACKBOX_SNAPSHOTS)
+        ring.head = 0;
+
+    ring.ticks++;
+}
+
+void blackbox_report(void)
+{
+    struct blackbox_record rec;
+    uint8_t i;
+
+    fprintf(serial_out, "bbox:reset:%u\n", reset_flags);
+
+    if (eeprom_read_byte(&blackbox_eeprom_magic) != BLACKBOX_MAGIC) {
+        fprintf(serial_out, "bbox:fault:none\n");
+        return ;
+    }
+
+    eeprom_read_block(&rec, &blackbox_eeprom, sizeof(rec));
+
+    fprintf(serial_out, "bbox:fault:%u:%u:%u\n", rec.reset_flags, rec.task, rec.ticks);
+
+    /* A fault in the first few ticks has fewer snapshots */
+    i = rec.ticks < BLACKBOX_SNAPSHOTS ? BLACKBOX_SNAPSHOTS - rec.ticks : 0;
+    for (; i < BLACKBOX_SNAPSHOTS; i++) {
+        struct blackbox_snapshot *s = rec.snaps + i;
+
+        fprintf(serial_out, "bbox:snap:%u:%u:%u:%u:%u:%u\n", s->tick,
+                s->motor_left, s->motor_right, s->motor_left_speed,
+                s->motor_right_speed, s->servo_degree);
+    }
+}
+
+void blackbox_clear(void)
+{
+    eeprom_update_byte(&blackbox_eeprom_magic, 0xFF);
+    fprintf(serial_out, "bbox:fault:none\n");
+}
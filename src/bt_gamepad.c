@@ -3,130 +3,285 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
 
 #include "bt_gamepad.h"
+#include "motion.h"
+#include "blackbox.h"
+#include "latency.h"
 #include "serial.h"
+#include "tune.h"
 
+/* Characters from the serial arrive through the event queue, and are
+ * collected here until a newline completes the message. The longest message
+ * is a motion step, "mq:9999:-255:-255:255". A message with a lost or
+ * garbled character, or one longer than MSG_LEN - 1 characters, is dropped
+ * whole at its newline. */
+#define MSG_LEN 24
 
-/* We implement queue as a ring buffer of messages from the serial input. As
- * characters come in, they are placed into the buffer at msg_write_idx. When
- * we recieve a newline character, we increment msg_write_idx to the next
- * value.
- *
- * Separately, msg_write_idx and msg_read_idx are checked, and if they differ,
- * then we will start processing all the messages in the queue until
- * msg_read_idx equals msg_write_idx.
- *
- * This works assuming MSG_BUF_CNT is high enough that we don't run out of
- * queue spots when getting lots of input.
- */
-#define MSG_BUF_CNT 20
-#define MSG_LEN 20
-
-static volatile char msg_buf[MSG_BUF_CNT][MSG_LEN];
-static volatile uint16_t msg_len[MSG_BUF_CNT];
-
-static volatile uint16_t msg_read_idx;
-static volatile uint16_t msg_write_idx;
-
-static void handle_serial_char(char ch)
-{
-    /* This handles characters from the serial. Note we're called in an
-     * interrupt context so we can't do the processing here and have to finish
-     * up really fast. */
-    if (ch == '\n') {
-        if (msg_len[msg_write_idx] > 0) {
-            msg_write_idx++;
-            if (msg_write_idx == MSG_BUF_CNT)
-                msg_write_idx = 0;
-        }
-    } else if (msg_len[msg_write_idx] < MSG_LEN - 1) {
-        msg_buf[msg_write_idx][msg_len[msg_write_idx]] = ch;
-        msg_len[msg_write_idx]++;
-    }
-}
+static char msg_buf[MSG_LEN];
+static uint8_t msg_len;
+static uint8_t msg_bad;
 
 struct bt_gamepad_state {
     int8_t ud_axis;
     int8_t lr_axis;
 
-    uint8_t buttons[8];
+    /* Bit n is button n */
+    uint8_t buttons;
 };
 
 static struct bt_gamepad_state gamepad_state;
 
-static void handle_gamepad_state()
+/* Receive time of the newline that completed the last axis or button
+ * message, if it hasn't been taken yet */
+static uint16_t input_stamp;
+static uint8_t input_pending;
+
+/*
+ * Parses a decimal number, with an optional '-'. Anything past 4 digits
+ * saturates, so a long number can't overflow. Returns 0 if 's' is empty or
+ * has anything else in it.
+ */
+static uint8_t parse_number(const char *s, int16_t *out)
 {
-    /* Handle any messages in the queue */
-    while (msg_read_idx != msg_write_idx) {
-        /* We turn interrupts off for this part so that the serial interrupt
-         * can't touch any of these variables while we work with them */
-        cli();
-        char tmp_msg[MSG_LEN] = { 0 };
-        uint16_t len = msg_len[msg_read_idx];
-        uint16_t i;
+    uint8_t neg = 0;
+    int16_t v = 0;
 
-        for (i = 0; i < len; i++)
-            tmp_msg[i] = msg_buf[msg_read_idx][i];
+    if (*s == '-') {
+        neg = 1;
+        s++;
+    }
 
-        msg_len[msg_read_idx] = 0;
-        for (i = 0; i < MSG_BUF_CNT; i++)
-            msg_buf[msg_read_idx][i] = 0;
+    if (!*s)
+        return 0;
 
-        msg_read_idx++;
-        if (msg_read_idx == MSG_BUF_CNT)
-            msg_read_idx = 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9')
+            return 0;
 
-        sei();
+        if (v < 1000)
+            v = v * 10 + (*s - '0');
+        else
+            v = 9999;
+    }
 
-        char *stringp = tmp_msg;
+    *out = neg ? -v : v;
+    return 1;
+}
 
-        char *id = strsep(&stringp, ":");
+static int8_t clamp_axis(int16_t v)
+{
+    if (v < INT8_MIN)
+        return INT8_MIN;
 
-        if (!id)
+    if (v > INT8_MAX)
+        return INT8_MAX;
+
+    return v;
+}
+
+/* mq:<ms>:<left>:<right>[:<servo>], or mq:run and the others */
+static void handle_motion(char *stringp)
+{
+    char *cmd = strsep(&stringp, ":");
+
+    if (!cmd)
+        return ;
+
+    if (strcmp(cmd, "run") == 0) {
+        motion_run();
+    } else if (strcmp(cmd, "stop") == 0) {
+        motion_stop();
+    } else if (strcmp(cmd, "clear") == 0) {
+        motion_clear();
+    } else if (strcmp(cmd, "stat") == 0) {
+        motion_report();
+    } else {
+        char *left = strsep(&stringp, ":");
+        char *right = strsep(&stringp, ":");
+        char *servo = strsep(&stringp, ":");
+        int16_t ms, l, r, s = -1;
+
+        if (!left || !right
+            || !parse_number(cmd, &ms) || !parse_number(left, &l) || !parse_number(right, &r)
+            || (servo && !parse_number(servo, &s))
+            || ms < 0 || (servo && s < 0)) {
+            fprintf(serial_out, "mq:err:bad\n");
             return ;
+        }
+
+        motion_add(ms, l, r, s);
+    }
+}
+
+/* Returns 1 if the message was gamepad input */
+static uint8_t handle_message(char *msg)
+{
+    char *stringp = msg;
+
+    char *id = strsep(&stringp, ":");
+
+    if (!id)
+        return 0;
 
-        /*
-         * The data from the BT controller is one of:
-         *
-         * axis:N:X:Y
-         * btn:N:P
-         */
-        if (strcmp(id, "axis") == 0) {
-            id = strsep(&stringp, ":");
-            char *lr_axis = strsep(&stringp, ":");
-            char *ud_axis = strsep(&stringp, ":");
-
-            if (!id || !lr_axis || !ud_axis)
-                return ;
-
-            gamepad_state.lr_axis = atoi(lr_axis);
-            gamepad_state.ud_axis = atoi(ud_axis);
-        } else if (strcmp(id, "btn") == 0) {
-            id = strsep(&stringp, ":");
-            char *pressed = strsep(&stringp, ":");
-
-            if (!id || !pressed)
-                return ;
-
-            int but = atoi(id);
-            if (but >= ARRAY_SIZE(gamepad_state.buttons))
-                return ;
-
-            gamepad_state.buttons[but] = (*pressed == '1');
+    /*
+     * The data from the BT controller is one of:
+     *
+     * axis:N:X:Y
+     * btn:N:P
+     *
+     * Or one of the tuning commands:
+     *
+     * get:NAME
+     * set:NAME:V
+     * list
+     * save
+     *
+     * Or one of the motion queue commands in motion.h, or the serial link
+     * ones in serial.h:
+     *
+     * baud:RATE
+     * baud:ok
+     * uart
+     *
+     * Or the fault recorder's, in blackbox.h:
+     *
+     * bbox
+     * bbox:clear
+     */
+    if (strcmp(id, "axis") == 0) {
+        id = strsep(&stringp, ":");
+        char *lr_axis = strsep(&stringp, ":");
+        char *ud_axis = strsep(&stringp, ":");
+
+        int16_t lr, ud;
+
+        if (!id || !lr_axis || !ud_axis)
+            return 0;
+
+        if (!parse_number(lr_axis, &lr) || !parse_number(ud_axis, &ud))
+            return 0;
+
+        gamepad_state.lr_axis = clamp_axis(lr);
+        gamepad_state.ud_axis = clamp_axis(ud);
+        return 1;
+    } else if (strcmp(id, "btn") == 0) {
+        id = strsep(&stringp, ":");
+        char *pressed = strsep(&stringp, ":");
+
+        int16_t but;
+
+        if (!id || !pressed)
+            return 0;
+
+        if (!parse_number(id, &but))
+            return 0;
+
+        if (but < 0 || but >= BT_GAMEPAD_BUTTONS)
+            return 0;
+
+        if (*pressed == '1')
+            gamepad_state.buttons |= _BV(but);
+        else
+            gamepad_state.buttons &= ~_BV(but);
+        return 1;
+    } else if (strcmp(id, "get") == 0) {
+        char *name = strsep(&stringp, ":");
+
+        if (!name)
+            return 0;
+
+        tune_get(name);
+    } else if (strcmp(id, "set") == 0) {
+        char *name = strsep(&stringp, ":");
+        char *value = strsep(&stringp, ":");
+
+        if (!name || !value)
+            return 0;
+
+        tune_set(name, value);
+    } else if (strcmp(id, "list") == 0) {
+        tune_list();
+    } else if (strcmp(id, "save") == 0) {
+        tune_save();
+    } else if (strcmp(id, "mq") == 0) {
+        handle_motion(stringp);
+    } else if (strcmp(id, "baud") == 0) {
+        char *rate = strsep(&stringp, ":");
+
+        if (!rate)
+            return 0;
+
+        if (strcmp(rate, "ok") == 0)
+            serial_baud_confirm();
+        else
+            serial_baud_try(rate);
+    } else if (strcmp(id, "uart") == 0) {
+        serial_report();
+    } else if (strcmp(id, "bbox") == 0) {
+        char *cmd = strsep(&stringp, ":");
+
+        if (cmd && strcmp(cmd, "clear") == 0)
+            blackbox_clear();
+        else if (!cmd)
+            blackbox_report();
+    }
+
+    return 0;
+}
+
+void bt_gamepad_handle_char(char ch, uint16_t stamp)
+{
+    if (ch == '\n') {
+        if (msg_len > 0 && !msg_bad) {
+            msg_buf[msg_len] = '\0';
+            if (handle_message(msg_buf)) {
+                input_stamp = stamp;
+                input_pending = 1;
+            }
         }
+        msg_len = 0;
+        msg_bad = 0;
+    } else if (msg_len < MSG_LEN - 1) {
+        msg_buf[msg_len++] = ch;
+    } else {
+        msg_bad = 1;
     }
 }
 
+void bt_gamepad_handle_error(void)
+{
+    msg_bad = 1;
+}
+
 void bt_gamepad_init(void)
 {
-    serial_init(handle_serial_char);
+    memset(&gamepad_state, 0, sizeof(gamepad_state));
+    msg_len = 0;
+    msg_bad = 0;
+    input_pending = 0;
+
+    serial_init();
+}
+
+uint8_t bt_gamepad_take_input(uint16_t *stamp)
+{
+    if (!input_pending)
+        return 0;
+
+    *stamp = input_stamp;
+    input_pending = 0;
+    return 1;
+}
+
+uint8_t bt_gamepad_buttons(void)
+{
+    return gamepad_state.buttons;
 }
 
-void bt_gamepad_update_state(void)
+uint8_t bt_gamepad_idle(void)
 {
-    handle_gamepad_state();
+    return !gamepad_state.lr_axis && !gamepad_state.ud_axis && !gamepad_state.buttons;
 }
 
 static float normalize(int8_t v)
@@ -158,33 +313,41 @@ void bt_gamepad_apply(struct car_state *car)
 
     if (r > 1) {
         car_state_right_motor_set(car, MOTOR_FOR);
-        car_state_motor_right_speed_set(car, (uint8_t)(r * 2) + 50);
+        car_state_motor_right_speed_set(car, (uint8_t)(r * 2) + tune.pwm_offset);
     } else if (r < -1) {
         car_state_right_motor_set(car, MOTOR_BACK);
-        car_state_motor_right_speed_set(car, (uint8_t)(-r * 2) + 50);
+        car_state_motor_right_speed_set(car, (uint8_t)(-r * 2) + tune.pwm_offset);
     } else {
         car_state_right_motor_set(car, MOTOR_STOPPED);
     }
 
     if (l > 1) {
         car_state_left_motor_set(car, MOTOR_FOR);
-        car_state_motor_left_speed_set(car, (uint8_t)(l * 2) + 50);
+        car_state_motor_left_speed_set(car, (uint8_t)(l * 2) + tune.pwm_offset);
     } else if (l < -1) {
         car_state_left_motor_set(car, MOTOR_BACK);
-        car_state_motor_left_speed_set(car, (uint8_t)(-l * 2) + 50);
+        car_state_motor_left_speed_set(car, (uint8_t)(-l * 2) + tune.pwm_offset);
     } else {
         car_state_left_motor_set(car, MOTOR_STOPPED);
     }
+}
+
+void bt_gamepad_tick(struct car_state *car, uint8_t (*manual_driving)(void))
+{
+    uint16_t stamp;
+
+    /* Taken every tick, so an input that came in while something else was
+     * driving doesn't get traced later */
+    uint8_t new_input = bt_gamepad_take_input(&stamp);
 
-    int servo_degree = car->servo_degree;
-    if (gamepad_state.buttons[1])
-        servo_degree = 192;
+    if (new_input && !bt_gamepad_idle())
+        motion_abort(car);
 
-    if (gamepad_state.buttons[3])
-        servo_degree = 64;
+    if (!manual_driving())
+        return ;
 
-    if (gamepad_state.buttons[2])
-        servo_degree = 128;
+    if (new_input)
+        car_state_input_tag(car, LATENCY_BT, stamp);
 
-    car_state_servo_degree_set(car, servo_degree);
+    bt_gamepad_apply(car);
 }
@@ -0,0 +1,51 @@
+#include "common.h"
+
+#include <avr/pgmspace.h>
+
+#include "clock.h"
+#include "button_map.h"
+
+void button_map_update(struct button_map *map, uint16_t buttons, uint8_t driving)
+{
+    uint16_t changed = map->held ^ buttons;
+    uint16_t pressed = changed & buttons;
+    uint16_t released = changed & map->held;
+    uint32_t now = clock_micros();
+    uint8_t i;
+
+    map->held = buttons;
+
+    for (i = 0; i < map->actions_len; i++) {
+        struct button_action a;
+        uint8_t runs = 0;
+
+        memcpy_P(&a, map->actions + i, sizeof(a));
+
+        if ((a.flags & (BUTTON_PRESS | BUTTON_REPEAT)) && (pressed & a.buttons)) {
+            runs = 1;
+            map->repeat_at[i] = now + (uint32_t)a.delay_ms * 1000;
+        } else if ((a.flags & BUTTON_REPEAT) && (buttons & a.buttons)) {
+            uint32_t *at = map->repeat_at + i;
+
+            while ((int32_t)(now - *at) >= 0 && runs < BUTTON_MAX_CATCH_UP) {
+                runs++;
+                *at += (uint32_t)a.repeat_ms * 1000;
+            }
+
+            /* Too far behind to catch up, so start over from now */
+            if ((int32_t)(now - *at) >= 0)
+                *at = now + (uint32_t)a.repeat_ms * 1000;
+        }
+
+        /* An entry for several buttons runs once, even if one is pressed
+         * and another released in the same update */
+        if ((a.flags & BUTTON_RELEASE) && (released & a.buttons) && !runs)
+            runs = 1;
+
+        if ((a.flags & BUTTON_DRIVING) && !driving)
+            continue;
+
+        while (runs--)
+            a.run(buttons);
+    }
+}
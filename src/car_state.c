@@ -8,6 +8,9 @@
 #include "l298n.h"
 #include "servo.h"
 #include "car_state.h"
+#include "recorder.h"
+#include "latency.h"
+#include "motion.h"
 
 void car_state_init(void)
 {
@@ -23,9 +26,9 @@ void car_state_init(void)
     servo_register(&PORTD, PORTD3);
 }
 
-static void handle_motor_left(struct car_state *car)
+static void output_left(enum motor_dir dir)
 {
-    switch (car->motor_left) {
+    switch (dir) {
     case MOTOR_STOPPED:
         l298n_left_stop();
         break;
@@ -40,9 +43,9 @@ static void handle_motor_left(struct car_state *car)
     }
 }
 
-static void handle_motor_right(struct car_state *car)
+static void output_right(enum motor_dir dir)
 {
-    switch (car->motor_right) {
+    switch (dir) {
     case MOTOR_STOPPED:
         l298n_right_stop();
         break;
@@ -57,14 +60,42 @@ static void handle_motor_right(struct car_state *car)
     }
 }
 
+static uint8_t output_speed(const struct car_state *car, uint8_t speed, int8_t trim)
+{
+    int16_t trimmed = (int16_t)speed + trim;
+
+    if (trimmed < 0)
+        return 0;
+
+    if (trimmed > 255)
+        trimmed = 255;
+
+    uint16_t scaled = ((uint16_t)trimmed * car->speed_scale) / CAR_STATE_SCALE_ONE;
+
+    if (scaled > 255)
+        return 255;
+
+    return scaled;
+}
+
+static void handle_motor_left(struct car_state *car)
+{
+    output_left(car->motor_left);
+}
+
+static void handle_motor_right(struct car_state *car)
+{
+    output_right(car->motor_right);
+}
+
 static void handle_motor_right_speed(struct car_state *car)
 {
-    OCR0A = car->motor_right_speed;
+    OCR0A = output_speed(car, car->motor_right_speed, -car->motor_trim);
 }
 
 static void handle_motor_left_speed(struct car_state *car)
 {
-    OCR0B = car->motor_left_speed;
+    OCR0B = output_speed(car, car->motor_left_speed, car->motor_trim);
 }
 
 static void handle_servo_degree(struct car_state *car)
@@ -72,55 +103,120 @@ static void handle_servo_degree(struct car_state *car)
     servo_set(car->servo_degree);
 }
 
+void car_state_output_motors(const struct car_state *car,
+                             enum motor_dir left, uint8_t left_speed,
+                             enum motor_dir right, uint8_t right_speed)
+{
+    if (left != MOTOR_STOPPED)
+        OCR0B = output_speed(car, left_speed, car->motor_trim);
+
+    if (right != MOTOR_STOPPED)
+        OCR0A = output_speed(car, right_speed, -car->motor_trim);
+
+    output_left(left);
+    output_right(right);
+}
+
 void car_state_apply(struct car_state *car)
 {
+    uint8_t actuated = 0;
+
+    /* A running motion queue writes the motors itself */
+    if (motion_owns_motors(car)) {
+        car->motor_left_speed_changed = 0;
+        car->motor_right_speed_changed = 0;
+        car->motor_left_changed = 0;
+        car->motor_right_changed = 0;
+    }
+
     if (car->motor_left_speed_changed) {
         handle_motor_left_speed(car);
         car->motor_left_speed_changed = 0;
+        actuated = 1;
     }
 
     if (car->motor_right_speed_changed) {
         handle_motor_right_speed(car);
         car->motor_right_speed_changed = 0;
+        actuated = 1;
     }
 
     if (car->motor_left_changed) {
         handle_motor_left(car);
         car->motor_left_changed = 0;
+        actuated = 1;
     }
 
     if (car->motor_right_changed) {
         handle_motor_right(car);
         car->motor_right_changed = 0;
+        actuated = 1;
     }
 
     if (car->servo_degree_changed) {
         handle_servo_degree(car);
         car->servo_degree_changed = 0;
+        actuated = 1;
+    }
+
+    if (car->input_tagged) {
+        if (actuated)
+            latency_record(car->input_source, car->input_stamp);
+
+        car->input_tagged = 0;
     }
 }
 
 void car_state_left_motor_set(struct car_state *car, enum motor_dir dir)
 {
+    if (dir == car->motor_left_cut)
+        dir = MOTOR_STOPPED;
+    else
+        car->motor_left_cut = MOTOR_STOPPED;
+
     if (car->motor_left != dir) {
         car->motor_left = dir;
         car->motor_left_changed = 1;
+        recorder_log(REC_LEFT_DIR, dir);
     }
 }
 
 void car_state_right_motor_set(struct car_state *car, enum motor_dir dir)
 {
+    if (dir == car->motor_right_cut)
+        dir = MOTOR_STOPPED;
+    else
+        car->motor_right_cut = MOTOR_STOPPED;
+
     if (car->motor_right != dir) {
         car->motor_right = dir;
         car->motor_right_changed = 1;
+        recorder_log(REC_RIGHT_DIR, dir);
     }
 }
 
+void car_state_left_motor_cut(struct car_state *car)
+{
+    enum motor_dir dir = car->motor_left;
+
+    car_state_left_motor_set(car, MOTOR_STOPPED);
+    car->motor_left_cut = dir;
+}
+
+void car_state_right_motor_cut(struct car_state *car)
+{
+    enum motor_dir dir = car->motor_right;
+
+    car_state_right_motor_set(car, MOTOR_STOPPED);
+    car->motor_right_cut = dir;
+}
+
 void car_state_servo_degree_set(struct car_state *car, uint8_t servo)
 {
     if (car->servo_degree != servo) {
         car->servo_degree = servo;
         car->servo_degree_changed = 1;
+        recorder_log(REC_SERVO, servo);
     }
 }
 
@@ -129,6 +225,7 @@ void car_state_motor_left_speed_set(struct car_state *car, uint8_t speed)
     if (car->motor_left_speed != speed) {
         car->motor_left_speed = speed;
         car->motor_left_speed_changed = 1;
+        recorder_log(REC_LEFT_SPEED, speed);
     }
 }
 
@@ -137,6 +234,31 @@ void car_state_motor_right_speed_set(struct car_state *car, uint8_t speed)
     if (car->motor_right_speed != speed) {
         car->motor_right_speed = speed;
         car->motor_right_speed_changed = 1;
+        recorder_log(REC_RIGHT_SPEED, speed);
     }
 }
 
+void car_state_motor_trim_set(struct car_state *car, int8_t trim)
+{
+    if (car->motor_trim != trim) {
+        car->motor_trim = trim;
+        car->motor_left_speed_changed = 1;
+        car->motor_right_speed_changed = 1;
+    }
+}
+
+void car_state_speed_scale_set(struct car_state *car, uint8_t scale)
+{
+    if (car->speed_scale != scale) {
+        car->speed_scale = scale;
+        car->motor_left_speed_changed = 1;
+        car->motor_right_speed_changed = 1;
+    }
+}
+
+void car_state_input_tag(struct car_state *car, uint8_t source, uint16_t stamp)
+{
+    car->input_source = source;
+    car->input_stamp = stamp;
+    car->input_tagged = 1;
+}
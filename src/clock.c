@@ -0,0 +1,78 @@
+
+#include "common.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "clock.h"
+#include "irq_monitor.h"
+
+/*
+ * TIMER1 runs freely in normal mode with a prescaler of 8, and the overflow
+ * interrupt counts the upper bits. The servo driver uses the compare A
+ * interrupt on the same timer, moving OCR1A forward instead of resetting the
+ * count, so the two don't disturb each other.
+ *
+ * The counter is read with interrupts off. If TIMER1 overflowed after they
+ * were turned off, the overflow interrupt hasn't counted it yet. A low count
+ * plus the pending TOV1 flag means that happened, so it is added in here.
+ */
+
+volatile uint32_t clock_overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+    IRQ_MONITOR_START_DUE(0);
+
+    clock_overflows++;
+
+    IRQ_MONITOR_STOP(IRQ_CLOCK);
+}
+
+static inline void clock_read(uint32_t *ovf, uint16_t *count)
+{
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    *count = TCNT1;
+    *ovf = clock_overflows;
+
+    if ((TIFR1 & _BV(TOV1)) && *count < 0x8000)
+        (*ovf)++;
+
+    IRQ_MONITOR_STOP(IRQ_CLI_CLOCK);
+    SREG = sreg;
+}
+
+uint32_t clock_ticks(void)
+{
+    uint32_t ovf;
+    uint16_t count;
+
+    clock_read(&ovf, &count);
+
+    return (ovf << 16) | count;
+}
+
+uint32_t clock_micros(void)
+{
+    uint32_t ovf;
+    uint16_t count;
+
+    clock_read(&ovf, &count);
+
+    return (ovf << 15) + (count >> 1);
+}
+
+void clock_init(void)
+{
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11);
+    TCNT1 = 0;
+
+    clock_overflows = 0;
+
+    TIFR1 = _BV(TOV1);
+    TIMSK1 |= _BV(TOIE1);
+}
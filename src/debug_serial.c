@@ -2,52 +2,123 @@
 #include "common.h"
 
 #include <stdio.h>
+#include <avr/interrupt.h>
 #include <avr/io.h>
-#include <util/delay.h>
 
 #include "debug_serial.h"
+#include "irq_monitor.h"
 
 #define SERIAL_PORT PORTC
 #define SERIAL_PIN  PORTC2
 
-/* A delay of 103us gives us right around 9600 baud */
-#define BAUD_DELAY 103
+/* TIMER2 in CTC mode with a prescaler of 8 interrupts at 2MHz / (207 + 1),
+ * right around 9600 baud */
+#define BAUD_OCR 207
+
+/* Must be a power of 2 */
+#define TX_BUF_LEN 128
 
 /* This is a bitbangged TX-only UART, just for debugging output.
  *
- * The hardware serial is used by other parts of the system. */
-static int serial_putc(char c, FILE *f)
-{
-    /* Send start bit */
-    SERIAL_PORT &= ~_BV(SERIAL_PIN);
-    _delay_us(BAUD_DELAY);
+ * The hardware serial is used by other parts of the system.
+ *
+ * Characters are queued and shifted out one bit per TIMER2 interrupt, so
+ * printing doesn't stall the caller for a millisecond per character. If the
+ * queue is full, characters are dropped rather than waiting. The interrupt is
+ * turned off whenever the queue is empty.
+ */
+static volatile char tx_buf[TX_BUF_LEN];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+
+static volatile uint16_t tx_dropped;
+
+/* Bits of the current character left to send, including the stop bit */
+static uint8_t tx_bits;
+static uint8_t tx_byte;
 
-    int i;
-    for (i = 0; i < 8; i++, c >>= 1) {
-        if (c & 1)
+static inline void tx_next(void)
+{
+    if (tx_bits) {
+        /* The stop bit comes out of the high bit shifted in below */
+        if (tx_byte & 1)
             SERIAL_PORT |= _BV(SERIAL_PIN);
         else
             SERIAL_PORT &= ~_BV(SERIAL_PIN);
 
-        _delay_us(BAUD_DELAY);
+        tx_byte = (tx_byte >> 1) | 0x80;
+        tx_bits--;
+        return ;
     }
 
-    /* Send stop bit */
-    SERIAL_PORT |= _BV(SERIAL_PIN);
-    _delay_us(BAUD_DELAY);
+    if (tx_tail == tx_head) {
+        TIMSK2 &= ~_BV(OCIE2A);
+        return ;
+    }
+
+    tx_byte = tx_buf[tx_tail];
+    tx_tail = (tx_tail + 1) & (TX_BUF_LEN - 1);
+    tx_bits = 9;
+
+    /* Send start bit */
+    SERIAL_PORT &= ~_BV(SERIAL_PIN);
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+    /* In CTC mode TIMER2 restarted from 0 at the match, and it counts in
+     * 0.5us ticks too */
+    IRQ_MONITOR_START_LATE(TCNT2);
+
+    tx_next();
+
+    IRQ_MONITOR_STOP(IRQ_DEBUG_TX);
+}
+
+static int serial_putc(char c, FILE *f)
+{
+    uint8_t next = (tx_head + 1) & (TX_BUF_LEN - 1);
+
+    if (next == tx_tail) {
+        tx_dropped++;
+        return c;
+    }
+
+    tx_buf[tx_head] = c;
+    tx_head = next;
+
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    if (!(TIMSK2 & _BV(OCIE2A))) {
+        TCNT2 = 0;
+        TIFR2 = _BV(OCF2A);
+        TIMSK2 |= _BV(OCIE2A);
+    }
+
+    IRQ_MONITOR_STOP(IRQ_CLI_DEBUG_TX);
+    SREG = sreg;
 
     return c;
 }
 
+uint16_t debug_serial_dropped(void)
+{
+    return tx_dropped;
+}
+
 void debug_serial_init(void)
 {
     DDRC |= _BV(DDC2);
 
     SERIAL_PORT |= _BV(SERIAL_PIN);
 
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS21);
+    OCR2A = BAUD_OCR;
+
 #ifdef USE_PRINTF
     fdevopen(&serial_putc, NULL);
 #endif
 }
-
-
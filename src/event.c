@@ -0,0 +1,26 @@
+
+#include "common.h"
+
+#include "event.h"
+
+volatile struct event event_queue[EVENT_QUEUE_LEN];
+volatile uint8_t event_head;
+volatile uint8_t event_tail;
+volatile uint8_t event_dropped;
+
+uint8_t event_get(struct event *ev)
+{
+    uint8_t tail = event_tail;
+
+    if (tail == event_head)
+        return 0;
+
+    ev->type = event_queue[tail].type;
+    ev->data = event_queue[tail].data;
+    ev->stamp = event_queue[tail].stamp;
+
+    /* Only now can the ISRs reuse the slot */
+    event_tail = (tail + 1) & (EVENT_QUEUE_LEN - 1);
+
+    return 1;
+}
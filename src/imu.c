@@ -0,0 +1,191 @@
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "twi_master.h"
+#include "clock.h"
+#include "car_state.h"
+#include "imu.h"
+
+/*
+ * MPU-6050 class IMU, on the same bitbanged TWI bus as the Wii extension.
+ *
+ * Only the gyro is used. Each update burst-reads all three gyro axes in one
+ * transfer (~0.7ms on the bus) and integrates the Z axis into the yaw. The
+ * bias is measured over the first updates after init, so the car must be
+ * still for the first half second or so after boot.
+ *
+ * This only talks to the hardware through twi_master.h and clock.h, so it
+ * can be built on the host against a fake TWI device.
+ */
+
+#define IMU_ADDRESS 0x68
+
+#define IMU_REG_CONFIG       0x1A
+#define IMU_REG_GYRO_CONFIG  0x1B
+#define IMU_REG_GYRO_XOUT_H  0x43
+#define IMU_REG_PWR_MGMT_1   0x6B
+#define IMU_REG_WHO_AM_I     0x75
+
+#define IMU_WHO_AM_I 0x68
+
+/* 44Hz gyro bandwidth, 1kHz output rate */
+#define IMU_DLPF_CFG 3
+
+/* Use the gyro X clock, it's more stable than the internal oscillator */
+#define IMU_CLKSEL_PLL_X 1
+
+#define IMU_CALIBRATION_SAMPLES 32
+
+/* Longer gaps than this (a stall elsewhere) are integrated as this long, so
+ * the multiply can't overflow */
+#define IMU_MAX_DT_US 50000UL
+
+/*
+ * Heading hold is a plain P controller. An error of one degree is 131000
+ * yaw units, shifting that right by 15 gives about 4 PWM steps per degree.
+ */
+#define IMU_HOLD_SHIFT    15
+#define IMU_HOLD_MAX_TRIM 40
+
+static struct imu_state {
+    uint8_t present :1;
+    uint8_t holding :1;
+
+    uint8_t calibrating;
+    int32_t bias_sum;
+
+    int16_t bias;
+    int32_t yaw;
+    int32_t target;
+
+    uint32_t last_update;
+} imu;
+
+static uint8_t read_gyro_z(int16_t *rate)
+{
+    uint8_t buf[6];
+    uint8_t status;
+
+    status = twi_read_reg_data(IMU_ADDRESS, IMU_REG_GYRO_XOUT_H, buf, sizeof(buf));
+    if (status)
+        return status;
+
+    *rate = (int16_t)((buf[4] << 8) | buf[5]);
+
+    return TWI_OK;
+}
+
+static uint8_t write_reg(uint8_t reg, uint8_t value)
+{
+    return twi_write_reg_data(IMU_ADDRESS, reg, &value, 1);
+}
+
+int imu_init(void)
+{
+    uint8_t who_am_i = 0;
+
+    imu.present = 0;
+    imu.calibrating = 0;
+
+    if (twi_read_reg_data(IMU_ADDRESS, IMU_REG_WHO_AM_I, &who_am_i, 1)
+        || who_am_i != IMU_WHO_AM_I)
+        return 1;
+
+    /* +/-250 degrees/s full scale, 131 LSB per degree/s */
+    if (write_reg(IMU_REG_PWR_MGMT_1, IMU_CLKSEL_PLL_X)
+        || write_reg(IMU_REG_CONFIG, IMU_DLPF_CFG)
+        || write_reg(IMU_REG_GYRO_CONFIG, 0))
+        return 1;
+
+    /* The bias is measured over the next updates, one sample each, so the
+     * init doesn't hold up the control loop */
+    imu.bias_sum = 0;
+    imu.calibrating = IMU_CALIBRATION_SAMPLES;
+
+    return 0;
+}
+
+uint8_t imu_present(void)
+{
+    return imu.present;
+}
+
+static void calibrate(void)
+{
+    int16_t rate;
+
+    if (read_gyro_z(&rate))
+        return ;
+
+    imu.bias_sum += rate;
+
+    if (--imu.calibrating)
+        return ;
+
+    imu.bias = imu.bias_sum / IMU_CALIBRATION_SAMPLES;
+    imu.yaw = 0;
+    imu.last_update = clock_micros();
+    imu.present = 1;
+}
+
+void imu_update(void)
+{
+    if (imu.calibrating) {
+        calibrate();
+        return ;
+    }
+
+    if (!imu.present)
+        return ;
+
+    uint32_t now = clock_micros();
+    uint32_t dt_us = now - imu.last_update;
+    int16_t rate;
+
+    /* On a bus error, the next good reading covers the gap */
+    if (read_gyro_z(&rate))
+        return ;
+
+    rate -= imu.bias;
+    imu.last_update = now;
+
+    if (dt_us > IMU_MAX_DT_US)
+        dt_us = IMU_MAX_DT_US;
+
+    imu.yaw += ((int32_t)rate * (int32_t)dt_us) / 1000;
+}
+
+int32_t imu_yaw(void)
+{
+    return imu.yaw;
+}
+
+void imu_heading_hold(struct car_state *car)
+{
+    if (!imu.present
+        || car->motor_left != MOTOR_FOR
+        || car->motor_right != MOTOR_FOR
+        || car->motor_left_speed != car->motor_right_speed) {
+        imu.holding = 0;
+        car_state_motor_trim_set(car, 0);
+        return ;
+    }
+
+    /* Hold whatever heading we had when we started going straight */
+    if (!imu.holding) {
+        imu.holding = 1;
+        imu.target = imu.yaw;
+    }
+
+    /* Positive yaw is counter-clockwise, so a positive error means we've
+     * drifted left and the left motor needs to speed up */
+    int32_t trim = (imu.yaw - imu.target) >> IMU_HOLD_SHIFT;
+
+    if (trim > IMU_HOLD_MAX_TRIM)
+        trim = IMU_HOLD_MAX_TRIM;
+    else if (trim < -IMU_HOLD_MAX_TRIM)
+        trim = -IMU_HOLD_MAX_TRIM;
+
+    car_state_motor_trim_set(car, trim);
+}
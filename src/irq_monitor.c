@@ -0,0 +1,72 @@
+#include "common.h"
+
+#ifdef IRQ_MONITOR
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/interrupt.h>
+
+#include "serial.h"
+#include "irq_monitor.h"
+
+/*
+ * The stats are reported as:
+ *
+ *   irq:<source>:<count>:<over budget>:<max latency us>:<max exec us>
+ *       :<latency bucket 0>:...:<latency bucket 7>
+ *       :<exec bucket 0>:...:<exec bucket 7>
+ *
+ * all on one line, and then cleared, so each report covers the last window.
+ * Sources without a latency report 0 for it. Times have 0.5us resolution.
+ */
+
+#define IRQ_MONITOR_REPORT_TICKS 256
+
+struct irq_stats irq_stats[IRQ_SOURCES];
+
+static uint16_t report_ticks;
+
+static void print_ticks(uint16_t ticks)
+{
+    fprintf(serial_out, ":%u.%u", ticks >> 1, (ticks & 1) * 5);
+}
+
+void irq_monitor_tick(void)
+{
+    struct irq_stats s;
+    uint8_t i, b;
+
+    if (++report_ticks < IRQ_MONITOR_REPORT_TICKS)
+        return ;
+
+    report_ticks = 0;
+
+    for (i = 0; i < IRQ_SOURCES; i++) {
+        /* One source at a time, so interrupts are only held off for a
+         * single copy */
+        uint8_t sreg = SREG;
+        cli();
+
+        s = irq_stats[i];
+        memset(irq_stats + i, 0, sizeof(s));
+
+        SREG = sreg;
+
+        if (!s.count)
+            continue;
+
+        fprintf(serial_out, "irq:%d:%u:%u", i, s.count, s.over_budget);
+        print_ticks(s.max_latency);
+        print_ticks(s.max_exec);
+
+        for (b = 0; b < IRQ_MONITOR_BUCKETS; b++)
+            fprintf(serial_out, ":%u", s.latency_buckets[b]);
+
+        for (b = 0; b < IRQ_MONITOR_BUCKETS; b++)
+            fprintf(serial_out, ":%u", s.exec_buckets[b]);
+
+        fprintf(serial_out, "\n");
+    }
+}
+
+#endif
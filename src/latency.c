@@ -0,0 +1,106 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "clock.h"
+#include "serial.h"
+#include "telemetry.h"
+#include "tune.h"
+#include "latency.h"
+
+/*
+ * The histograms are reported as:
+ *
+ *   lat:<source>:<count>:<max us>:<bucket 0>:...:<bucket 7>
+ *
+ * and then cleared, so each report covers the last window. With the binary
+ * telemetry frames on, each latency is also sent as it is recorded.
+ */
+
+#define LATENCY_REPORT_TICKS 256
+
+/* Bucket 0 ends at 1ms, in clock_stamp() units */
+#define LATENCY_FIRST_BUCKET (1000 / CLOCK_STAMP_US)
+
+struct latency_hist {
+    uint16_t count;
+
+    /* In clock_stamp() units */
+    uint16_t max;
+
+    uint16_t buckets[LATENCY_BUCKETS];
+};
+
+static struct latency_hist hists[LATENCY_SOURCES];
+static uint16_t report_ticks;
+
+static uint8_t bucket_of(uint16_t age)
+{
+    uint16_t limit = LATENCY_FIRST_BUCKET;
+    uint8_t b;
+
+    for (b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        if (age < limit)
+            break;
+
+        limit <<= 1;
+    }
+
+    return b;
+}
+
+void latency_record(uint8_t source, uint16_t stamp)
+{
+    struct latency_hist *hist = hists + source;
+    uint16_t now = clock_stamp();
+    uint16_t age = now - stamp;
+
+    if (hist->count < UINT16_MAX)
+        hist->count++;
+
+    if (age > hist->max)
+        hist->max = age;
+
+    uint16_t *bucket = hist->buckets + bucket_of(age);
+    if (*bucket < UINT16_MAX)
+        (*bucket)++;
+
+    if (tune.telemetry_frames) {
+        struct telemetry_latency frame;
+
+        frame.source = source;
+        frame.actuate_us = clock_micros();
+        frame.input_us = frame.actuate_us - (uint32_t)age * CLOCK_STAMP_US;
+
+        telemetry_send_frame(TELEMETRY_LATENCY, &frame, sizeof(frame));
+    }
+}
+
+void latency_tick(void)
+{
+    uint8_t i, b;
+
+    if (++report_ticks < LATENCY_REPORT_TICKS)
+        return ;
+
+    report_ticks = 0;
+
+    for (i = 0; i < LATENCY_SOURCES; i++) {
+        struct latency_hist *hist = hists + i;
+
+        if (!hist->count)
+            continue;
+
+        fprintf(serial_out, "lat:%d:%u:%lu", i, hist->count,
+                (unsigned long)hist->max * CLOCK_STAMP_US);
+
+        for (b = 0; b < LATENCY_BUCKETS; b++)
+            fprintf(serial_out, ":%u", hist->buckets[b]);
+
+        fprintf(serial_out, "\n");
+
+        memset(hist, 0, sizeof(*hist));
+    }
+}
@@ -0,0 +1,112 @@
+#include "common.h"
+
+#include "car_state.h"
+#include "line_sensor.h"
+#include "line_follow.h"
+#include "tune.h"
+
+/*
+ * Line following.
+ *
+ * A PD controller on the line position steers by speeding up one side and
+ * slowing down the other. When the line is lost, the car keeps turning
+ * toward the side it was last seen on, for up to LINE_LOST_TICKS ticks,
+ * and stops if it doesn't find it again.
+ */
+
+#define LINE_SEARCH_SPEED 150
+#define LINE_LOST_TICKS 60
+
+static struct line_follow_state {
+    uint8_t active :1;
+
+    int8_t last_position;
+    uint8_t lost_ticks;
+} line_state;
+
+static void set_motor(struct car_state *car, uint8_t left, int16_t speed)
+{
+    enum motor_dir dir = MOTOR_FOR;
+
+    if (speed < 0) {
+        dir = MOTOR_BACK;
+        speed = -speed;
+    }
+
+    if (speed > 255)
+        speed = 255;
+
+    if (left) {
+        car_state_left_motor_set(car, dir);
+        car_state_motor_left_speed_set(car, speed);
+    } else {
+        car_state_right_motor_set(car, dir);
+        car_state_motor_right_speed_set(car, speed);
+    }
+}
+
+static void stop(struct car_state *car)
+{
+    car_state_left_motor_set(car, MOTOR_STOPPED);
+    car_state_right_motor_set(car, MOTOR_STOPPED);
+}
+
+void line_follow_tick(struct car_state *car)
+{
+    if (!line_state.active)
+        return ;
+
+    int8_t pos = line_sensor_read();
+
+    if (pos == LINE_POSITION_LOST) {
+        if (line_state.lost_ticks == LINE_LOST_TICKS) {
+            stop(car);
+            return ;
+        }
+
+        line_state.lost_ticks++;
+
+        /* Pivot toward where the line was last seen */
+        if (line_state.last_position < 0) {
+            set_motor(car, 1, -LINE_SEARCH_SPEED);
+            set_motor(car, 0, LINE_SEARCH_SPEED);
+        } else {
+            set_motor(car, 1, LINE_SEARCH_SPEED);
+            set_motor(car, 0, -LINE_SEARCH_SPEED);
+        }
+
+        return ;
+    }
+
+    int16_t steer = ((int16_t)pos * tune.line_kp
+                     + ((int16_t)pos - line_state.last_position) * tune.line_kd) / 16;
+
+    line_state.last_position = pos;
+    line_state.lost_ticks = 0;
+
+    /* A line to the right means turning right, so the left side speeds up */
+    set_motor(car, 1, tune.line_speed + steer);
+    set_motor(car, 0, tune.line_speed - steer);
+}
+
+void line_follow_start(void)
+{
+    line_state.active = 1;
+    line_state.last_position = 0;
+    line_state.lost_ticks = 0;
+
+    /* Throw away whatever was sampled before */
+    line_sensor_read();
+}
+
+void line_follow_stop(struct car_state *car)
+{
+    line_state.active = 0;
+
+    stop(car);
+}
+
+uint8_t line_follow_active(void)
+{
+    return line_state.active;
+}
@@ -0,0 +1,91 @@
+
+#include "common.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "line_sensor.h"
+#include "irq_monitor.h"
+
+/*
+ * The array is sampled at 1kHz by the TIMER1 compare B interrupt, which
+ * moves OCR1B forward the same way the servo moves OCR1A. Each sample is a
+ * single port read and a table lookup, so it takes the same time whatever
+ * the sensors see. The samples are summed up, and the control loop only
+ * takes the average once per tick.
+ */
+
+#define LINE_SENSOR_SAMPLE_TICKS 2000
+
+/*
+ * Line position for each reading, indexed by the masked and shifted pin
+ * value: bit 0 is PB2 (left), bit 2 is PB4 (center) and bit 3 is PB5
+ * (right). Bit 1 is PB3, which is masked off, so those entries never get
+ * used. The position is the average of the channels that see the line.
+ */
+static const int8_t positions[] PROGMEM = {
+    [0x0] = LINE_POSITION_LOST,
+    [0x1] = -LINE_POSITION_MAX,
+    [0x4] = 0,
+    [0x5] = -LINE_POSITION_MAX / 2,
+    [0x8] = LINE_POSITION_MAX,
+    [0x9] = 0,
+    [0xC] = LINE_POSITION_MAX / 2,
+    [0xD] = 0,
+};
+
+static volatile int16_t position_sum;
+static volatile uint8_t position_samples;
+
+ISR(TIMER1_COMPB_vect)
+{
+    IRQ_MONITOR_START_DUE(OCR1B);
+
+    OCR1B += LINE_SENSOR_SAMPLE_TICKS;
+
+    uint8_t reading = (LINE_SENSOR_PIN & LINE_SENSOR_MASK) >> LINE_SENSOR_SHIFT;
+    int8_t pos = pgm_read_byte(positions + reading);
+
+    /* 255 samples is over a quarter second, longer than any tick */
+    if (pos != LINE_POSITION_LOST && position_samples != 255) {
+        position_sum += pos;
+        position_samples++;
+    }
+
+    IRQ_MONITOR_STOP(IRQ_LINE);
+}
+
+int8_t line_sensor_read(void)
+{
+    int16_t sum;
+    uint8_t samples;
+
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    sum = position_sum;
+    samples = position_samples;
+    position_sum = 0;
+    position_samples = 0;
+
+    IRQ_MONITOR_STOP(IRQ_CLI_LINE);
+    SREG = sreg;
+
+    if (!samples)
+        return LINE_POSITION_LOST;
+
+    return sum / samples;
+}
+
+void line_sensor_init(void)
+{
+    LINE_SENSOR_DDR &= ~LINE_SENSOR_MASK;
+    LINE_SENSOR_PORT &= ~LINE_SENSOR_MASK;
+
+    OCR1B = TCNT1 + LINE_SENSOR_SAMPLE_TICKS;
+
+    TIFR1 = _BV(OCF1B);
+    TIMSK1 |= _BV(OCIE1B);
+}
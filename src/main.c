@@ -5,16 +5,52 @@
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #include "debug_serial.h"
 #include "serial.h"
 #include "twi_master.h"
-#include "snes_classic.h"
+#include "wii_ext.h"
 #include "ultrasonic.h"
 #include "car_state.h"
 #include "bt_gamepad.h"
+#include "scan.h"
+#include "autonomous.h"
+#include "recorder.h"
+#include "tune.h"
+#include "imu.h"
+#include "power.h"
+#include "event.h"
+#include "clock.h"
+#include "telemetry.h"
+#include "latency.h"
+#include "line_sensor.h"
+#include "line_follow.h"
+#include "irq_monitor.h"
+#include "button_map.h"
+#include "motion.h"
+#include "blackbox.h"
 
-static struct snes_classic_state snes_state;
+/* BT gamepad buttons that toggle line following, the servo scan,
+ * autonomous driving, recording and replay, and point the servo */
+#define BT_BUTTON_LINE         0
+#define BT_BUTTON_LOOK_LEFT    1
+#define BT_BUTTON_LOOK_CENTER  2
+#define BT_BUTTON_LOOK_RIGHT   3
+#define BT_BUTTON_SCAN         4
+#define BT_BUTTON_AUTO         5
+#define BT_BUTTON_RECORD       6
+#define BT_BUTTON_REPLAY       7
+
+/* Held speed and servo buttons step once, and then keep stepping after a
+ * pause */
+#define REPEAT_DELAY_MS 300
+#define REPEAT_MS       100
+
+static struct wii_ext_state ext_state;
+
+/* The read before, to tell a new input from one still held */
+static struct wii_ext_state ext_last;
 
 static struct car_state car_state = {
     .motor_left_speed_changed = 1,
@@ -26,89 +62,477 @@ static struct car_state car_state = {
     .motor_left_speed = 200,
     .motor_right_speed = 200,
     .servo_degree = 128,
+    .speed_scale = CAR_STATE_SCALE_ONE,
     .motor_left = MOTOR_STOPPED,
     .motor_right = MOTOR_STOPPED,
 };
 
-void snes_controller_handle_state(struct snes_classic_state *state, struct car_state *car)
-{
-    if (snes_state.up_pressed) {
-        car_state_left_motor_set(car, MOTOR_FOR);
-        car_state_right_motor_set(car, MOTOR_FOR);
-    } else if (snes_state.down_pressed) {
-        car_state_left_motor_set(car, MOTOR_BACK);
-        car_state_right_motor_set(car, MOTOR_BACK);
-    } else if (snes_state.left_pressed) {
-        car_state_left_motor_set(car, MOTOR_BACK);
-        car_state_right_motor_set(car, MOTOR_FOR);
-    } else if (snes_state.right_pressed) {
-        car_state_left_motor_set(car, MOTOR_FOR);
-        car_state_right_motor_set(car, MOTOR_BACK);
+/* True when no mode or motion script has taken over driving from the
+ * controller */
+static uint8_t manual_driving(void)
+{
+    return !autonomous_active() && !line_follow_active() && !recorder_replaying()
+        && !motion_running();
+}
+
+/* The D-pad drives while held. Up wins over down, and both over turning */
+static void drive_dpad(uint16_t held)
+{
+    enum motor_dir left = MOTOR_STOPPED, right = MOTOR_STOPPED;
+
+    if (held & WII_BUTTON_UP) {
+        left = right = MOTOR_FOR;
+    } else if (held & WII_BUTTON_DOWN) {
+        left = right = MOTOR_BACK;
+    } else if (held & WII_BUTTON_LEFT) {
+        left = MOTOR_BACK;
+        right = MOTOR_FOR;
+    } else if (held & WII_BUTTON_RIGHT) {
+        left = MOTOR_FOR;
+        right = MOTOR_BACK;
+    }
+
+    car_state_left_motor_set(&car_state, left);
+    car_state_right_motor_set(&car_state, right);
+}
+
+/* Stick readings within this of center count as centered */
+#define STICK_DEADZONE 16
+
+/* A held stick wobbles by a few counts between reads, which isn't a new
+ * input */
+#define STICK_NOISE 4
+
+static struct {
+    uint8_t driving;
+    uint8_t looking;
+
+    /* The speeds the buttons had set, for when the stick lets go */
+    uint8_t left_speed;
+    uint8_t right_speed;
+} stick;
+
+static uint8_t stick_off_center(int8_t v)
+{
+    return v > STICK_DEADZONE || v < -STICK_DEADZONE;
+}
+
+/* Returns 1 if either stick is pushed */
+static uint8_t sticks_pushed(const struct wii_ext_state *s)
+{
+    return stick_off_center(s->stick[WII_EXT_LX]) || stick_off_center(s->stick[WII_EXT_LY])
+        || stick_off_center(s->stick[WII_EXT_RX]);
+}
+
+/* Returns 1 if a button or a stick changed since the read in 'last' */
+static uint8_t ext_input_changed(const struct wii_ext_state *s,
+                                 const struct wii_ext_state *last)
+{
+    uint8_t i;
+
+    if (s->buttons != last->buttons)
+        return 1;
+
+    for (i = 0; i < WII_EXT_STICKS; i++) {
+        int16_t d = s->stick[i] - last->stick[i];
+
+        if (d > STICK_NOISE || d < -STICK_NOISE)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* 'v' is -256 to 254. Speeds go from the PWM offset up to full */
+static void stick_motor(uint8_t left, int16_t v)
+{
+    enum motor_dir dir = MOTOR_STOPPED;
+    uint8_t speed = 0;
+
+    if (v > STICK_DEADZONE || v < -STICK_DEADZONE) {
+        uint16_t mag = v < -255 ? 255 : v < 0 ? -v : v;
+
+        dir = v < 0 ? MOTOR_BACK : MOTOR_FOR;
+        speed = tune.pwm_offset + mag * (255 - tune.pwm_offset) / 255;
+    }
+
+    if (left) {
+        car_state_left_motor_set(&car_state, dir);
+        if (dir != MOTOR_STOPPED)
+            car_state_motor_left_speed_set(&car_state, speed);
     } else {
-        car_state_left_motor_set(car, MOTOR_STOPPED);
-        car_state_right_motor_set(car, MOTOR_STOPPED);
+        car_state_right_motor_set(&car_state, dir);
+        if (dir != MOTOR_STOPPED)
+            car_state_motor_right_speed_set(&car_state, speed);
     }
+}
 
-    int new_motor_speed = car->motor_left_speed;
+/*
+ * The left stick drives in proportion, mixed the usual way: up for both
+ * motors forward, right for the left one ahead of the right. The right
+ * stick's X points the servo. Each only takes over from the buttons while
+ * pushed, and when it comes back stops the motors, or centers the servo,
+ * once. A controller without sticks reads centered, so never gets here.
+ */
+static void drive_sticks(const struct wii_ext_state *s)
+{
+    int16_t x = s->stick[WII_EXT_LX], y = s->stick[WII_EXT_LY];
+    int16_t rx = s->stick[WII_EXT_RX];
+    uint8_t driving = stick_off_center(x) || stick_off_center(y);
+    uint8_t looking = stick_off_center(rx);
 
-    if (snes_state.x_pressed && car->motor_left_speed < 250)
-        new_motor_speed += 10;
+    if (driving) {
+        int16_t left = y + x, right = y - x;
 
-    if (snes_state.y_pressed && car->motor_left_speed > 150)
-        new_motor_speed -= 10;
+        if (!stick.driving) {
+            stick.left_speed = car_state.motor_left_speed;
+            stick.right_speed = car_state.motor_right_speed;
+        }
 
-    car_state_motor_left_speed_set(car, new_motor_speed);
-    car_state_motor_right_speed_set(car, new_motor_speed);
+        stick_motor(1, left);
+        stick_motor(0, right);
+    } else if (stick.driving) {
+        car_state_left_motor_set(&car_state, MOTOR_STOPPED);
+        car_state_right_motor_set(&car_state, MOTOR_STOPPED);
+        car_state_motor_left_speed_set(&car_state, stick.left_speed);
+        car_state_motor_right_speed_set(&car_state, stick.right_speed);
+    }
 
-    uint8_t new_servo_degree = car->servo_degree;
+    /* Low servo degrees point right */
+    if (looking)
+        car_state_servo_degree_set(&car_state, rx == -128 ? 255 : 128 - rx);
+    else if (stick.looking)
+        car_state_servo_degree_set(&car_state, 128);
 
-    if (snes_state.r_pressed && car->servo_degree > 20)
-        new_servo_degree -= 20;
+    stick.driving = driving;
+    stick.looking = looking;
+}
 
-    if (snes_state.l_pressed && car->servo_degree < 230)
-        new_servo_degree += 20;
+static void set_speed(int speed)
+{
+    if (speed > 255)
+        speed = 255;
+
+    car_state_motor_left_speed_set(&car_state, speed);
+    car_state_motor_right_speed_set(&car_state, speed);
+}
+
+static void speed_up(uint16_t held)
+{
+    if (car_state.motor_left_speed < 250)
+        set_speed(car_state.motor_left_speed + tune.speed_step);
+}
+
+static void speed_down(uint16_t held)
+{
+    if (car_state.motor_left_speed > 150)
+        set_speed(car_state.motor_left_speed - tune.speed_step);
+}
 
-    car_state_servo_degree_set(car, new_servo_degree);
+/* Low servo degrees point right, high degrees point left */
+static void look_left_step(uint16_t held)
+{
+    if (car_state.servo_degree < 255 - tune.servo_step)
+        car_state_servo_degree_set(&car_state, car_state.servo_degree + tune.servo_step);
+}
+
+static void look_right_step(uint16_t held)
+{
+    if (car_state.servo_degree > tune.servo_step)
+        car_state_servo_degree_set(&car_state, car_state.servo_degree - tune.servo_step);
+}
+
+static void look_left(uint16_t held)
+{
+    car_state_servo_degree_set(&car_state, 192);
+}
+
+static void look_center(uint16_t held)
+{
+    car_state_servo_degree_set(&car_state, 128);
+}
+
+static void look_right(uint16_t held)
+{
+    car_state_servo_degree_set(&car_state, 64);
+}
+
+static void toggle_record(uint16_t held)
+{
+    if (recorder_recording())
+        recorder_stop();
+    else
+        recorder_start(&car_state);
+}
+
+static void toggle_replay(uint16_t held)
+{
+    if (recorder_replaying())
+        recorder_replay_stop(&car_state);
+    else if (!autonomous_active() && !line_follow_active()) {
+        scan_stop();
+        recorder_replay_start();
+    }
+}
+
+/* A replay owns the car until it is done, so the other modes wait */
+static void toggle_auto(uint16_t held)
+{
+    if (recorder_replaying())
+        return ;
+
+    if (autonomous_active())
+        autonomous_stop(&car_state);
+    else if (!line_follow_active())
+        autonomous_start();
+}
+
+static void toggle_line(uint16_t held)
+{
+    if (recorder_replaying())
+        return ;
+
+    if (line_follow_active())
+        line_follow_stop(&car_state);
+    else if (!autonomous_active())
+        line_follow_start();
+}
+
+/* Autonomous driving needs the scan, so it can't be turned off */
+static void toggle_scan(uint16_t held)
+{
+    if (recorder_replaying() || autonomous_active())
+        return ;
+
+    if (scan_active())
+        scan_stop();
+    else
+        scan_start();
+}
+
+#define WII_DPAD (WII_BUTTON_UP | WII_BUTTON_DOWN | WII_BUTTON_LEFT | WII_BUTTON_RIGHT)
+
+static const struct button_action ext_actions[] PROGMEM = {
+    { WII_DPAD, BUTTON_PRESS | BUTTON_RELEASE | BUTTON_DRIVING, 0, 0, drive_dpad },
+    { WII_BUTTON_X, BUTTON_REPEAT | BUTTON_DRIVING, REPEAT_DELAY_MS, REPEAT_MS, speed_up },
+    { WII_BUTTON_Y, BUTTON_REPEAT | BUTTON_DRIVING, REPEAT_DELAY_MS, REPEAT_MS, speed_down },
+    { WII_BUTTON_L, BUTTON_REPEAT | BUTTON_DRIVING, REPEAT_DELAY_MS, REPEAT_MS, look_left_step },
+    { WII_BUTTON_R, BUTTON_REPEAT | BUTTON_DRIVING, REPEAT_DELAY_MS, REPEAT_MS, look_right_step },
+
+    { WII_BUTTON_HOME,   BUTTON_PRESS, 0, 0, toggle_record },
+    { WII_BUTTON_ZR,     BUTTON_PRESS, 0, 0, toggle_replay },
+    { WII_BUTTON_START,  BUTTON_PRESS, 0, 0, toggle_auto },
+    { WII_BUTTON_A,      BUTTON_PRESS, 0, 0, toggle_line },
+    { WII_BUTTON_SELECT, BUTTON_PRESS, 0, 0, toggle_scan },
+};
+
+static const struct button_action bt_actions[] PROGMEM = {
+    { _BV(BT_BUTTON_LOOK_LEFT),   BUTTON_PRESS | BUTTON_DRIVING, 0, 0, look_left },
+    { _BV(BT_BUTTON_LOOK_CENTER), BUTTON_PRESS | BUTTON_DRIVING, 0, 0, look_center },
+    { _BV(BT_BUTTON_LOOK_RIGHT),  BUTTON_PRESS | BUTTON_DRIVING, 0, 0, look_right },
+
+    { _BV(BT_BUTTON_RECORD), BUTTON_PRESS, 0, 0, toggle_record },
+    { _BV(BT_BUTTON_REPLAY), BUTTON_PRESS, 0, 0, toggle_replay },
+    { _BV(BT_BUTTON_AUTO),   BUTTON_PRESS, 0, 0, toggle_auto },
+    { _BV(BT_BUTTON_LINE),   BUTTON_PRESS, 0, 0, toggle_line },
+    { _BV(BT_BUTTON_SCAN),   BUTTON_PRESS, 0, 0, toggle_scan },
+};
+
+static uint32_t ext_repeat_at[ARRAY_SIZE(ext_actions)];
+static uint32_t bt_repeat_at[ARRAY_SIZE(bt_actions)];
+
+static struct button_map ext_map = {
+    .actions = ext_actions,
+    .actions_len = ARRAY_SIZE(ext_actions),
+    .repeat_at = ext_repeat_at,
+};
+
+static struct button_map bt_map = {
+    .actions = bt_actions,
+    .actions_len = ARRAY_SIZE(bt_actions),
+    .repeat_at = bt_repeat_at,
+};
+
+static void handle_events(void)
+{
+    struct event ev;
+
+    while (event_get(&ev)) {
+        switch (ev.type) {
+        case EVENT_SERIAL_RX:
+            bt_gamepad_handle_char(ev.data, ev.stamp);
+            break;
+
+        case EVENT_SERIAL_RX_ERROR:
+            bt_gamepad_handle_error();
+            break;
+        }
+    }
+}
+
+/*
+ * Devices on the TWI bus are probed from the control loop, one per tick,
+ * after the first tick has run. Together with the debug output no longer
+ * blocking, this gets the motors live a few ms after reset instead of after
+ * all the probing and printing. The BT gamepad drives until the Wii
+ * controller has been found.
+ */
+enum probe_step {
+    PROBE_EXT,
+    PROBE_IMU,
+    PROBE_DONE,
+};
+
+static enum probe_step probe_step;
+static uint8_t ext_attached;
+
+static void probe_tick(void)
+{
+    switch (probe_step) {
+    case PROBE_EXT:
+        ext_attached = !wii_ext_init();
+        probe_step = PROBE_IMU;
+        break;
+
+    case PROBE_IMU:
+        if (!imu_init())
+            printf("IMU found, heading hold enabled\n");
+
+        probe_step = PROBE_DONE;
+        break;
+
+    case PROBE_DONE:
+        break;
+    }
 }
 
 int main(void)
 {
+    clock_init();
     debug_serial_init();
+    tune_init();
     bt_gamepad_init();
     twi_master_init();
     car_state_init();
+    blackbox_init();
+    motion_init(&car_state);
+    power_init();
     sei();
 
     DDRD |= _BV(DDD3);
     PORTD &= ~_BV(PORTD3);
 
-    /* For Ultrasonic Sensor */
-    DDRC |= _BV(DDC5);
-    DDRC &= ~_BV(DDC4);
     ultrasonic_init();
+    scan_init();
+    recorder_init();
+    line_sensor_init();
 
-    int snes_controller_attached = !snes_classic_init();
-
-    int i = 0;
+    uint32_t next_tick = clock_micros();
     while (1) {
-        if (snes_controller_attached) {
-            snes_classic_read_state(&snes_state);
-            snes_controller_handle_state(&snes_state, &car_state);
+        uint32_t tick_start = clock_micros();
+
+        /* Serial messages are handled even with the Wii controller, so the
+         * tuning commands still work */
+        blackbox_task(BLACKBOX_TASK_EVENTS);
+        handle_events();
+        serial_tick();
+
+        if (ext_attached) {
+            /* If the controller stops answering, every button reads as
+             * released and every stick as centered, so the car stops this
+             * same tick */
+            blackbox_task(BLACKBOX_TASK_EXT);
+            wii_ext_read_state(&ext_state);
+
+            /* Any button or stick takes the car back from a motion script */
+            if (ext_state.buttons || sticks_pushed(&ext_state))
+                motion_abort(&car_state);
+
+            /* Compared every tick, like the BT input below, so an input
+             * that came in while something else was driving isn't traced
+             * later */
+            uint8_t new_input = ext_input_changed(&ext_state, &ext_last);
+            ext_last = ext_state;
+
+            if (new_input && manual_driving())
+                car_state_input_tag(&car_state, LATENCY_SNES, ext_state.stamp);
+
+            button_map_update(&ext_map, ext_state.buttons, manual_driving());
+
+            /* After the buttons, so a pushed stick wins over the D-pad */
+            if (manual_driving())
+                drive_sticks(&ext_state);
         } else {
-            bt_gamepad_update_state();
-            bt_gamepad_apply(&car_state);
+            blackbox_task(BLACKBOX_TASK_BT);
+            bt_gamepad_tick(&car_state, manual_driving);
+            button_map_update(&bt_map, bt_gamepad_buttons(), manual_driving());
         }
 
+        /* Before the modes, so one that takes the motors aborts the script */
+        blackbox_task(BLACKBOX_TASK_MOTION);
+        motion_tick(&car_state);
+
+        /* The scan takes over the servo, and the front sensor's readings */
+        blackbox_task(BLACKBOX_TASK_SCAN);
+        scan_tick(&car_state);
+        blackbox_task(BLACKBOX_TASK_AUTO);
+        autonomous_tick(&car_state);
+        blackbox_task(BLACKBOX_TASK_LINE);
+        line_follow_tick(&car_state);
+
+        blackbox_task(BLACKBOX_TASK_POWER);
+        power_update(&car_state);
+
+        /* Must come after anything that changes car_state this tick */
+        blackbox_task(BLACKBOX_TASK_RECORDER);
+        recorder_tick(&car_state);
+
+        /* Both devices are read once per tick, so neither slows the other */
+        blackbox_task(BLACKBOX_TASK_IMU);
+        imu_update();
+        imu_heading_hold(&car_state);
+
+        blackbox_task(BLACKBOX_TASK_APPLY);
         car_state_apply(&car_state);
 
-        if (!i)
-            ultrasonic_read_distance();
+        blackbox_task(BLACKBOX_TASK_REPORT);
+        latency_tick();
+        irq_monitor_tick();
+
+        /* The clock starts at the top of main(), so this leaves out only the
+         * C runtime startup */
+        if (probe_step == PROBE_EXT)
+            fprintf(serial_out, "boot:%lu\n", clock_micros());
+
+        blackbox_task(BLACKBOX_TASK_PROBE);
+        probe_tick();
+
+        blackbox_task(BLACKBOX_TASK_ULTRASONIC);
+        ultrasonic_tick();
+
+        if (tune.telemetry_frames) {
+            struct telemetry_tick frame = {
+                .start_us = tick_start,
+                .work_us = clock_micros() - tick_start,
+            };
+
+            telemetry_send_frame(TELEMETRY_TICK, &frame, sizeof(frame));
+        }
+
+        /* Feeds the watchdog, so it only bites if a tick never gets here */
+        blackbox_tick(&car_state);
+        blackbox_task(BLACKBOX_TASK_IDLE);
 
-        i++;
-        if (i == 15)
-            i = 0;
+        /* Ticks start a fixed period apart, no matter how long the work took.
+         * If we overran, start the next one right away and re-sync */
+        next_tick += (uint32_t)tune.loop_period_ms * 1000;
+        if ((int32_t)(clock_micros() - next_tick) > 0)
+            next_tick = clock_micros();
 
-        _delay_ms(16);
+        /* The pings are started and collected while waiting, so they don't
+         * have to line up with the ticks */
+        while ((int32_t)(clock_micros() - next_tick) < 0)
+            ultrasonic_poll();
     }
 
     return 0;
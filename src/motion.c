@@ -0,0 +1,385 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "serial.h"
+#include "clock.h"
+#include "servo.h"
+#include "car_state.h"
+#include "irq_monitor.h"
+#include "motion.h"
+
+/*
+ * The steps are switched by the TIMER2 compare B interrupt, which checks
+ * the clock every 104us while the queue runs. TIMER2 is already running in
+ * CTC mode for the debug serial, from debug_serial_init(), and TIMER1 has
+ * no compare left over. So a step starts within ~110us of when it is due,
+ * whatever the control loop is busy with. Step start times are kept on the
+ * clock, so lateness doesn't add up over a script.
+ *
+ * The interrupt writes the motor outputs itself, using the trim and speed
+ * scale in car_state. motion_tick() then copies the step into car_state
+ * through the setters, so it is recorded and reported like any other
+ * change. If car_state ends up with motor settings other than the copied
+ * step, something else wants the motors, and the queue is aborted.
+ */
+
+#define CLOCK_TICKS_PER_MS (CLOCK_TICKS_PER_US * 1000UL)
+
+/* 'flags': the left motor_dir in bits 0-1, the right in bits 2-3 */
+#define STEP_LEFT(flags)  ((enum motor_dir)((flags) & 0x03))
+#define STEP_RIGHT(flags) ((enum motor_dir)(((flags) >> 2) & 0x03))
+#define STEP_SET_SERVO    _BV(4)
+
+struct motion_step {
+    uint16_t ms;
+    uint8_t left_speed;
+    uint8_t right_speed;
+    uint8_t servo;
+    uint8_t flags;
+};
+
+enum motion_end {
+    MOTION_NOT_ENDED,
+    MOTION_DONE,
+    MOTION_STOPPED,
+};
+
+static struct motion_step steps[MOTION_QUEUE_LEN];
+static uint8_t steps_len;
+
+/* Shared with the interrupt */
+static volatile struct motion_run {
+    uint8_t running;
+    enum motion_end ended;
+
+    /* Steps started so far */
+    uint8_t started;
+
+    /* clock_ticks() the next step is due at */
+    uint32_t next_at;
+
+    /* Worst lateness of a step start, in clock ticks */
+    uint16_t max_late;
+} run;
+
+static struct car_state *motion_car;
+
+/* The step motion_tick() last copied into car_state */
+static struct motion_step mirrored;
+static uint8_t mirror_valid;
+
+/* Stopped motors, for the end of the queue */
+static const struct motion_step stop_step;
+
+static void output(const struct motion_step *s)
+{
+    car_state_output_motors(motion_car, STEP_LEFT(s->flags), s->left_speed,
+                            STEP_RIGHT(s->flags), s->right_speed);
+}
+
+/* With interrupts off */
+static void end(enum motion_end how)
+{
+    run.running = 0;
+    run.ended = how;
+
+    TIMSK2 &= ~_BV(OCIE2B);
+}
+
+ISR(TIMER2_COMPB_vect)
+{
+    /* OCR2B is 0, so TIMER2 counts the ticks since the match */
+    IRQ_MONITOR_START_LATE(TCNT2);
+
+    int32_t late = clock_ticks() - run.next_at;
+
+    if (late >= 0) {
+        if (late > run.max_late)
+            run.max_late = late > UINT16_MAX ? UINT16_MAX : late;
+
+        if (run.started == steps_len) {
+            output(&stop_step);
+            end(MOTION_DONE);
+        } else {
+            const struct motion_step *s = steps + run.started;
+
+            output(s);
+            if (s->flags & STEP_SET_SERVO)
+                servo_set(s->servo);
+
+            run.next_at += s->ms * CLOCK_TICKS_PER_MS;
+            run.started++;
+        }
+    }
+
+    IRQ_MONITOR_STOP(IRQ_MOTION);
+}
+
+static void report(const char *what)
+{
+    fprintf(serial_out, "mq:%s:%u:%u\n", what, run.started, run.max_late / CLOCK_TICKS_PER_US);
+}
+
+static void set_motor(struct car_state *car, uint8_t left, enum motor_dir dir, uint8_t speed)
+{
+    if (left) {
+        car_state_left_motor_set(car, dir);
+        if (dir != MOTOR_STOPPED)
+            car_state_motor_left_speed_set(car, speed);
+    } else {
+        car_state_right_motor_set(car, dir);
+        if (dir != MOTOR_STOPPED)
+            car_state_motor_right_speed_set(car, speed);
+    }
+}
+
+/* Whether car_state still holds the motor settings of step 's' */
+static uint8_t holds_step(const struct car_state *car, const struct motion_step *s)
+{
+    enum motor_dir left = STEP_LEFT(s->flags), right = STEP_RIGHT(s->flags);
+
+    return car->motor_left == left
+        && car->motor_right == right
+        && (left == MOTOR_STOPPED || car->motor_left_speed == s->left_speed)
+        && (right == MOTOR_STOPPED || car->motor_right_speed == s->right_speed);
+}
+
+/* Ends the run and has car_state_apply() write every motor setting, since
+ * the outputs may not match car_state */
+static void abort_run(struct car_state *car)
+{
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    end(MOTION_NOT_ENDED);
+
+    IRQ_MONITOR_STOP(IRQ_CLI_MOTION);
+    SREG = sreg;
+
+    car->motor_left_changed = 1;
+    car->motor_right_changed = 1;
+    car->motor_left_speed_changed = 1;
+    car->motor_right_speed_changed = 1;
+
+    mirror_valid = 0;
+    report("abort");
+}
+
+void motion_init(struct car_state *car)
+{
+    motion_car = car;
+}
+
+void motion_add(uint16_t ms, int16_t left, int16_t right, int16_t servo)
+{
+    struct motion_step *s;
+
+    if (run.running) {
+        fprintf(serial_out, "mq:err:busy\n");
+        return ;
+    }
+
+    if (steps_len == MOTION_QUEUE_LEN) {
+        fprintf(serial_out, "mq:err:full\n");
+        return ;
+    }
+
+    if (!ms || left < -255 || left > 255 || right < -255 || right > 255 || servo > 255) {
+        fprintf(serial_out, "mq:err:bad\n");
+        return ;
+    }
+
+    s = steps + steps_len++;
+
+    s->ms = ms;
+    s->left_speed = 0;
+    s->right_speed = 0;
+    s->servo = 0;
+    s->flags = 0;
+
+    if (left) {
+        s->flags |= left > 0 ? MOTOR_FOR : MOTOR_BACK;
+        s->left_speed = left > 0 ? left : -left;
+    }
+
+    if (right) {
+        s->flags |= (right > 0 ? MOTOR_FOR : MOTOR_BACK) << 2;
+        s->right_speed = right > 0 ? right : -right;
+    }
+
+    if (servo >= 0) {
+        s->flags |= STEP_SET_SERVO;
+        s->servo = servo;
+    }
+
+    fprintf(serial_out, "mq:ok:%u\n", steps_len);
+}
+
+void motion_run(void)
+{
+    if (run.running) {
+        fprintf(serial_out, "mq:err:busy\n");
+        return ;
+    }
+
+    if (!steps_len) {
+        fprintf(serial_out, "mq:err:bad\n");
+        return ;
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    run.started = 0;
+    run.max_late = 0;
+    run.ended = MOTION_NOT_ENDED;
+    run.next_at = clock_ticks();
+    run.running = 1;
+
+    OCR2B = 0;
+    TIFR2 = _BV(OCF2B);
+    TIMSK2 |= _BV(OCIE2B);
+
+    IRQ_MONITOR_STOP(IRQ_CLI_MOTION);
+    SREG = sreg;
+
+    mirror_valid = 0;
+    fprintf(serial_out, "mq:run:%u\n", steps_len);
+}
+
+void motion_stop(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    /* Like the end of the queue in the interrupt, so the motors stop now
+     * rather than on the next tick */
+    if (run.running) {
+        output(&stop_step);
+        end(MOTION_STOPPED);
+    }
+
+    IRQ_MONITOR_STOP(IRQ_CLI_MOTION);
+    SREG = sreg;
+}
+
+void motion_clear(void)
+{
+    if (run.running) {
+        fprintf(serial_out, "mq:err:busy\n");
+        return ;
+    }
+
+    steps_len = 0;
+    fprintf(serial_out, "mq:ok:0\n");
+}
+
+void motion_report(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    uint8_t running = run.running;
+    uint8_t started = run.started;
+    uint16_t max_late = run.max_late;
+
+    IRQ_MONITOR_STOP(IRQ_CLI_MOTION);
+    SREG = sreg;
+
+    fprintf(serial_out, "mq:stat:%u:%u:%u:%u\n", running, started, steps_len,
+            max_late / CLOCK_TICKS_PER_US);
+}
+
+uint8_t motion_running(void)
+{
+    return run.running;
+}
+
+void motion_abort(struct car_state *car)
+{
+    if (!run.running)
+        return ;
+
+    abort_run(car);
+
+    car_state_left_motor_set(car, MOTOR_STOPPED);
+    car_state_right_motor_set(car, MOTOR_STOPPED);
+}
+
+void motion_tick(struct car_state *car)
+{
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    uint8_t running = run.running;
+    uint8_t started = run.started;
+    enum motion_end ended = run.ended;
+
+    run.ended = MOTION_NOT_ENDED;
+
+    IRQ_MONITOR_STOP(IRQ_CLI_MOTION);
+    SREG = sreg;
+
+    if (ended != MOTION_NOT_ENDED) {
+        /* Unless something else took the motors since the last tick. The
+         * interrupt may have started a step after the one copied, so the
+         * stop is written even if car_state already says stopped */
+        if (!mirror_valid || holds_step(car, &mirrored)) {
+            car_state_left_motor_set(car, MOTOR_STOPPED);
+            car_state_right_motor_set(car, MOTOR_STOPPED);
+            car->motor_left_changed = 1;
+            car->motor_right_changed = 1;
+        }
+
+        mirror_valid = 0;
+        report(ended == MOTION_DONE ? "done" : "stop");
+        return ;
+    }
+
+    if (!running || !started)
+        return ;
+
+    mirrored = steps[started - 1];
+    mirror_valid = 1;
+
+    set_motor(car, 1, STEP_LEFT(mirrored.flags), mirrored.left_speed);
+    set_motor(car, 0, STEP_RIGHT(mirrored.flags), mirrored.right_speed);
+
+    if (mirrored.flags & STEP_SET_SERVO)
+        car_state_servo_degree_set(car, mirrored.servo);
+}
+
+uint8_t motion_owns_motors(struct car_state *car)
+{
+    if (!run.running)
+        return 0;
+
+    if (mirror_valid && !holds_step(car, &mirrored)) {
+        abort_run(car);
+        return 0;
+    }
+
+    /* The trim or speed scale changed, redo the current step's outputs
+     * with them */
+    if (car->motor_left_speed_changed || car->motor_right_speed_changed) {
+        uint8_t sreg = SREG;
+        cli();
+        IRQ_MONITOR_START();
+
+        if (run.running && run.started)
+            output(steps + run.started - 1);
+
+        IRQ_MONITOR_STOP(IRQ_CLI_MOTION);
+        SREG = sreg;
+    }
+
+    return 1;
+}
@@ -0,0 +1,119 @@
+
+#include "common.h"
+
+#include <stdio.h>
+
+#include "serial.h"
+#include "adc.h"
+#include "car_state.h"
+#include "power.h"
+
+/*
+ * Battery compensation: the PWM duty is scaled by nominal / measured voltage,
+ * so a given speed setting drives the motors at the same voltage as the pack
+ * runs down. A reading below POWER_BATTERY_MIN_MV can't be a pack that still
+ * drives the motors, so it means there is no divider attached and ADC6 is
+ * floating. The duty is left alone then.
+ *
+ * Stall detection: a motor that is being driven and has drawn more than
+ * POWER_STALL_MA for POWER_STALL_TICKS in a row is cut (see
+ * car_state_left_motor_cut()). It stays stopped until it is set to stop or
+ * to the other direction, so holding the button down won't keep restarting
+ * it.
+ */
+
+#define ADC_REF_MV 5000UL
+
+#define POWER_BATTERY_MIN_MV 5000
+
+/* Don't boost the duty by more than 2x */
+#define POWER_SCALE_MAX (CAR_STATE_SCALE_ONE * 2 - 1)
+
+#define POWER_STALL_MA 1500
+#define POWER_STALL_TICKS 30
+
+#define POWER_REPORT_TICKS 64
+
+struct motor_monitor {
+    uint8_t stall_ticks;
+};
+
+static struct power_state {
+    uint16_t battery_mv;
+    uint8_t report_ticks;
+
+    struct motor_monitor left;
+    struct motor_monitor right;
+} power;
+
+static uint16_t adc_to_mv(uint16_t value)
+{
+    return ((uint32_t)value * ADC_REF_MV) >> 10;
+}
+
+static uint16_t sense_to_ma(uint16_t value)
+{
+    return ((uint32_t)adc_to_mv(value) * 1000) / POWER_SENSE_MILLIOHM;
+}
+
+/* Returns 1 if the motor has stalled and should be cut */
+static uint8_t check_stall(struct motor_monitor *mon, enum motor_dir dir,
+                           uint16_t ma, const char *name)
+{
+    if (dir == MOTOR_STOPPED || ma < POWER_STALL_MA) {
+        mon->stall_ticks = 0;
+        return 0;
+    }
+
+    if (++mon->stall_ticks < POWER_STALL_TICKS)
+        return 0;
+
+    mon->stall_ticks = 0;
+
+    fprintf(serial_out, "pwr:stall:%s:%u\n", name, ma);
+
+    return 1;
+}
+
+void power_update(struct car_state *car)
+{
+    struct adc_snapshot snap;
+
+    adc_read_snapshot(&snap);
+
+    power.battery_mv = adc_to_mv(snap.value[ADC_BATTERY]) * POWER_BATTERY_DIVIDER;
+
+    if (power.battery_mv >= POWER_BATTERY_MIN_MV) {
+        uint16_t scale = ((uint32_t)POWER_NOMINAL_MV * CAR_STATE_SCALE_ONE) / power.battery_mv;
+
+        if (scale > POWER_SCALE_MAX)
+            scale = POWER_SCALE_MAX;
+
+        car_state_speed_scale_set(car, scale);
+    } else {
+        car_state_speed_scale_set(car, CAR_STATE_SCALE_ONE);
+    }
+
+    uint16_t left_ma = sense_to_ma(snap.value[ADC_SENSE_LEFT]);
+    uint16_t right_ma = sense_to_ma(snap.value[ADC_SENSE_RIGHT]);
+
+    if (check_stall(&power.left, car->motor_left, left_ma, "left"))
+        car_state_left_motor_cut(car);
+    if (check_stall(&power.right, car->motor_right, right_ma, "right"))
+        car_state_right_motor_cut(car);
+
+    if (++power.report_ticks == POWER_REPORT_TICKS) {
+        power.report_ticks = 0;
+        fprintf(serial_out, "pwr:%u:%u:%u\n", power.battery_mv, left_ma, right_ma);
+    }
+}
+
+uint16_t power_battery_mv(void)
+{
+    return power.battery_mv;
+}
+
+void power_init(void)
+{
+    adc_init();
+}
@@ -0,0 +1,263 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <avr/eeprom.h>
+
+#include "serial.h"
+#include "car_state.h"
+#include "recorder.h"
+
+/*
+ * Records every change made through the car_state setters, and plays them
+ * back with the same tick timing.
+ *
+ * Only changes are stored, as 2-byte records:
+ *
+ *   byte 0: field (top 3 bits) | ticks since the previous record (low 5 bits)
+ *   byte 1: new value
+ *
+ * Gaps longer than 31 ticks are stored as a REC_WAIT record first, which
+ * holds a 13-bit tick count across both bytes. Recording starts with a
+ * snapshot of every field so replay begins from the same state.
+ *
+ * With 16ms ticks, a minute of driving with a change every half second or so
+ * fits in ~250 bytes.
+ */
+
+#define REC_DELTA_BITS 5
+#define REC_DELTA_MAX  ((1 << REC_DELTA_BITS) - 1)
+#define REC_WAIT_MAX   ((REC_DELTA_MAX << 8) | 0xFF)
+
+/* An EEPROM byte takes 3.3ms to write, so saving a full buffer in one go
+ * would hold up the control loop for most of a second. It is saved this
+ * many bytes per tick instead, which only waits for one byte's write */
+#define REC_SAVE_CHUNK 2
+
+static struct recorder_state {
+    uint8_t recording :1;
+    uint8_t replaying :1;
+    uint8_t full :1;
+    uint8_t saving :1;
+
+    uint16_t tick;
+    uint16_t last_tick;
+
+    uint16_t len;
+    uint16_t pos;
+
+    /* How much of the buffer has been saved */
+    uint16_t saved;
+} rec;
+
+static uint8_t rec_buf[RECORDER_BUF_LEN];
+
+#ifdef RECORDER_EEPROM
+static uint16_t EEMEM rec_eeprom_len;
+static uint8_t EEMEM rec_eeprom_buf[RECORDER_BUF_LEN];
+#endif
+
+static void put_record(uint8_t field, uint8_t delta, uint8_t value)
+{
+    if (rec.len + 2 > RECORDER_BUF_LEN) {
+        if (!rec.full)
+            fprintf(serial_out, "rec:full\n");
+
+        rec.full = 1;
+        return ;
+    }
+
+    rec_buf[rec.len++] = (field << REC_DELTA_BITS) | delta;
+    rec_buf[rec.len++] = value;
+}
+
+void recorder_log(enum recorder_field field, uint8_t value)
+{
+    if (!rec.recording)
+        return ;
+
+    uint16_t delta = rec.tick - rec.last_tick;
+
+    while (delta > REC_DELTA_MAX) {
+        uint16_t wait = delta;
+        if (wait > REC_WAIT_MAX)
+            wait = REC_WAIT_MAX;
+
+        put_record(REC_WAIT, wait >> 8, wait & 0xFF);
+        delta -= wait;
+    }
+
+    put_record(field, delta, value);
+    rec.last_tick = rec.tick;
+}
+
+static void apply_record(struct car_state *car, uint8_t field, uint8_t value)
+{
+    switch (field) {
+    case REC_LEFT_DIR:
+        car_state_left_motor_set(car, value);
+        break;
+
+    case REC_RIGHT_DIR:
+        car_state_right_motor_set(car, value);
+        break;
+
+    case REC_SERVO:
+        car_state_servo_degree_set(car, value);
+        break;
+
+    case REC_LEFT_SPEED:
+        car_state_motor_left_speed_set(car, value);
+        break;
+
+    case REC_RIGHT_SPEED:
+        car_state_motor_right_speed_set(car, value);
+        break;
+    }
+}
+
+static void replay_due(struct car_state *car)
+{
+    while (rec.pos < rec.len) {
+        uint8_t field = rec_buf[rec.pos] >> REC_DELTA_BITS;
+        uint16_t delta = rec_buf[rec.pos] & REC_DELTA_MAX;
+        uint8_t value = rec_buf[rec.pos + 1];
+
+        if (field == REC_WAIT)
+            delta = (delta << 8) | value;
+
+        if (rec.tick - rec.last_tick < delta)
+            return ;
+
+        rec.last_tick += delta;
+        rec.pos += 2;
+
+        if (field != REC_WAIT)
+            apply_record(car, field, value);
+    }
+
+    fprintf(serial_out, "replay:done\n");
+    recorder_replay_stop(car);
+}
+
+#ifdef RECORDER_EEPROM
+static void save_due(void)
+{
+    uint16_t len = rec.len - rec.saved;
+
+    if (len > REC_SAVE_CHUNK)
+        len = REC_SAVE_CHUNK;
+
+    eeprom_update_block(rec_buf + rec.saved, rec_eeprom_buf + rec.saved, len);
+    rec.saved += len;
+
+    if (rec.saved == rec.len) {
+        eeprom_update_word(&rec_eeprom_len, rec.len);
+        rec.saving = 0;
+
+        fprintf(serial_out, "rec:saved\n");
+    }
+}
+#endif
+
+void recorder_tick(struct car_state *car)
+{
+    if (rec.replaying)
+        replay_due(car);
+
+#ifdef RECORDER_EEPROM
+    if (rec.saving)
+        save_due();
+#endif
+
+    rec.tick++;
+}
+
+void recorder_start(struct car_state *car)
+{
+    /* The buffer can't change until the last recording is saved */
+    if (rec.replaying || rec.saving)
+        return ;
+
+    rec.len = 0;
+    rec.full = 0;
+    rec.tick = 0;
+    rec.last_tick = 0;
+    rec.recording = 1;
+
+    recorder_log(REC_LEFT_DIR, car->motor_left);
+    recorder_log(REC_RIGHT_DIR, car->motor_right);
+    recorder_log(REC_SERVO, car->servo_degree);
+    recorder_log(REC_LEFT_SPEED, car->motor_left_speed);
+    recorder_log(REC_RIGHT_SPEED, car->motor_right_speed);
+
+    fprintf(serial_out, "rec:start\n");
+}
+
+void recorder_stop(void)
+{
+    if (!rec.recording)
+        return ;
+
+    rec.recording = 0;
+
+    fprintf(serial_out, "rec:stop:%u:%u\n", rec.len, rec.tick);
+
+#ifdef RECORDER_EEPROM
+    /* Saved a chunk at a time by recorder_tick(). Until the length is
+     * written at the end, the EEPROM reads as blank rather than as a mix of
+     * two recordings */
+    eeprom_update_word(&rec_eeprom_len, 0xFFFF);
+    rec.saved = 0;
+    rec.saving = 1;
+#endif
+}
+
+uint8_t recorder_recording(void)
+{
+    return rec.recording;
+}
+
+void recorder_replay_start(void)
+{
+    if (rec.recording || !rec.len)
+        return ;
+
+    rec.pos = 0;
+    rec.tick = 0;
+    rec.last_tick = 0;
+    rec.replaying = 1;
+
+    fprintf(serial_out, "replay:start:%u\n", rec.len);
+}
+
+void recorder_replay_stop(struct car_state *car)
+{
+    if (!rec.replaying)
+        return ;
+
+    rec.replaying = 0;
+
+    car_state_left_motor_set(car, MOTOR_STOPPED);
+    car_state_right_motor_set(car, MOTOR_STOPPED);
+}
+
+uint8_t recorder_replaying(void)
+{
+    return rec.replaying;
+}
+
+void recorder_init(void)
+{
+    rec.len = 0;
+
+#ifdef RECORDER_EEPROM
+    uint16_t len = eeprom_read_word(&rec_eeprom_len);
+
+    /* Blank EEPROM reads back as 0xFFFF */
+    if (len <= RECORDER_BUF_LEN && !(len & 1)) {
+        eeprom_read_block(rec_buf, rec_eeprom_buf, len);
+        rec.len = len;
+    }
+#endif
+}
@@ -0,0 +1,211 @@
+
+#include "common.h"
+
+#include <stdio.h>
+
+#include "serial.h"
+#include "clock.h"
+#include "ultrasonic.h"
+#include "car_state.h"
+#include "scan.h"
+
+/*
+ * Sweeps the servo carrying the ultrasonic sensor back and forth across its
+ * range, keeping the latest distance seen in each sector.
+ *
+ * Only one step happens per call to scan_tick(), and none of them block:
+ *
+ *   SCAN_MOVE   - Point the servo at the current sector
+ *   SCAN_SETTLE - Wait SCAN_SETTLE_TICKS for the servo to get there
+ *   SCAN_RANGE  - Wait for a front sensor ping that started after the servo
+ *                 settled, store it, and move on to the next sector
+ *
+ * The sweep goes back and forth rather than wrapping around, so the servo
+ * never has to make a full-range jump. It can be limited to a few sectors,
+ * to revisit them more often.
+ */
+
+/* Ticks to wait after moving the servo one sector before ranging. One
+ * sector is 1/16 of the range, which the servo covers well within this. A
+ * longer move, when the range changes, waits this long per sector */
+#define SCAN_SETTLE_TICKS 3
+
+/* The servo degree values are 0-255, each sector is pointed at its middle */
+#define SCAN_DEGREE_STEP (256 / SCAN_SECTORS)
+
+enum scan_step {
+    SCAN_MOVE,
+    SCAN_SETTLE,
+    SCAN_RANGE,
+};
+
+static struct scan_state {
+    uint8_t active :1;
+    uint8_t reverse :1;
+
+    enum scan_step step;
+    uint8_t settle;
+
+    /* clock_micros() the servo settled at */
+    uint32_t settled_at;
+    uint8_t sector;
+    uint8_t updated;
+
+    /* The sector the servo points at, and the ones swept */
+    uint8_t pointed;
+    uint8_t first;
+    uint8_t last;
+} scan_state;
+
+static uint8_t sectors[SCAN_SECTORS];
+
+uint8_t scan_sector_degree(uint8_t sector)
+{
+    return sector * SCAN_DEGREE_STEP + SCAN_DEGREE_STEP / 2;
+}
+
+uint8_t scan_sector(uint8_t sector)
+{
+    return sectors[sector];
+}
+
+uint8_t scan_updated_sector(void)
+{
+    return scan_state.updated;
+}
+
+static void next_sector(void)
+{
+    if (scan_state.first == scan_state.last)
+        return ;
+
+    if (!scan_state.reverse) {
+        if (scan_state.sector >= scan_state.last) {
+            scan_state.reverse = 1;
+            scan_state.sector--;
+        } else {
+            scan_state.sector++;
+        }
+    } else {
+        if (scan_state.sector <= scan_state.first) {
+            scan_state.reverse = 0;
+            scan_state.sector++;
+        } else {
+            scan_state.sector--;
+        }
+    }
+}
+
+static void range_sector(uint16_t cm)
+{
+    uint16_t half_cm = cm / 2;
+
+    if (half_cm > 255)
+        half_cm = 255;
+
+    /* Only a missing echo should look like an unmeasured sector */
+    if (cm == ULTRASONIC_NO_ECHO)
+        half_cm = SCAN_UNKNOWN;
+    else if (half_cm == SCAN_UNKNOWN)
+        half_cm = 1;
+
+    sectors[scan_state.sector] = half_cm;
+
+    fprintf(serial_out, "scan:%d:%d\n", scan_state.sector, sectors[scan_state.sector]);
+}
+
+void scan_tick(struct car_state *car)
+{
+    uint16_t cm;
+
+    scan_state.updated = SCAN_NONE;
+
+    if (!scan_state.active)
+        return ;
+
+    switch (scan_state.step) {
+    case SCAN_MOVE: {
+        uint8_t sectors_moved = scan_state.sector > scan_state.pointed
+                              ? scan_state.sector - scan_state.pointed
+                              : scan_state.pointed - scan_state.sector;
+
+        if (!sectors_moved)
+            sectors_moved = 1;
+
+        car_state_servo_degree_set(car, scan_sector_degree(scan_state.sector));
+        scan_state.pointed = scan_state.sector;
+        scan_state.settle = SCAN_SETTLE_TICKS * sectors_moved;
+        scan_state.step = SCAN_SETTLE;
+        break;
+    }
+
+    case SCAN_SETTLE:
+        if (!--scan_state.settle) {
+            scan_state.settled_at = clock_micros();
+            scan_state.step = SCAN_RANGE;
+        }
+        break;
+
+    case SCAN_RANGE:
+        if (!ultrasonic_read(ULTRASONIC_FRONT, scan_state.settled_at, &cm))
+            break;
+
+        range_sector(cm);
+        scan_state.updated = scan_state.sector;
+        next_sector();
+        scan_state.step = SCAN_MOVE;
+        break;
+    }
+}
+
+void scan_start(void)
+{
+    scan_state.active = 1;
+    scan_state.step = SCAN_MOVE;
+    scan_state.first = 0;
+    scan_state.last = SCAN_SECTORS - 1;
+}
+
+void scan_set_range(uint8_t first, uint8_t last)
+{
+    scan_state.first = first;
+    scan_state.last = last;
+
+    /* A sweep outside the new range starts over from its nearest end. One
+     * inside carries on, a reading in progress included */
+    if (scan_state.sector < first) {
+        scan_state.sector = first;
+        scan_state.reverse = 0;
+        scan_state.step = SCAN_MOVE;
+    } else if (scan_state.sector > last) {
+        scan_state.sector = last;
+        scan_state.reverse = 1;
+        scan_state.step = SCAN_MOVE;
+    }
+}
+
+void scan_stop(void)
+{
+    scan_state.active = 0;
+}
+
+uint8_t scan_active(void)
+{
+    return scan_state.active;
+}
+
+void scan_init(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < SCAN_SECTORS; i++)
+        sectors[i] = SCAN_UNKNOWN;
+
+    scan_state.sector = 0;
+    scan_state.pointed = 0;
+    scan_state.first = 0;
+    scan_state.last = SCAN_SECTORS - 1;
+    scan_state.reverse = 0;
+    scan_state.active = 0;
+    scan_state.updated = SCAN_NONE;
+}
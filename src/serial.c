@@ -1,22 +1,107 @@
 
 #include "common.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/setbaud.h>
 
+#include "clock.h"
+#include "event.h"
 #include "serial.h"
+#include "irq_monitor.h"
+
+static int serial_putc(char c, FILE *f)
+{
+    serial_send_char(c);
+    return c;
+}
+
+static FILE serial_stream = FDEV_SETUP_STREAM(serial_putc, NULL, _FDEV_SETUP_WRITE);
+
+FILE *serial_out = &serial_stream;
+
+/* UBRR for a rate in double speed mode, rounded to the nearest */
+#define SERIAL_UBRR_2X(baud) ((F_CPU + 4UL * (baud)) / (8UL * (baud)) - 1)
+
+/*
+ * The rates that can be switched to. All of them use double speed mode,
+ * which halves the rate error at 57600 (2.1% to -0.8%) and brings 115200
+ * from -3.5% to 2.1%. 115200 is still at the edge of what a receiver
+ * takes, which is what the error counters are for.
+ */
+struct serial_rate {
+    uint32_t baud;
+    uint16_t ubrr;
+};
+
+static const struct serial_rate rates[] PROGMEM = {
+    { 38400,  SERIAL_UBRR_2X(38400) },
+    { 57600,  SERIAL_UBRR_2X(57600) },
+    { 115200, SERIAL_UBRR_2X(115200) },
+};
+
+/* Counted in the RX interrupt, saturating */
+static volatile struct serial_errors {
+    uint16_t framing;
+    uint16_t overrun;
+    uint16_t parity;
+} errors;
+
+static struct {
+    uint32_t baud;
+
+    /* While a switch waits for its confirmation: the rate to go back to,
+     * and the clock_micros() to do it at */
+    uint8_t trying;
+    uint32_t old_baud;
+    uint16_t old_ubrr;
+    uint8_t old_u2x;
+    uint32_t revert_at;
+} baud_state;
+
+static inline void count_error(volatile uint16_t *counter)
+{
+    if (*counter != UINT16_MAX)
+        (*counter)++;
+}
 
 /* Hardware serial
  *
- * When we recieve a char, we call the set callback */
-
-static void (*serial_callback) (char);
+ * When we recieve a char, we post it to the event queue. This used to call
+ * through a function pointer, which forced the ISR to save every
+ * call-clobbered register on each character. event_post() is inlined, so now
+ * only the few registers it uses get saved.
+ *
+ * The error flags in UCSR0A are for the character in UDR0, so they are read
+ * first. A character with a framing or parity error is garbage and is
+ * replaced by the error event. After an overrun the character itself is
+ * fine, but the ones before it were lost, so the error event goes first. */
 
 ISR(USART_RX_vect)
 {
-    char c = UDR0;
-    serial_callback(c);
+    IRQ_MONITOR_START();
+
+    uint8_t status = UCSR0A;
+    uint8_t data = UDR0;
+
+    if (status & (_BV(FE0) | _BV(DOR0) | _BV(UPE0))) {
+        if (status & _BV(FE0))
+            count_error(&errors.framing);
+        if (status & _BV(DOR0))
+            count_error(&errors.overrun);
+        if (status & _BV(UPE0))
+            count_error(&errors.parity);
+
+        event_post(EVENT_SERIAL_RX_ERROR, status);
+    }
+
+    if (!(status & (_BV(FE0) | _BV(UPE0))))
+        event_post(EVENT_SERIAL_RX, data);
+
+    IRQ_MONITOR_STOP(IRQ_SERIAL_RX);
 }
 
 void serial_send_char(char c)
@@ -24,10 +109,113 @@ void serial_send_char(char c)
 	while(!(UCSR0A & (1<<UDRE0)))
         ; // wait until sending is possible
 
+    /* Clear the transmit complete flag, so a baud switch can tell when this
+     * character is out. The error flags must be written as 0 */
+    UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+
 	UDR0 = c; // output character saved in c
 }
 
-void serial_init(void (*char_callback) (char c))
+/* Waits for the last character to go out at the current rate, then changes
+ * it. The receiver is switched off meanwhile, so a character caught half
+ * way isn't counted as an error */
+static void set_rate(uint16_t ubrr, uint8_t u2x)
+{
+    while (!(UCSR0A & _BV(TXC0)))
+        ;
+
+    UCSR0B &= ~_BV(RXEN0);
+
+    UBRR0H = ubrr >> 8;
+    UBRR0L = ubrr;
+
+    if (u2x)
+        UCSR0A = _BV(U2X0);
+    else
+        UCSR0A = 0;
+
+    UCSR0B |= _BV(RXEN0);
+
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    errors.framing = 0;
+    errors.overrun = 0;
+    errors.parity = 0;
+
+    IRQ_MONITOR_STOP(IRQ_CLI_SERIAL);
+    SREG = sreg;
+}
+
+void serial_baud_try(const char *rate)
+{
+    uint32_t baud = strtoul(rate, NULL, 10);
+    struct serial_rate r;
+    uint8_t i;
+
+    for (i = 0; i < ARRAY_SIZE(rates); i++) {
+        memcpy_P(&r, rates + i, sizeof(r));
+        if (r.baud == baud)
+            break;
+    }
+
+    if (i == ARRAY_SIZE(rates) || baud_state.trying) {
+        fprintf(serial_out, "baud:err:%s\n", rate);
+        return ;
+    }
+
+    fprintf(serial_out, "baud:try:%lu\n", baud);
+
+    baud_state.old_baud = baud_state.baud;
+    baud_state.old_ubrr = ((uint16_t)UBRR0H << 8) | UBRR0L;
+    baud_state.old_u2x = !!(UCSR0A & _BV(U2X0));
+
+    set_rate(r.ubrr, 1);
+
+    baud_state.baud = baud;
+    baud_state.trying = 1;
+    baud_state.revert_at = clock_micros() + SERIAL_BAUD_CONFIRM_MS * 1000UL;
+}
+
+void serial_baud_confirm(void)
+{
+    if (!baud_state.trying)
+        return ;
+
+    baud_state.trying = 0;
+    fprintf(serial_out, "baud:ok:%lu\n", baud_state.baud);
+}
+
+void serial_tick(void)
+{
+    if (!baud_state.trying || (int32_t)(clock_micros() - baud_state.revert_at) < 0)
+        return ;
+
+    baud_state.trying = 0;
+    baud_state.baud = baud_state.old_baud;
+
+    set_rate(baud_state.old_ubrr, baud_state.old_u2x);
+
+    fprintf(serial_out, "baud:revert:%lu\n", baud_state.baud);
+}
+
+void serial_report(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
+
+    struct serial_errors e = errors;
+
+    IRQ_MONITOR_STOP(IRQ_CLI_SERIAL);
+    SREG = sreg;
+
+    fprintf(serial_out, "uart:%lu:%u:%u:%u:%u\n", baud_state.baud, e.framing, e.overrun,
+            e.parity, event_dropped);
+}
+
+void serial_init(void)
 {
     /* We're using the setbaud.h magic to calculate the baudrate flag values.
      *
@@ -41,10 +229,15 @@ void serial_init(void (*char_callback) (char c))
     UCSR0A &= ~_BV(U2X0);
 #endif
 
-    serial_callback = char_callback;
-
     /* Turn on RX and TX, as well as the RX interrupt */
 	UCSR0B |= _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
 	UCSR0C |= _BV(UCSZ01) | _BV(UCSZ00);
-}
 
+    /* Interrupts are still off, the receiver can't count anything yet */
+    baud_state.baud = BAUD;
+    baud_state.trying = 0;
+
+    errors.framing = 0;
+    errors.overrun = 0;
+    errors.parity = 0;
+}
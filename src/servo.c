@@ -6,6 +6,7 @@
 #include <avr/io.h>
 
 #include "servo.h"
+#include "irq_monitor.h"
 
 /* This is only half-implemented at the moment. It *should* support more the
  * one servo, however it currently only does one.
@@ -24,6 +25,10 @@
  * We cannot easily generate this signal just via PWM (The signal is too slow,
  * and on/off is too short), so we instead generate it by hand triggering the
  * timer interrupt and then toggling the outputs manually.
+ *
+ * TIMER1 is free-running since it is also the system clock (see clock.c), so
+ * each interrupt schedules the next one by moving OCR1A forward from the
+ * current compare point, rather than resetting the count.
  */
 
 /* We make use of TIMER1, which is the only 16-bit timer. This is important
@@ -76,57 +81,59 @@ static int next_servo = 0;
 
 ISR(TIMER1_COMPA_vect)
 {
+    IRQ_MONITOR_START_DUE(OCR1A);
+
     if (next_servo == -1) {
-        OCR1A = SERVO_REFRESH_PERIOD_TICKS;
+        OCR1A += SERVO_REFRESH_PERIOD_TICKS;
         next_servo = 0;
     } else if (servos[0].port) {
         if (servos[0].is_on) {
             *servos[0].port &= ~_BV(servos[0].pin);
-            OCR1A = SERVO_PERIOD_TICKS - servos[0].duty_cycle_ticks;
+            OCR1A += SERVO_PERIOD_TICKS - servos[0].duty_cycle_ticks;
             servos[0].is_on = 0;
             next_servo = -1;
         } else {
             *servos[0].port |= _BV(servos[0].pin);
             servos[0].is_on = 1;
-            OCR1A = servos[0].duty_cycle_ticks;
+            OCR1A += servos[0].duty_cycle_ticks;
         }
     } else {
-        OCR1A = SERVO_PERIOD_TICKS;
+        OCR1A += SERVO_PERIOD_TICKS;
     }
 
-    TCNT1 = 0;
+    IRQ_MONITOR_STOP(IRQ_SERVO);
 }
 
 void servo_init(void)
 {
-    /* This sets timer 1 to count up, with a prescaler of 8.
-     * When it hits OCR1A, it will trigger an interrupt */
-    TCCR1A = 0;
-    TCCR1B = _BV(CS11);
-    TCNT1 = 0;
-
-    /* Tell it to trigger an interrupt when TCNT1 hits OCR0A */
-    TIFR1 |= _BV(OCF1A);
-    TIMSK1 |= _BV(OCIE1A);
+    /* Timer 1 is already counting up with a prescaler of 8, from
+     * clock_init() */
+    OCR1A = TCNT1 + SERVO_PERIOD_TICKS;
 
-    OCR1A = SERVO_PERIOD_TICKS;
+    /* Tell it to trigger an interrupt when TCNT1 hits OCR1A */
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
 }
 
 int servo_register(uint8_t volatile *port, uint8_t pin)
 {
     uint8_t sreg = SREG;
     cli();
+    IRQ_MONITOR_START();
 
     servos[0].port = port;
     servos[0].pin = pin;
     servos[0].is_on = 0;
     servos[0].duty_cycle_ticks = SERVO_DUTY_CYCLE_MIN_TICKS;
 
-    printf("PIN: %d, ticks: %d\n", pin, servos[0].duty_cycle_ticks);
-
-    OCR1A = servos[0].duty_cycle_ticks;
+    OCR1A = TCNT1 + servos[0].duty_cycle_ticks;
+    uint16_t ticks = servos[0].duty_cycle_ticks;
 
+    IRQ_MONITOR_STOP(IRQ_CLI_SERVO);
     SREG = sreg;
+
+    printf("PIN: %d, ticks: %u\n", pin, ticks);
+
     return 1;
 }
 
@@ -134,9 +141,11 @@ void servo_unregister(int s)
 {
     uint8_t sreg = SREG;
     cli();
+    IRQ_MONITOR_START();
 
     servos[0].port = NULL;
 
+    IRQ_MONITOR_STOP(IRQ_CLI_SERVO);
     SREG = sreg;
 }
 
@@ -144,9 +153,11 @@ void servo_set(int degree)
 {
     uint8_t sreg = SREG;
     cli();
+    IRQ_MONITOR_START();
 
     servos[0].duty_cycle_ticks = SERVO_DUTY_CYCLE_MIN_TICKS + (uint16_t)degree * (SERVO_DUTY_CYCLE_PULSE_TICKS / 256);
 
+    IRQ_MONITOR_STOP(IRQ_CLI_SERVO);
     SREG = sreg;
 }
 
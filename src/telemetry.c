@@ -0,0 +1,23 @@
+
+#include "common.h"
+
+#include "serial.h"
+#include "telemetry.h"
+
+void telemetry_send_frame(uint8_t type, const void *payload, uint8_t len)
+{
+    const uint8_t *p = payload;
+    uint8_t check = type ^ len;
+    uint8_t i;
+
+    serial_send_char(TELEMETRY_SYNC);
+    serial_send_char(type);
+    serial_send_char(len);
+
+    for (i = 0; i < len; i++) {
+        serial_send_char(p[i]);
+        check ^= p[i];
+    }
+
+    serial_send_char(check);
+}
@@ -0,0 +1,158 @@
+
+#include "common.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+
+#include "serial.h"
+#include "tune.h"
+
+/*
+ * The parameter names and limits live in a table in flash. A lookup is a
+ * linear strcmp_P() over it, which is fine since it only happens when a
+ * command comes in.
+ *
+ * Committed values are stored in EEPROM behind a magic byte holding the
+ * layout version, so stale values from an older layout are never loaded.
+ * TUNE_VERSION has to be bumped on every change to struct tune_params, even
+ * one that keeps its size. Older firmware used 0xA0 | size as the magic,
+ * which the 0xC0 range stays clear of.
+ */
+
+#define TUNE_VERSION 1
+#define TUNE_MAGIC (0xC0 | TUNE_VERSION)
+
+static const struct tune_params tune_defaults PROGMEM = {
+    .loop_period_ms = 16,
+    .ultrasonic_gap_ms = 10,
+    .speed_step = 10,
+    .servo_step = 20,
+    .pwm_offset = 50,
+    .telemetry_frames = 0,
+    .auto_speed = 180,
+    .auto_obstacle_cm = 30,
+    .auto_clear_cm = 60,
+    .line_speed = 170,
+    .line_kp = 20,
+    .line_kd = 24,
+    .irq_budget_us = 16,
+};
+
+struct tune_params tune;
+
+static uint8_t EEMEM tune_eeprom_magic;
+static struct tune_params EEMEM tune_eeprom;
+
+struct tune_param {
+    const char *name;
+    uint8_t *value;
+    uint8_t min;
+    uint8_t max;
+};
+
+static const char name_loop_ms[] PROGMEM = "loop_ms";
+static const char name_ult_gap[] PROGMEM = "ult_gap";
+static const char name_spd_step[] PROGMEM = "spd_step";
+static const char name_srv_step[] PROGMEM = "srv_step";
+static const char name_pwm_off[] PROGMEM = "pwm_off";
+static const char name_telem[] PROGMEM = "telem";
+static const char name_auto_spd[] PROGMEM = "auto_spd";
+static const char name_auto_obs[] PROGMEM = "auto_obs";
+static const char name_auto_clr[] PROGMEM = "auto_clr";
+static const char name_line_spd[] PROGMEM = "line_spd";
+static const char name_line_kp[] PROGMEM = "line_kp";
+static const char name_line_kd[] PROGMEM = "line_kd";
+static const char name_irq_bud[] PROGMEM = "irq_bud";
+
+static const struct tune_param params[] PROGMEM = {
+    { name_loop_ms,  &tune.loop_period_ms,     1, 100 },
+    { name_ult_gap,  &tune.ultrasonic_gap_ms,  1, 60 },
+    { name_spd_step, &tune.speed_step,         1, 100 },
+    { name_srv_step, &tune.servo_step,         1, 100 },
+    { name_pwm_off,  &tune.pwm_offset,         0, 55 },
+    { name_telem,    &tune.telemetry_frames,   0, 1 },
+    { name_auto_spd, &tune.auto_speed,         60, 255 },
+    { name_auto_obs, &tune.auto_obstacle_cm,   10, 200 },
+    { name_auto_clr, &tune.auto_clear_cm,      10, 250 },
+    { name_line_spd, &tune.line_speed,         60, 255 },
+    { name_line_kp,  &tune.line_kp,            0, 100 },
+    { name_line_kd,  &tune.line_kd,            0, 100 },
+    { name_irq_bud,  &tune.irq_budget_us,      1, 255 },
+};
+
+static const struct tune_param *find_param(const char *name)
+{
+    uint8_t i;
+
+    for (i = 0; i < ARRAY_SIZE(params); i++)
+        if (strcmp_P(name, pgm_read_ptr(&params[i].name)) == 0)
+            return params + i;
+
+    return NULL;
+}
+
+static void report(const struct tune_param *param)
+{
+    uint8_t *value = pgm_read_ptr(&param->value);
+
+    fprintf_P(serial_out, PSTR("tune:%S:%d\n"), (const char *)pgm_read_ptr(&param->name), *value);
+}
+
+void tune_get(const char *name)
+{
+    const struct tune_param *param = find_param(name);
+
+    if (!param) {
+        fprintf_P(serial_out, PSTR("tune:err:%s\n"), name);
+        return ;
+    }
+
+    report(param);
+}
+
+void tune_set(const char *name, const char *value)
+{
+    const struct tune_param *param = find_param(name);
+    char *end;
+    long v = strtol(value, &end, 10);
+
+    /* The whole value has to be digits. None of the limits are negative */
+    if (!param || !isdigit(*value) || *end != '\0'
+        || v < pgm_read_byte(&param->min)
+        || v > pgm_read_byte(&param->max)) {
+        fprintf_P(serial_out, PSTR("tune:err:%s\n"), name);
+        return ;
+    }
+
+    *(uint8_t *)pgm_read_ptr(&param->value) = v;
+
+    report(param);
+}
+
+void tune_list(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < ARRAY_SIZE(params); i++)
+        report(params + i);
+}
+
+void tune_save(void)
+{
+    eeprom_update_block(&tune, &tune_eeprom, sizeof(tune));
+    eeprom_update_byte(&tune_eeprom_magic, TUNE_MAGIC);
+
+    fprintf_P(serial_out, PSTR("tune:saved\n"));
+}
+
+void tune_init(void)
+{
+    memcpy_P(&tune, &tune_defaults, sizeof(tune));
+
+    if (eeprom_read_byte(&tune_eeprom_magic) == TUNE_MAGIC)
+        eeprom_read_block(&tune, &tune_eeprom, sizeof(tune));
+}
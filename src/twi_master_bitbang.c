@@ -28,10 +28,28 @@
 #define SCL_PIN    PINC
 #define SCL_PIN_N  PINC1
 
+/* Clock stretching is given up on after this many 10us waits */
+#define TWI_STRETCH_LOOPS 100
+
+/* Attempts per transfer, and the wait before the first retry. The wait
+ * doubles on each retry after that */
+#define TWI_ATTEMPTS 3
+#define TWI_BACKOFF_US 100
+
+/* Devices with their own error counters. Errors for any others are not
+ * counted */
+#define TWI_MAX_DEVICES 4
+
 static struct twi_state {
     uint8_t send_restart :1;
 } twi_state;
 
+static struct twi_device_stats {
+    uint8_t address;
+    uint8_t last_status;
+    uint16_t errors;
+} device_stats[TWI_MAX_DEVICES];
+
 static inline void twi_delay(void)
 {
     /* This delay gives us around a 100Khz speed. Since we have a separate clock (SCL),
@@ -69,6 +87,24 @@ static inline void sda_low(void)
     sbi(SDA_DDR, SDA_DDR_N);
 }
 
+/* Releases SCL and waits for it to actually go high. The slave may stretch
+ * the clock to request more time by holding it low, but not forever */
+static uint8_t scl_release(void)
+{
+    uint8_t i;
+
+    scl_high();
+
+    for (i = 0; i < TWI_STRETCH_LOOPS; i++) {
+        if (scl_read())
+            return TWI_OK;
+
+        _delay_us(10);
+    }
+
+    return TWI_TIMEOUT;
+}
+
 void twi_master_init(void)
 {
     /* Setup for open-drain configuration */
@@ -79,21 +115,53 @@ void twi_master_init(void)
     sda_high();
 }
 
-static void twi_send_start_cond(void)
+/*
+ * A slave that was reset or glitched in the middle of a read can be left
+ * holding SDA low, waiting for clocks that will never come. Clocking SCL up
+ * to 9 times lets it finish shifting out its byte and let go of SDA, and the
+ * STOP afterward puts it back to idle.
+ */
+static void twi_bus_recover(void)
+{
+    uint8_t i;
+
+    sda_high();
+
+    for (i = 0; i < 9 && !sda_read(); i++) {
+        scl_low();
+        twi_delay();
+        scl_release();
+        twi_delay();
+    }
+
+    scl_low();
+    sda_low();
+    twi_delay();
+    scl_release();
+    twi_delay();
+    sda_high();
+    twi_delay();
+
+    twi_state.send_restart = 0;
+}
+
+static uint8_t twi_send_start_cond(void)
 {
     if (twi_state.send_restart) {
         /* Generate a restart condition instead of a regular start */
         sda_high();
         twi_delay();
-        scl_high();
 
-        /* The slave may stretch the clock to request more time by holding it low */
-        while (!scl_read())
-            _delay_us(10);
+        if (scl_release())
+            return TWI_TIMEOUT;
 
         twi_delay();
     }
 
+    /* Both lines have to be free before we can take the bus */
+    if (!sda_read() || !scl_read())
+        return TWI_ARB_LOST;
+
     /* Start condition - SDA goes low while SCL is high */
     sda_low();
     twi_delay();
@@ -101,26 +169,29 @@ static void twi_send_start_cond(void)
 
     /* This triggers a restart to be sent if this function is called without this being reset */
     twi_state.send_restart = 1;
+
+    return TWI_OK;
 }
 
-static void twi_send_stop_cond(void)
+static uint8_t twi_send_stop_cond(void)
 {
+    uint8_t status;
+
     sda_low();
     twi_delay();
 
-    scl_high();
-
-    while (!scl_read())
-        _delay_us(10);
+    status = scl_release();
 
     sda_high();
     twi_delay();
 
     /* We just sent a stop condition, so we can't send a restart anymore */
     twi_state.send_restart = 0;
+
+    return status;
 }
 
-static void twi_write_bit(int bit)
+static uint8_t twi_write_bit(int bit)
 {
     if (bit)
         sda_high();
@@ -129,132 +200,264 @@ static void twi_write_bit(int bit)
 
     twi_delay();
 
-    scl_high();
+    if (scl_release())
+        return TWI_TIMEOUT;
+
     twi_delay();
 
-    while (!scl_read())
-        _delay_us(10);
+    /* If we let SDA go high and it's low, something else is driving it */
+    if (bit && !sda_read())
+        return TWI_ARB_LOST;
 
     scl_low();
+
+    return TWI_OK;
 }
 
-static uint8_t twi_read_bit(void)
+static uint8_t twi_read_bit(uint8_t *bit)
 {
-    uint8_t bit;
-
     /* This is High-Z, so the slave can drive SDA */
     sda_high();
 
     twi_delay();
 
-    scl_high();
-
-    while (!scl_read())
-        _delay_us(10);
+    if (scl_release())
+        return TWI_TIMEOUT;
 
     twi_delay();
 
-    bit = sda_read();
+    *bit = sda_read();
 
     scl_low();
 
-    return bit;
+    return TWI_OK;
 }
 
+/* Returns TWI_DATA_NACK if the byte wasn't acknowledged */
 static uint8_t twi_write_byte(uint8_t byte)
 {
+    uint8_t status;
+    uint8_t nack;
     uint8_t i;
 
     for (i = 0; i < 8; i++) {
-        twi_write_bit(byte & 0x80);
+        status = twi_write_bit(byte & 0x80);
+        if (status)
+            return status;
+
         byte <<= 1;
     }
 
     /* This is the ACK */
-    return twi_read_bit();
+    status = twi_read_bit(&nack);
+    if (status)
+        return status;
+
+    return nack? TWI_DATA_NACK: TWI_OK;
 }
 
-static uint8_t twi_read_byte(int nack)
+static uint8_t twi_read_byte(uint8_t *byte, int nack)
 {
-   uint8_t result = 0;
-   uint8_t i;
+    uint8_t status;
+    uint8_t bit;
+    uint8_t i;
 
-   for (i = 0; i < 8; i++)
-       result |= twi_read_bit() << (7 - i);
+    *byte = 0;
 
-   /* ACK */
-   twi_write_bit(nack);
+    for (i = 0; i < 8; i++) {
+        status = twi_read_bit(&bit);
+        if (status)
+            return status;
 
-   return result;
+        *byte |= bit << (7 - i);
+    }
+
+    /* ACK */
+    return twi_write_bit(nack);
 }
 
-uint8_t twi_write_data(uint8_t address, const uint8_t *data, uint8_t count)
+static uint8_t twi_send_address(uint8_t address, uint8_t read)
 {
-    uint8_t i;
+    uint8_t status = twi_send_start_cond();
 
-    twi_send_start_cond();
-    twi_write_byte(address << 1);
+    if (status)
+        return status;
 
-    for (i = 0; i < count; i++)
-        twi_write_byte(data[i]);
+    status = twi_write_byte((address << 1) | read);
+    if (status == TWI_DATA_NACK)
+        return TWI_ADDR_NACK;
 
-    twi_send_stop_cond();
-
-    return 0;
+    return status;
 }
 
-uint8_t twi_read_data(uint8_t address, uint8_t *data, uint8_t count)
+/*
+ * One whole transfer: an optional write phase (the register, then 'wdata'),
+ * followed by an optional read phase into 'rdata' after a (re)start.
+ */
+struct twi_transfer {
+    uint8_t address;
+
+    uint8_t has_reg;
+    uint8_t reg;
+
+    const uint8_t *wdata;
+    uint8_t wcount;
+
+    uint8_t *rdata;
+    uint8_t rcount;
+};
+
+static uint8_t twi_try_transfer(const struct twi_transfer *xfer)
 {
+    uint8_t status;
     uint8_t i;
 
-    twi_send_start_cond();
-    twi_write_byte((address << 1) | 0x01);
+    if (xfer->has_reg || xfer->wcount) {
+        status = twi_send_address(xfer->address, 0);
+        if (status)
+            return status;
+
+        if (xfer->has_reg) {
+            status = twi_write_byte(xfer->reg);
+            if (status)
+                return status;
+        }
+
+        for (i = 0; i < xfer->wcount; i++) {
+            status = twi_write_byte(xfer->wdata[i]);
+            if (status)
+                return status;
+        }
+    }
 
-    for (i = 0; i < count - 1; i++)
-        data[i] = twi_read_byte(0);
+    if (xfer->rcount) {
+        status = twi_send_address(xfer->address, 1);
+        if (status)
+            return status;
+
+        for (i = 0; i < xfer->rcount; i++) {
+            /* The last byte is NACKed to tell the slave we're done */
+            status = twi_read_byte(xfer->rdata + i, i == xfer->rcount - 1);
+            if (status)
+                return status;
+        }
+    }
 
-    data[i] = twi_read_byte(1);
+    return twi_send_stop_cond();
+}
 
-    twi_send_stop_cond();
+static void twi_record_status(uint8_t address, uint8_t status)
+{
+    uint8_t i;
 
-    return 0;
+    for (i = 0; i < TWI_MAX_DEVICES; i++) {
+        if (!device_stats[i].address)
+            device_stats[i].address = address;
+
+        if (device_stats[i].address == address)
+            break;
+    }
+
+    if (i == TWI_MAX_DEVICES)
+        return ;
+
+    device_stats[i].last_status = status;
+    if (status && device_stats[i].errors != 0xFFFF)
+        device_stats[i].errors++;
 }
 
-uint8_t twi_write_reg_data(uint8_t address, uint8_t reg, const uint8_t *data, uint8_t count)
+static uint8_t twi_transfer(const struct twi_transfer *xfer)
 {
-    uint8_t i;
+    uint8_t status = TWI_OK;
+    uint8_t attempt, i;
 
-    twi_send_start_cond();
-    twi_write_byte(address << 1);
-    twi_write_byte(reg);
+    for (attempt = 0; attempt < TWI_ATTEMPTS; attempt++) {
+        if (attempt) {
+            for (i = 0; i < (1 << (attempt - 1)); i++)
+                _delay_us(TWI_BACKOFF_US);
+        }
 
-    for (i = 0; i < count; i++)
-        twi_write_byte(data[i]);
+        status = twi_try_transfer(xfer);
+        twi_record_status(xfer->address, status);
 
-    twi_send_stop_cond();
+        if (!status)
+            break;
 
-    return 0;
+        /* Leave the bus idle for the next try, freeing SDA if a slave is
+         * holding it */
+        if (twi_send_stop_cond() || !sda_read())
+            twi_bus_recover();
+    }
+
+    return status;
 }
 
-uint8_t twi_read_reg_data(uint8_t address, uint8_t reg, uint8_t *data, uint8_t count)
+uint8_t twi_write_data(uint8_t address, const uint8_t *data, uint8_t count)
 {
-    uint8_t i;
+    struct twi_transfer xfer = {
+        .address = address,
+        .wdata = data,
+        .wcount = count,
+    };
 
-    twi_send_start_cond();
-    twi_write_byte(address << 1);
-    twi_write_byte(reg);
+    return twi_transfer(&xfer);
+}
 
-    twi_send_start_cond();
-    twi_write_byte((address << 1) | 0x01);
+uint8_t twi_read_data(uint8_t address, uint8_t *data, uint8_t count)
+{
+    struct twi_transfer xfer = {
+        .address = address,
+        .rdata = data,
+        .rcount = count,
+    };
 
-    for (i = 0; i < count - 1; i++)
-        data[i] = twi_read_byte(0);
+    return twi_transfer(&xfer);
+}
 
-    data[i] = twi_read_byte(1);
+uint8_t twi_write_reg_data(uint8_t address, uint8_t reg, const uint8_t *data, uint8_t count)
+{
+    struct twi_transfer xfer = {
+        .address = address,
+        .has_reg = 1,
+        .reg = reg,
+        .wdata = data,
+        .wcount = count,
+    };
+
+    return twi_transfer(&xfer);
+}
 
-    twi_send_stop_cond();
+uint8_t twi_read_reg_data(uint8_t address, uint8_t reg, uint8_t *data, uint8_t count)
+{
+    struct twi_transfer xfer = {
+        .address = address,
+        .has_reg = 1,
+        .reg = reg,
+        .rdata = data,
+        .rcount = count,
+    };
+
+    return twi_transfer(&xfer);
+}
 
-    return 0;
+uint16_t twi_error_count(uint8_t address)
+{
+    uint8_t i;
+
+    for (i = 0; i < TWI_MAX_DEVICES; i++)
+        if (device_stats[i].address == address)
+            return device_stats[i].errors;
 
+    return 0;
 }
 
+uint8_t twi_last_status(uint8_t address)
+{
+    uint8_t i;
+
+    for (i = 0; i < TWI_MAX_DEVICES; i++)
+        if (device_stats[i].address == address)
+            return device_stats[i].last_status;
+
+    return TWI_OK;
+}
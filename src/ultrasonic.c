@@ -3,85 +3,310 @@
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "serial.h"
+#include "clock.h"
+#include "tune.h"
+#include "irq_monitor.h"
 #include "ultrasonic.h"
 
-#define TICKS_PER_US (F_CPU / 1000000UL)
+/*
+ * The sensors are pinged one at a time, round robin. The next ping only
+ * starts once the last one is over and the 'ult_gap' tuning parameter has
+ * passed, so late reflections of one ping are never taken for another
+ * sensor's echo.
+ *
+ * Nothing here waits on a sensor. The echo edges are timestamped by the pin
+ * change interrupt, and ultrasonic_poll() picks up the result and starts
+ * the next ping. Sound takes ~58us to go 1cm and back.
+ *
+ * The sensor raises echo within a few hundred us of the trigger, and drops
+ * it after at most ~38ms even when nothing is in range. A ping that takes
+ * longer than that has no echo, and is counted as dropped.
+ *
+ * Every second, each sensor reports "ult:<sensor>:<readings>:<dropped>:<cm>"
+ * over the hardware serial. Readings is then also the update rate in Hz.
+ */
+#define ULTRASONIC_US_PER_CM 58
 
-static volatile uint16_t overflow_count;
+#define ULTRASONIC_RISE_TIMEOUT_US  5000UL
+#define ULTRASONIC_PULSE_TIMEOUT_US 40000UL
 
-ISR(TIMER2_OVF_vect)
+#define ULTRASONIC_REPORT_US 1000000UL
+
+#define ULTRASONIC_IDLE ULTRASONIC_SENSORS
+
+struct ultrasonic_desc {
+    volatile uint8_t *trig_port;
+    volatile uint8_t *trig_ddr;
+    uint8_t trig_mask;
+
+    /* On ULTRASONIC_ECHO_PIN */
+    uint8_t echo_mask;
+};
+
+static const struct ultrasonic_desc descs[ULTRASONIC_SENSORS] PROGMEM = {
+    [ULTRASONIC_FRONT] = {
+        &ULTRASONIC_FRONT_TRIG_PORT, &ULTRASONIC_FRONT_TRIG_DDR,
+        _BV(ULTRASONIC_FRONT_TRIG_PIN_N), _BV(ULTRASONIC_FRONT_ECHO_PIN_N),
+    },
+    [ULTRASONIC_LEFT] = {
+        &ULTRASONIC_LEFT_TRIG_PORT, &ULTRASONIC_LEFT_TRIG_DDR,
+        _BV(ULTRASONIC_LEFT_TRIG_PIN_N), _BV(ULTRASONIC_LEFT_ECHO_PIN_N),
+    },
+    [ULTRASONIC_RIGHT] = {
+        &ULTRASONIC_RIGHT_TRIG_PORT, &ULTRASONIC_RIGHT_TRIG_DDR,
+        _BV(ULTRASONIC_RIGHT_TRIG_PIN_N), _BV(ULTRASONIC_RIGHT_ECHO_PIN_N),
+    },
+};
+
+static struct sensor_state {
+    uint16_t cm;
+    uint8_t finished;
+
+    /* clock_micros() the last finished ping was triggered at */
+    uint32_t ping_at;
+    /* clock_micros() at the end of the last successful reading */
+    uint32_t reading_at;
+
+    /* Since the last report */
+    uint16_t readings;
+    uint16_t dropped;
+} sensors[ULTRASONIC_SENSORS];
+
+/* Shared with the interrupt */
+static volatile struct echo {
+    /* Echo pin of the sensor being pinged, 0 when none is */
+    uint8_t mask;
+
+    uint8_t rose;
+    uint8_t fell;
+
+    /* clock_stamp() of the edges */
+    uint16_t rise;
+    uint16_t fall;
+} echo;
+
+static struct {
+    /* Being pinged, or ULTRASONIC_IDLE */
+    uint8_t sensor;
+    uint8_t next;
+
+    uint32_t trig_at;
+
+    /* clock_micros() the next ping can start at */
+    uint32_t quiet_at;
+
+    uint32_t report_at;
+} sched;
+
+ISR(ULTRASONIC_ECHO_vect)
 {
-    overflow_count++;
+    IRQ_MONITOR_START();
+
+    if (echo.mask) {
+        uint8_t level = ULTRASONIC_ECHO_PIN & echo.mask;
+
+        if (level && !echo.rose) {
+            echo.rise = clock_stamp();
+            echo.rose = 1;
+        } else if (!level && echo.rose && !echo.fell) {
+            echo.fall = clock_stamp();
+            echo.fell = 1;
+        }
+    }
+
+    IRQ_MONITOR_STOP(IRQ_ULTRASONIC);
 }
 
-static inline uint16_t ms_to_cm(unsigned long duration)
+/* The ports are shared with pins the interrupts write, so the read-modify-
+ * write through a pointer has to be atomic */
+static void write_trig(volatile uint8_t *port, uint8_t mask, uint8_t high)
 {
-    return (uint16_t)((duration / 2) / 29.1);
-}
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
 
-static FILE *serial_out;
+    if (high)
+        *port |= mask;
+    else
+        *port &= ~mask;
 
-static int serial_write(char c, FILE *f)
-{
-    serial_send_char(c);
-    return c;
+    IRQ_MONITOR_STOP(IRQ_CLI_ULTRASONIC);
+    SREG = sreg;
 }
 
 void ultrasonic_init(void)
 {
-    ULTRASONIC_TRIG_PORT &= ~_BV(ULTRASONIC_TRIG_PIN_N);
+    uint8_t i;
+
+    for (i = 0; i < ULTRASONIC_SENSORS; i++) {
+        struct ultrasonic_desc d;
+
+        memcpy_P(&d, descs + i, sizeof(d));
+
+        write_trig(d.trig_port, d.trig_mask, 0);
+        write_trig(d.trig_ddr, d.trig_mask, 1);
+
+        ULTRASONIC_ECHO_DDR &= ~d.echo_mask;
+        ULTRASONIC_ECHO_PCMSK |= d.echo_mask;
+    }
 
-    TCCR2B = 0;
-    TCCR2A = 0;
-    TIMSK2 |= _BV(TOIE2);
+    PCICR |= _BV(ULTRASONIC_ECHO_PCIE);
 
-    serial_out = fdevopen(serial_write, NULL);
+    sched.sensor = ULTRASONIC_IDLE;
+    sched.quiet_at = clock_micros();
+    sched.report_at = sched.quiet_at + ULTRASONIC_REPORT_US;
 }
 
-uint16_t ultrasonic_read_distance(void)
+/* Turns the length of an echo pulse into a distance in cm. Split out so the
+ * math can be measured without a sensor attached. */
+static uint16_t ultrasonic_convert(uint16_t us)
 {
-    TCNT2 = 0;
-    TIFR2 |= _BV(TOV2);
+    uint16_t distance = us / ULTRASONIC_US_PER_CM;
+
+    /* Anything under 1cm is still an echo */
+    if (distance == ULTRASONIC_NO_ECHO)
+        distance = 1;
+
+    return distance;
+}
+
+static void start(uint8_t sensor)
+{
+    struct ultrasonic_desc d;
+
+    memcpy_P(&d, descs + sensor, sizeof(d));
+
+    uint8_t sreg = SREG;
+    cli();
+    IRQ_MONITOR_START();
 
-    overflow_count = 0;
+    echo.mask = d.echo_mask;
+    echo.rose = 0;
+    echo.fell = 0;
 
-    ULTRASONIC_TRIG_PORT |= _BV(ULTRASONIC_TRIG_PIN_N);
+    IRQ_MONITOR_STOP(IRQ_CLI_ULTRASONIC);
+    SREG = sreg;
+
+    sched.sensor = sensor;
+    sched.trig_at = clock_micros();
+
+    write_trig(d.trig_port, d.trig_mask, 1);
     _delay_us(10);
-    ULTRASONIC_TRIG_PORT &= ~_BV(ULTRASONIC_TRIG_PIN_N);
+    write_trig(d.trig_port, d.trig_mask, 0);
+}
+
+static void finish(uint16_t cm)
+{
+    struct sensor_state *s = sensors + sched.sensor;
+    uint32_t now = clock_micros();
+
+    echo.mask = 0;
+
+    s->cm = cm;
+    s->finished = 1;
+    s->ping_at = sched.trig_at;
+
+    if (cm == ULTRASONIC_NO_ECHO) {
+        s->dropped++;
+    } else {
+        s->readings++;
+        s->reading_at = now;
+    }
+
+    sched.sensor = ULTRASONIC_IDLE;
+    sched.quiet_at = now + (uint32_t)tune.ultrasonic_gap_ms * 1000;
+}
+
+void ultrasonic_poll(void)
+{
+    uint32_t now = clock_micros();
+
+    if (sched.sensor != ULTRASONIC_IDLE) {
+        uint8_t sreg = SREG;
+        cli();
+        IRQ_MONITOR_START();
+
+        uint8_t rose = echo.rose, fell = echo.fell;
+        uint16_t rise = echo.rise, fall = echo.fall;
+
+        IRQ_MONITOR_STOP(IRQ_CLI_ULTRASONIC);
+        SREG = sreg;
 
+        uint32_t waited = now - sched.trig_at;
 
-    /* Wait for rising edge */
-    while (!(ULTRASONIC_ECHO_PIN & _BV(ULTRASONIC_ECHO_PIN_N)))
-        ;
+        if (fell) {
+            uint32_t us = (uint32_t)(uint16_t)(fall - rise) * CLOCK_STAMP_US;
 
-    /* Turn on the timer with 128 prescaler */
-    TCCR2B |= _BV(CS20) | _BV(CS22);
+            finish(us > ULTRASONIC_PULSE_TIMEOUT_US ? ULTRASONIC_NO_ECHO : ultrasonic_convert(us));
+        } else if (waited > ULTRASONIC_RISE_TIMEOUT_US
+                   + (rose ? ULTRASONIC_PULSE_TIMEOUT_US : 0)) {
+            finish(ULTRASONIC_NO_ECHO);
+        }
 
-    while (ULTRASONIC_ECHO_PIN & _BV(ULTRASONIC_ECHO_PIN_N))
-        ;
+        return ;
+    }
 
-    TCCR2B = 0;
+    if ((int32_t)(now - sched.quiet_at) < 0)
+        return ;
 
-    uint16_t orig_overflow = overflow_count;
-    uint16_t orig_count = TCNT2;
-    uint16_t count = orig_count + overflow_count * 256;
+    /* On a shared echo line, one still high from the last ping would be
+     * taken for this one's rise. Wait for it to drop */
+    if (ULTRASONIC_ECHO_PIN & pgm_read_byte(&descs[sched.next].echo_mask))
+        return ;
 
-    double us = ((double)count * 128) / TICKS_PER_US;
+    start(sched.next);
 
-    double distance = us / 58.0;
+    if (++sched.next == ULTRASONIC_SENSORS)
+        sched.next = 0;
+}
+
+void ultrasonic_tick(void)
+{
+    uint32_t now;
+    uint8_t i;
+
+    ultrasonic_poll();
 
-    char usbuf[30];
-    char buf[30];
+    now = clock_micros();
+    if ((int32_t)(now - sched.report_at) < 0)
+        return ;
 
-    dtostrf(distance, 3, 3, buf);
-    dtostrf(us, 3, 3, usbuf);
+    sched.report_at += ULTRASONIC_REPORT_US;
+    if ((int32_t)(now - sched.report_at) >= 0)
+        sched.report_at = now + ULTRASONIC_REPORT_US;
 
-    fprintf(serial_out, "ult:%d:%d:%s:%s\n", orig_overflow, count, usbuf, buf);
+    for (i = 0; i < ULTRASONIC_SENSORS; i++) {
+        struct sensor_state *s = sensors + i;
 
-    return 0;
+        fprintf(serial_out, "ult:%u:%u:%u:%u\n", i, s->readings, s->dropped, s->cm);
+
+        s->readings = 0;
+        s->dropped = 0;
+    }
 }
 
+uint8_t ultrasonic_read(uint8_t sensor, uint32_t since, uint16_t *cm)
+{
+    struct sensor_state *s = sensors + sensor;
+
+    if (!s->finished || (int32_t)(s->ping_at - since) < 0)
+        return 0;
+
+    *cm = s->cm;
+    return 1;
+}
+
+uint16_t ultrasonic_distance(uint8_t sensor)
+{
+    return sensors[sensor].cm;
+}
+
+uint32_t ultrasonic_last_reading_time(uint8_t sensor)
+{
+    return sensors[sensor].reading_at;
+}
@@ -0,0 +1,297 @@
+
+#include "common.h"
+#include "twi_master.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "clock.h"
+#include "wii_ext.h"
+
+#define WIIMOTE_EXTENSION_ADDRESS 0x52
+
+#define WII_EXT_REG_FORMAT 0xFE
+#define WII_EXT_REG_ID     0xFA
+
+/* Classic controllers report byte 4 of their ID as the data format */
+#define WII_EXT_ID_FORMAT 4
+#define WII_EXT_FORMAT_HIRES 0x03
+
+#define WII_EXT_REPORT_MAX 8
+
+/*
+ * Each controller and data format has a decoder: a list of pieces, each
+ * taking a few bits of one report byte to a place in one field. Decoding is
+ * the same shift, mask and OR for every piece, so the layouts are all data.
+ *
+ * The fields are the sticks, then the triggers, then the buttons. Fields
+ * start out at the decoder's resting value, and the sticks and triggers
+ * are then shifted up to 8 bits. Stick fields are unsigned, centered at
+ * 128 once at 8 bits.
+ */
+enum wii_ext_field {
+    FIELD_TRIGGERS = WII_EXT_STICKS,
+    FIELD_BUTTONS = FIELD_TRIGGERS + WII_EXT_TRIGGERS,
+
+    FIELDS,
+};
+
+/* Bits 'mask' of report byte 'byte', after shifting it right by 'shift',
+ * go to bit 'at' of 'field' */
+struct wii_ext_piece {
+    uint8_t field;
+    uint8_t byte;
+    uint8_t shift;
+    uint8_t mask;
+    uint8_t at;
+};
+
+struct wii_ext_decoder {
+    const struct wii_ext_piece *pieces;
+    uint8_t pieces_len;
+    uint8_t report_len;
+
+    /* For the sticks and triggers: what a field without pieces reads, and
+     * the shift up to 8 bits */
+    uint8_t rest[FIELD_BUTTONS];
+    uint8_t scale[FIELD_BUTTONS];
+
+    /* The buttons it has. The rest read as released */
+    uint16_t buttons;
+};
+
+/*
+ * Classic Controller, standard format. The left stick has 6 bits, the right
+ * stick and the triggers 5, spread over the first four bytes:
+ *
+ *   0: RX 4-3 | LX 5-0
+ *   1: RX 2-1 | LY 5-0
+ *   2: RX 0   | LT 4-3 | RY 4-0
+ *   3: LT 2-0 | RT 4-0
+ */
+static const struct wii_ext_piece classic_pieces[] PROGMEM = {
+    { WII_EXT_LX, 0, 0, 0x3F, 0 },
+    { WII_EXT_LY, 1, 0, 0x3F, 0 },
+    { WII_EXT_RX, 0, 6, 0x03, 3 },
+    { WII_EXT_RX, 1, 6, 0x03, 1 },
+    { WII_EXT_RX, 2, 7, 0x01, 0 },
+    { WII_EXT_RY, 2, 0, 0x1F, 0 },
+    { FIELD_TRIGGERS + WII_EXT_LT, 2, 5, 0x03, 3 },
+    { FIELD_TRIGGERS + WII_EXT_LT, 3, 5, 0x07, 0 },
+    { FIELD_TRIGGERS + WII_EXT_RT, 3, 0, 0x1F, 0 },
+    { FIELD_BUTTONS, 4, 0, 0xFF, 0 },
+    { FIELD_BUTTONS, 5, 0, 0xFF, 8 },
+};
+
+/* Classic Controller, high resolution format. A byte each for LX, RX, LY,
+ * RY, LT and RT, then the buttons */
+static const struct wii_ext_piece classic_hires_pieces[] PROGMEM = {
+    { WII_EXT_LX, 0, 0, 0xFF, 0 },
+    { WII_EXT_RX, 1, 0, 0xFF, 0 },
+    { WII_EXT_LY, 2, 0, 0xFF, 0 },
+    { WII_EXT_RY, 3, 0, 0xFF, 0 },
+    { FIELD_TRIGGERS + WII_EXT_LT, 4, 0, 0xFF, 0 },
+    { FIELD_TRIGGERS + WII_EXT_RT, 5, 0, 0xFF, 0 },
+    { FIELD_BUTTONS, 6, 0, 0xFF, 0 },
+    { FIELD_BUTTONS, 7, 0, 0xFF, 8 },
+};
+
+/* Nunchuk. A byte each for the stick, the accelerometer, and C and Z in
+ * bits 1 and 0 of byte 5 */
+static const struct wii_ext_piece nunchuk_pieces[] PROGMEM = {
+    { WII_EXT_LX, 0, 0, 0xFF, 0 },
+    { WII_EXT_LY, 1, 0, 0xFF, 0 },
+    { FIELD_BUTTONS, 5, 1, 0x01, 12 },
+    { FIELD_BUTTONS, 5, 0, 0x01, 14 },
+};
+
+static const struct wii_ext_decoder classic PROGMEM = {
+    .pieces = classic_pieces,
+    .pieces_len = ARRAY_SIZE(classic_pieces),
+    .report_len = 6,
+    .scale = { 2, 2, 3, 3, 3, 3 },
+    .buttons = WII_BUTTONS_ALL,
+};
+
+static const struct wii_ext_decoder classic_hires PROGMEM = {
+    .pieces = classic_hires_pieces,
+    .pieces_len = ARRAY_SIZE(classic_hires_pieces),
+    .report_len = 8,
+    .buttons = WII_BUTTONS_ALL,
+};
+
+static const struct wii_ext_decoder nunchuk PROGMEM = {
+    .pieces = nunchuk_pieces,
+    .pieces_len = ARRAY_SIZE(nunchuk_pieces),
+    .report_len = 6,
+    .rest = { 0, 0, 128, 128 },
+    .buttons = WII_BUTTON_C | WII_BUTTON_Z,
+};
+
+/*
+ * Known controllers, by ID. Byte 4 of a classic controller's ID is its data
+ * format, so it isn't compared. The SNES Classic has the Classic Controller
+ * Pro's ID.
+ */
+struct wii_ext_type {
+    uint8_t id[6];
+    const char *name;
+
+    const struct wii_ext_decoder *decoder;
+
+    /* NULL if it has no high resolution format */
+    const struct wii_ext_decoder *hires;
+};
+
+static const char name_nunchuk[] PROGMEM = "Nunchuk";
+static const char name_classic[] PROGMEM = "Classic Controller";
+static const char name_classic_pro[] PROGMEM = "Classic Controller Pro/SNES Classic";
+
+static const struct wii_ext_type types[] PROGMEM = {
+    { { 0x00, 0x00, 0xA4, 0x20, 0x00, 0x00 }, name_nunchuk, &nunchuk, NULL },
+    { { 0x00, 0x00, 0xA4, 0x20, 0x01, 0x01 }, name_classic, &classic, &classic_hires },
+    { { 0x01, 0x00, 0xA4, 0x20, 0x01, 0x01 }, name_classic_pro, &classic, &classic_hires },
+};
+
+/* Decoder of the controller found, copied out of flash */
+static struct wii_ext_decoder decoder;
+
+static uint8_t read_id(uint8_t *id)
+{
+    uint8_t reg = WII_EXT_REG_ID;
+    uint8_t result = twi_write_data(WIIMOTE_EXTENSION_ADDRESS, &reg, 1);
+
+    if (result)
+        return result;
+
+    /* Classic controllers need a small delay before responding to reads */
+    _delay_ms(1);
+
+    return twi_read_data(WIIMOTE_EXTENSION_ADDRESS, id, 6);
+}
+
+static const struct wii_ext_type *find_type(const uint8_t *id)
+{
+    uint8_t i, j;
+
+    for (i = 0; i < ARRAY_SIZE(types); i++) {
+        for (j = 0; j < 6; j++) {
+            if (j != WII_EXT_ID_FORMAT && id[j] != pgm_read_byte(&types[i].id[j]))
+                break;
+        }
+
+        if (j == 6)
+            return types + i;
+    }
+
+    return NULL;
+}
+
+int wii_ext_init(void)
+{
+    unsigned char buf[6];
+    const struct wii_ext_type *type;
+    const struct wii_ext_decoder *hires;
+
+    /* These first two writes turn of the "encryption" that Nintendo used for Wii extensions */
+
+    buf[0] = 0x55;
+
+    uint8_t result = twi_write_reg_data(WIIMOTE_EXTENSION_ADDRESS, 0xF0, buf, 1);
+
+    printf("First write, result: %d\n", result);
+
+    buf[0] = 0x00;
+
+    result = twi_write_reg_data(WIIMOTE_EXTENSION_ADDRESS, 0xFB, buf, 1);
+
+    printf("Second write, result: %d\n", result);
+    printf("Reading device identifier...\n");
+
+    result = read_id(buf);
+    if (result) {
+        printf("Identifier read failed, result: %d\n", result);
+        return 1;
+    }
+
+    printf("Identifier: 0x%02x:0x%02x:0x%02x:0x%02x:0x%02x:0x%02x\n",
+            buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+
+    type = find_type(buf);
+    if (!type)
+        return 1;
+
+    memcpy_P(&decoder, pgm_read_ptr(&type->decoder), sizeof(decoder));
+
+    /* The controller only takes the format if it has it, and says so in
+     * its ID. Otherwise the standard one stays */
+    hires = pgm_read_ptr(&type->hires);
+    if (hires) {
+        buf[0] = WII_EXT_FORMAT_HIRES;
+
+        if (!twi_write_reg_data(WIIMOTE_EXTENSION_ADDRESS, WII_EXT_REG_FORMAT, buf, 1)
+            && !read_id(buf) && buf[WII_EXT_ID_FORMAT] == WII_EXT_FORMAT_HIRES)
+            memcpy_P(&decoder, hires, sizeof(decoder));
+    }
+
+    printf_P(PSTR("%S controller setup, %u byte reports\n"),
+             (const char *)pgm_read_ptr(&type->name), decoder.report_len);
+
+    return 0;
+}
+
+/* Decodes a report from the controller, with the decoder in 'd' */
+static void wii_ext_decode(const struct wii_ext_decoder *d, struct wii_ext_state *state,
+                           const unsigned char *buf)
+{
+    uint16_t field[FIELDS];
+    uint8_t i;
+
+    for (i = 0; i < FIELD_BUTTONS; i++)
+        field[i] = d->rest[i];
+    field[FIELD_BUTTONS] = 0;
+
+    for (i = 0; i < d->pieces_len; i++) {
+        struct wii_ext_piece p;
+
+        memcpy_P(&p, d->pieces + i, sizeof(p));
+
+        field[p.field] |= (uint16_t)((buf[p.byte] >> p.shift) & p.mask) << p.at;
+    }
+
+    for (i = 0; i < WII_EXT_STICKS; i++)
+        state->stick[i] = (uint8_t)(field[i] << d->scale[i]) - 128;
+
+    for (i = 0; i < WII_EXT_TRIGGERS; i++)
+        state->trigger[i] = field[FIELD_TRIGGERS + i] << d->scale[FIELD_TRIGGERS + i];
+
+    /* Active-low */
+    state->buttons = ~field[FIELD_BUTTONS] & d->buttons;
+}
+
+int wii_ext_read_state(struct wii_ext_state *state)
+{
+    memset(state, 0, sizeof(*state));
+    unsigned char buf[WII_EXT_REPORT_MAX];
+    uint8_t result;
+
+    buf[0] = 0x00;
+
+    result = twi_write_data(WIIMOTE_EXTENSION_ADDRESS, buf, 1);
+    if (!result) {
+        /* Classic controllers need a small delay before responding to reads */
+        _delay_ms(1);
+
+        result = twi_read_data(WIIMOTE_EXTENSION_ADDRESS, buf, decoder.report_len);
+    }
+
+    /* A failed read releases every button, which is an input too */
+    state->stamp = clock_stamp();
+    if (result)
+        return result;
+
+    wii_ext_decode(&decoder, state, buf);
+
+    return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * Checks for src/imu.c, built for the host against a scripted TWI bus and a
+ * clock that only moves when told to.
+ *
+ * Each check queues the transfers the IMU driver should make, in order,
+ * with what the fake device answers. A transfer that isn't the next one
+ * queued, or one left over at the end of a check, is a failure. Any failure
+ * is printed and exits non-zero.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "twi_master.h"
+#include "clock.h"
+#include "car_state.h"
+#include "imu.h"
+
+#define IMU_ADDRESS 0x68
+
+#define REG_CONFIG      0x1A
+#define REG_GYRO_CONFIG 0x1B
+#define REG_GYRO_XOUT_H 0x43
+#define REG_PWR_MGMT_1  0x6B
+#define REG_WHO_AM_I    0x75
+
+#define CALIBRATION_SAMPLES 32
+
+#define SCRIPT_MAX 256
+
+/* A transfer the driver should make next. Reads get 'data' back, writes
+ * must send it */
+struct twi_step {
+    uint8_t write;
+    uint8_t reg;
+    uint8_t status;
+    uint8_t len;
+    uint8_t data[6];
+};
+
+static struct twi_step script[SCRIPT_MAX];
+static int script_len, script_pos;
+
+static uint32_t now_us;
+static int failed;
+
+#define CHECK(cond, ...) do {                   \
+    if (!(cond)) {                              \
+        fprintf(stderr, "FAIL: " __VA_ARGS__);  \
+        fprintf(stderr, "\n");                  \
+        failed = 1;                             \
+    }                                           \
+} while (0)
+
+static void expect(uint8_t write, uint8_t reg, uint8_t status,
+                   const uint8_t *data, uint8_t len)
+{
+    struct twi_step *s;
+
+    /* Reuse the room of transfers already made */
+    if (script_pos == script_len)
+        script_pos = script_len = 0;
+
+    s = script + script_len++;
+    if (script_len > SCRIPT_MAX) {
+        fprintf(stderr, "script too long\n");
+        exit(1);
+    }
+
+    s->write = write;
+    s->reg = reg;
+    s->status = status;
+    s->len = len;
+    memcpy(s->data, data, len);
+}
+
+static void expect_write(uint8_t reg, uint8_t value)
+{
+    expect(1, reg, TWI_OK, &value, 1);
+}
+
+/* A burst read of the three gyro axes. X and Y are junk the driver must
+ * ignore */
+static void expect_gyro(int16_t z, uint8_t status)
+{
+    uint8_t buf[6] = { 0x7f, 0xff, 0x80, 0x01, (uint16_t)z >> 8, z & 0xff };
+
+    expect(0, REG_GYRO_XOUT_H, status, buf, sizeof(buf));
+}
+
+/* Everything queued must have been used */
+static void script_done(const char *check)
+{
+    CHECK(script_pos == script_len, "%s: %d of %d transfers made",
+          check, script_pos, script_len);
+
+    script_len = 0;
+    script_pos = 0;
+}
+
+static const struct twi_step *next_step(uint8_t write, uint8_t address, uint8_t reg,
+                                        uint8_t count)
+{
+    const struct twi_step *s = script + script_pos;
+
+    if (script_pos == script_len || s->write != write || address != IMU_ADDRESS
+        || s->reg != reg || s->len != count) {
+        fprintf(stderr, "FAIL: unexpected %s of %u bytes at 0x%02x:0x%02x\n",
+                write ? "write" : "read", count, address, reg);
+        exit(1);
+    }
+
+    script_pos++;
+
+    return s;
+}
+
+uint8_t twi_read_reg_data(uint8_t address, uint8_t reg, uint8_t *data, uint8_t count)
+{
+    const struct twi_step *s = next_step(0, address, reg, count);
+
+    if (!s->status)
+        memcpy(data, s->data, count);
+
+    return s->status;
+}
+
+uint8_t twi_write_reg_data(uint8_t address, uint8_t reg, const uint8_t *data, uint8_t count)
+{
+    const struct twi_step *s = next_step(1, address, reg, count);
+
+    CHECK(!memcmp(data, s->data, count), "wrote 0x%02x to 0x%02x, expected 0x%02x",
+          data[0], reg, s->data[0]);
+
+    return s->status;
+}
+
+uint32_t clock_micros(void)
+{
+    return now_us;
+}
+
+void car_state_motor_trim_set(struct car_state *car, int8_t trim)
+{
+    car->motor_trim = trim;
+}
+
+static void expect_init(void)
+{
+    uint8_t who_am_i = 0x68;
+
+    expect(0, REG_WHO_AM_I, TWI_OK, &who_am_i, 1);
+    expect_write(REG_PWR_MGMT_1, 1);
+    expect_write(REG_CONFIG, 3);
+    expect_write(REG_GYRO_CONFIG, 0);
+}
+
+/* Runs 'n' updates 'dt_us' apart, with the gyro reading 'rate' */
+static void rotate(int16_t rate, uint32_t dt_us, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        expect_gyro(rate, TWI_OK);
+        now_us += dt_us;
+        imu_update();
+    }
+}
+
+static void check_init(void)
+{
+    uint8_t other = 0x70;
+
+    expect(0, REG_WHO_AM_I, TWI_ADDR_NACK, &other, 1);
+    CHECK(imu_init() && !imu_present(), "init with nothing on the bus");
+    script_done("no device");
+
+    expect(0, REG_WHO_AM_I, TWI_OK, &other, 1);
+    CHECK(imu_init() && !imu_present(), "init with another device");
+    script_done("other device");
+
+    /* Updates before an init that found one touch nothing */
+    imu_update();
+    script_done("no device update");
+}
+
+/* Calibrates to a bias of -20, which the checks after this rely on */
+static void check_calibration(void)
+{
+    int i;
+
+    expect_init();
+    CHECK(!imu_init(), "init");
+    script_done("init");
+
+    /* A failed read isn't a sample */
+    expect_gyro(0, TWI_TIMEOUT);
+    imu_update();
+
+    for (i = 0; i < CALIBRATION_SAMPLES; i++) {
+        CHECK(!imu_present(), "present after %d samples", i);
+        expect_gyro(i & 1 ? -19 : -21, TWI_OK);
+        imu_update();
+    }
+
+    CHECK(imu_present(), "not present after calibrating");
+    CHECK(imu_yaw() == 0, "yaw %ld after calibrating", (long)imu_yaw());
+    script_done("calibration");
+}
+
+static void check_yaw(void)
+{
+    int32_t yaw;
+
+    /* One degree per second, net of the bias, for a second */
+    rotate(-20 + 131, 10000, 100);
+    CHECK(imu_yaw() == IMU_YAW_UNITS_PER_DEG, "yaw %ld after 1 degree left",
+          (long)imu_yaw());
+
+    /* Negative rates sign extend */
+    rotate(-20 - 262, 10000, 50);
+    CHECK(imu_yaw() == 0, "yaw %ld after 1 degree back", (long)imu_yaw());
+    script_done("yaw");
+
+    /* The reading after a failed one covers the time since the last good
+     * one */
+    expect_gyro(0, TWI_DATA_NACK);
+    now_us += 10000;
+    imu_update();
+    rotate(-20 + 131, 10000, 1);
+    CHECK(imu_yaw() == 2 * 1310, "yaw %ld after a failed read", (long)imu_yaw());
+
+    /* A long gap counts as IMU_MAX_DT_US */
+    yaw = imu_yaw();
+    rotate(-20 + 131, 200000, 1);
+    CHECK(imu_yaw() - yaw == 131 * 50, "yaw grew %ld over a 200ms gap",
+          (long)(imu_yaw() - yaw));
+
+    /* Across a wrap of the clock. The jump to just before it is another
+     * long gap, with no rotation */
+    yaw = imu_yaw();
+    now_us = 0xffffffffUL - 5000;
+    rotate(-20, 0, 1);
+    rotate(-20 + 131, 10000, 1);
+    CHECK(imu_yaw() - yaw == 1310, "yaw grew %ld across a clock wrap",
+          (long)(imu_yaw() - yaw));
+    script_done("yaw gaps");
+}
+
+static void check_heading_hold(void)
+{
+    struct car_state car;
+
+    memset(&car, 0, sizeof(car));
+    car.motor_left = MOTOR_FOR;
+    car.motor_right = MOTOR_FOR;
+    car.motor_left_speed = 150;
+    car.motor_right_speed = 150;
+
+    /* The heading when it starts going straight is the one held */
+    rotate(-20 + 131, 10000, 100);
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == 0, "trim %d when starting to hold", car.motor_trim);
+
+    /* Drifting left speeds up the left motor, by 4 steps per degree */
+    rotate(-20 + 131, 10000, 100);
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == 3, "trim %d at 1 degree left", car.motor_trim);
+
+    rotate(-20 - 131, 10000, 200);
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == -4, "trim %d at 1 degree right", car.motor_trim);
+
+    /* 10 degrees is past the limit either way */
+    rotate(-20 + 13100, 50000, 5);
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == 40, "trim %d at 24 degrees left", car.motor_trim);
+
+    rotate(-20 - 13100, 50000, 8);
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == -40, "trim %d at 16 degrees right", car.motor_trim);
+
+    /* Anything but straight forward clears the trim, and going straight
+     * again holds the new heading */
+    car.motor_right_speed = 100;
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == 0, "trim %d while turning", car.motor_trim);
+
+    car.motor_right_speed = 150;
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == 0, "trim %d after turning", car.motor_trim);
+
+    car.motor_right = MOTOR_BACK;
+    rotate(-20 + 13100, 50000, 1);
+    imu_heading_hold(&car);
+    CHECK(car.motor_trim == 0, "trim %d while pivoting", car.motor_trim);
+    script_done("heading hold");
+}
+
+int main(void)
+{
+    check_init();
+    check_calibration();
+    check_yaw();
+    check_heading_hold();
+
+    if (failed)
+        return 1;
+
+    printf("imu ok\n");
+
+    return 0;
+}
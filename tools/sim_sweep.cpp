@@ -0,0 +1,462 @@
+/*
+ * Parameter sweep over the host simulator.
+ *
+ * Runs sim/car_sim many times in parallel, each with a different set of
+ * tuning parameters (see tune.h), scores every run and prints them ranked
+ * best first. The parameter sets are either every combination of a grid,
+ * or random picks from the ranges.
+ *
+ * Each run is its own car_sim process, since the firmware modules keep
+ * their state in globals. Runs share nothing, so with one worker per core
+ * the throughput goes up with the core count.
+ *
+ * A run's score is a weighted sum, lower is better:
+ *
+ *   collisions * C + stalls * S + time to goal * G + motor charge (mAh) * E
+ *
+ * A run that never reaches the goal counts twice the run length as its time
+ * to goal. Maps without a goal leave that term out.
+ *
+ * Usage:
+ *   sim_sweep [options] -p <name>=<lo>:<hi>[:<step>]... <map>
+ *
+ *   -p <name>=<lo>:<hi>[:<step>]  Parameter to vary, can be repeated. A grid
+ *                                 goes in steps of <step> (default 1)
+ *   -n <runs>                     Random search with this many runs, instead
+ *                                 of the grid
+ *   -S <seed>                     Random search seed (default 1)
+ *   -j <jobs>                     Runs at a time (default: number of cores)
+ *   -m auto|line|drive, -T <s>, -B <mV>
+ *                                 Passed on to car_sim
+ *   -w <C>,<S>,<G>,<E>            Score weights (default 100,50,1,1)
+ *   -k <count>                    How many of the best runs to print
+ *                                 (default 10, 0 for all)
+ *   -o <file>                     Also write every run as CSV
+ *   -x <path>                     car_sim to run (default ./sim/car_sim)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+/* Stops a typo in a grid from queueing up runs for a week */
+constexpr size_t MAX_RUNS = 100000;
+
+struct Param {
+    std::string name;
+    int lo, hi, step;
+};
+
+struct Result {
+    std::vector<int> values;
+
+    bool ok = false;
+    double collisions = 0;
+    double stalls = 0;
+    double goal_s = -1;
+    double charge_mah = 0;
+    double distance_cm = 0;
+    double min_clearance_cm = 0;
+    double score = 0;
+};
+
+struct Weights {
+    double collisions = 100, stalls = 50, goal = 1, charge = 1;
+};
+
+struct Options {
+    std::string sim = "./sim/car_sim";
+    std::string map;
+    std::string mode = "auto";
+    std::string seconds = "60";
+    std::string battery_mv;
+};
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n runs] [-S seed] [-j jobs] [-m mode] [-T seconds] [-B mV] "
+            "[-w C,S,G,E] [-k count] [-o results.csv] [-x car_sim] "
+            "-p name=lo:hi[:step]... <map>\n", prog);
+    exit(2);
+}
+
+bool parse_param(const char *arg, Param &p)
+{
+    const char *eq = strchr(arg, '=');
+    if (!eq || eq == arg)
+        return false;
+
+    p.name.assign(arg, eq - arg);
+    p.step = 1;
+
+    int n = sscanf(eq + 1, "%d:%d:%d", &p.lo, &p.hi, &p.step);
+    return n >= 2 && p.lo <= p.hi && p.step > 0;
+}
+
+/* Every combination, the last parameter changing fastest */
+std::vector<Result> grid(const std::vector<Param> &params)
+{
+    std::vector<Result> runs;
+    std::vector<int> values;
+
+    for (auto &p : params)
+        values.push_back(p.lo);
+
+    while (1) {
+        if (runs.size() == MAX_RUNS) {
+            fprintf(stderr, "grid has more than %zu runs\n", MAX_RUNS);
+            exit(2);
+        }
+
+        runs.push_back(Result{values});
+
+        size_t i = params.size();
+        while (i > 0) {
+            i--;
+            values[i] += params[i].step;
+            if (values[i] <= params[i].hi)
+                break;
+            values[i] = params[i].lo;
+            if (i == 0)
+                return runs;
+        }
+
+        if (params.empty())
+            return runs;
+    }
+}
+
+std::vector<Result> random_search(const std::vector<Param> &params, size_t count, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<Result> runs(count);
+
+    for (auto &r : runs)
+        for (auto &p : params)
+            r.values.push_back(std::uniform_int_distribution<int>(p.lo, p.hi)(rng));
+
+    return runs;
+}
+
+/* Picks "key": <number> out of car_sim's summary */
+bool summary_value(const std::string &summary, const char *key, double &value)
+{
+    std::string needle = std::string("\"") + key + "\":";
+    size_t at = summary.find(needle);
+    if (at == std::string::npos)
+        return false;
+
+    char *end;
+    value = strtod(summary.c_str() + at + needle.size(), &end);
+    return end != summary.c_str() + at + needle.size();
+}
+
+/* Runs car_sim with the run's parameters and collects its summary */
+void run_one(const Options &opts, const std::vector<Param> &params, Result &r)
+{
+    std::vector<std::string> args = { opts.sim, "-g", "-m", opts.mode, "-T", opts.seconds };
+    if (!opts.battery_mv.empty()) {
+        args.push_back("-B");
+        args.push_back(opts.battery_mv);
+    }
+    for (size_t i = 0; i < params.size(); i++) {
+        args.push_back("-t");
+        args.push_back(params[i].name + "=" + std::to_string(r.values[i]));
+    }
+    args.push_back(opts.map);
+
+    std::vector<char *> argv;
+    for (auto &a : args)
+        argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+
+    /* Close-on-exec, so runs started by the other workers don't hold this
+     * pipe open. The dup2() onto stdout clears it for this run's end */
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) < 0)
+        return;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+
+    if (err) {
+        close(out[0]);
+        return;
+    }
+
+    std::string summary;
+    char buf[512];
+    ssize_t len;
+    while ((len = read(out[0], buf, sizeof(buf))) != 0) {
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        summary.append(buf, len);
+    }
+    close(out[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+
+    r.ok = summary_value(summary, "collisions", r.collisions)
+        && summary_value(summary, "stalls", r.stalls)
+        && summary_value(summary, "goal_s", r.goal_s)
+        && summary_value(summary, "charge_mah", r.charge_mah)
+        && summary_value(summary, "distance_cm", r.distance_cm)
+        && summary_value(summary, "min_clearance_cm", r.min_clearance_cm);
+}
+
+void score(Result &r, const Weights &w, double seconds, bool has_goal)
+{
+    if (!r.ok)
+        return;
+
+    r.score = r.collisions * w.collisions + r.stalls * w.stalls + r.charge_mah * w.charge;
+
+    if (has_goal)
+        r.score += (r.goal_s < 0 ? seconds * 2 : r.goal_s) * w.goal;
+}
+
+void print_text(FILE *out, const std::vector<Param> &params, const std::vector<Result> &runs,
+                size_t count)
+{
+    fprintf(out, "%4s %9s", "rank", "score");
+    for (auto &p : params)
+        fprintf(out, " %8s", p.name.c_str());
+    fprintf(out, " %10s %6s %8s %10s %11s %9s\n",
+            "collisions", "stalls", "goal_s", "charge_mah", "distance_cm", "clearance");
+
+    for (size_t i = 0; i < count; i++) {
+        const Result &r = runs[i];
+
+        fprintf(out, "%4zu", i + 1);
+        if (r.ok)
+            fprintf(out, " %9.2f", r.score);
+        else
+            fprintf(out, " %9s", "failed");
+        for (int v : r.values)
+            fprintf(out, " %8d", v);
+        if (r.ok)
+            fprintf(out, " %10.0f %6.0f %8.3f %10.2f %11.1f %9.1f", r.collisions, r.stalls,
+                    r.goal_s, r.charge_mah, r.distance_cm, r.min_clearance_cm);
+        fprintf(out, "\n");
+    }
+}
+
+void print_csv(FILE *out, const std::vector<Param> &params, const std::vector<Result> &runs)
+{
+    fprintf(out, "rank,score");
+    for (auto &p : params)
+        fprintf(out, ",%s", p.name.c_str());
+    fprintf(out, ",collisions,stalls,goal_s,charge_mah,distance_cm,min_clearance_cm\n");
+
+    for (size_t i = 0; i < runs.size(); i++) {
+        const Result &r = runs[i];
+
+        fprintf(out, "%zu,", i + 1);
+        if (r.ok)
+            fprintf(out, "%.2f", r.score);
+        for (int v : r.values)
+            fprintf(out, ",%d", v);
+        if (r.ok)
+            fprintf(out, ",%.0f,%.0f,%.3f,%.2f,%.1f,%.1f", r.collisions, r.stalls, r.goal_s,
+                    r.charge_mah, r.distance_cm, r.min_clearance_cm);
+        else
+            fprintf(out, ",,,,,,");
+        fprintf(out, "\n");
+    }
+}
+
+bool map_has_goal(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+        return false;
+
+    char buf[256], kind[16];
+    bool goal = false;
+    while (!goal && fgets(buf, sizeof(buf), f))
+        goal = sscanf(buf, "%15s", kind) == 1 && strcmp(kind, "goal") == 0;
+
+    fclose(f);
+    return goal;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    Weights weights;
+    std::vector<Param> params;
+    size_t random_runs = 0;
+    unsigned seed = 1;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    size_t top = 10;
+    const char *csv_path = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:n:S:j:m:T:B:w:k:o:x:")) != -1) {
+        switch (opt) {
+        case 'p': {
+            Param p;
+            if (!parse_param(optarg, p))
+                usage(argv[0]);
+            params.push_back(p);
+            break;
+        }
+
+        case 'n':
+            random_runs = strtoul(optarg, nullptr, 10);
+            break;
+
+        case 'S':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+
+        case 'j':
+            jobs = strtoul(optarg, nullptr, 10);
+            if (!jobs)
+                usage(argv[0]);
+            break;
+
+        case 'm':
+            opts.mode = optarg;
+            break;
+
+        case 'T':
+            opts.seconds = optarg;
+            break;
+
+        case 'B':
+            opts.battery_mv = optarg;
+            break;
+
+        case 'w':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &weights.collisions, &weights.stalls,
+                       &weights.goal, &weights.charge) != 4)
+                usage(argv[0]);
+            break;
+
+        case 'k':
+            top = strtoul(optarg, nullptr, 10);
+            break;
+
+        case 'o':
+            csv_path = optarg;
+            break;
+
+        case 'x':
+            opts.sim = optarg;
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc || params.empty())
+        usage(argv[0]);
+
+    opts.map = argv[optind];
+
+    if (access(opts.sim.c_str(), X_OK) < 0) {
+        fprintf(stderr, "%s: %s\n", opts.sim.c_str(), strerror(errno));
+        return 1;
+    }
+
+    std::vector<Result> runs = random_runs ? random_search(params, random_runs, seed)
+                                           : grid(params);
+
+    /* Workers take the next run off a shared counter, so a slow run only
+     * holds up its own worker */
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> done(0);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+
+    jobs = std::min<size_t>(jobs, runs.size());
+    for (unsigned i = 0; i < jobs; i++) {
+        workers.emplace_back([&]() {
+            size_t n;
+            while ((n = next++) < runs.size()) {
+                run_one(opts, params, runs[n]);
+
+                size_t d = ++done;
+                if (isatty(STDERR_FILENO))
+                    fprintf(stderr, "\r%zu/%zu", d, runs.size());
+            }
+        });
+    }
+
+    for (auto &w : workers)
+        w.join();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double seconds = strtod(opts.seconds.c_str(), nullptr);
+    bool has_goal = map_has_goal(opts.map);
+    size_t failed = 0;
+
+    for (auto &r : runs) {
+        score(r, weights, seconds, has_goal);
+        failed += !r.ok;
+    }
+
+    /* Failed runs go last */
+    std::stable_sort(runs.begin(), runs.end(), [](const Result &a, const Result &b) {
+        if (a.ok != b.ok)
+            return a.ok;
+        return a.score < b.score;
+    });
+
+    if (isatty(STDERR_FILENO))
+        fprintf(stderr, "\r");
+    fprintf(stderr, "sweep: %zu runs on %u jobs in %.2fs, %.1f runs/s", runs.size(), jobs, wall,
+            wall > 0 ? runs.size() / wall : 0);
+    if (failed)
+        fprintf(stderr, ", %zu failed", failed);
+    fprintf(stderr, "\n");
+
+    print_text(stdout, params, runs, top && top < runs.size() ? top : runs.size());
+
+    if (csv_path) {
+        FILE *csv = fopen(csv_path, "w");
+        if (!csv) {
+            fprintf(stderr, "%s: %s\n", csv_path, strerror(errno));
+            return 1;
+        }
+
+        print_csv(csv, params, runs);
+        fclose(csv);
+    }
+
+    return failed == runs.size();
+}
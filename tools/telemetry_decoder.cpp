@@ -0,0 +1,517 @@
+/*
+ * Host side decoder for the car's serial telemetry.
+ *
+ * Reads the serial output of the car from a capture file, stdin ('-') or a
+ * serial device / pty, decodes the text telemetry lines and the binary
+ * frames from telemetry.h, and prints summary statistics as CSV or JSON:
+ *
+ *   - Update rate and dropped echoes per ultrasonic sensor, from the 'ult:'
+ *     lines
+ *   - Control loop period distribution, from the tick frames
+ *   - Input-to-actuation latency per input source, from the latency frames
+ *
+ * The text lines carry no timestamp of their own, so they are stamped with
+ * the firmware time of the most recent tick frame. Without tick frames
+ * (the 'telem' tuning parameter is 0), a live device falls back to the host
+ * receive time, and a capture file only gets counts.
+ *
+ * Usage:
+ *   telemetry_decoder [-b baud] [-f csv|json] [-e events.csv] [-t seconds] <input>
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+extern "C" {
+#include "latency.h"
+#include "telemetry.h"
+}
+
+namespace {
+
+std::string source_name(uint8_t source)
+{
+    switch (source) {
+    case LATENCY_BT:   return "bt";
+    case LATENCY_SNES: return "snes";
+    }
+
+    return std::to_string(source);
+}
+
+struct Summary {
+    size_t count = 0;
+    double mean = 0;
+    uint32_t min = 0, p50 = 0, p90 = 0, p99 = 0, max = 0;
+};
+
+class Distribution {
+public:
+    void add(uint32_t v) { samples_.push_back(v); }
+    bool empty() const { return samples_.empty(); }
+
+    Summary summarize() const
+    {
+        Summary s;
+        if (samples_.empty())
+            return s;
+
+        std::vector<uint32_t> sorted(samples_);
+        std::sort(sorted.begin(), sorted.end());
+
+        double total = 0;
+        for (uint32_t v : sorted)
+            total += v;
+
+        auto pct = [&](double p) {
+            return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+        };
+
+        s.count = sorted.size();
+        s.mean = total / sorted.size();
+        s.min = sorted.front();
+        s.p50 = pct(0.50);
+        s.p90 = pct(0.90);
+        s.p99 = pct(0.99);
+        s.max = sorted.back();
+        return s;
+    }
+
+private:
+    std::vector<uint32_t> samples_;
+};
+
+class Decoder {
+public:
+    explicit Decoder(FILE *events) : events_(events)
+    {
+        if (events_)
+            fprintf(events_, "time_us,kind,fields\n");
+    }
+
+    /* 'host_us' is the receive time of the chunk, or a negative value if
+     * there is none (capture files) */
+    void feed(const uint8_t *buf, size_t len, int64_t host_us)
+    {
+        host_us_ = host_us;
+
+        for (size_t i = 0; i < len; i++)
+            feed_byte(buf[i]);
+    }
+
+    void print_csv(FILE *out) const;
+    void print_json(FILE *out) const;
+
+private:
+    enum class State { TEXT, TYPE, LEN, PAYLOAD, CHECK };
+
+    void feed_byte(uint8_t c)
+    {
+        switch (state_) {
+        case State::TEXT:
+            if (c == TELEMETRY_SYNC) {
+                state_ = State::TYPE;
+            } else if (c == '\n') {
+                handle_line();
+                line_.clear();
+            } else if (c != '\r') {
+                /* A line that long is noise, throw it away */
+                if (line_.size() < 256)
+                    line_.push_back(c);
+                else
+                    line_.clear();
+            }
+            break;
+
+        case State::TYPE:
+            frame_type_ = c;
+            check_ = c;
+            state_ = State::LEN;
+            break;
+
+        case State::LEN:
+            frame_len_ = c;
+            check_ ^= c;
+            payload_.clear();
+            state_ = frame_len_ ? State::PAYLOAD : State::CHECK;
+            break;
+
+        case State::PAYLOAD:
+            payload_.push_back(c);
+            check_ ^= c;
+            if (payload_.size() == frame_len_)
+                state_ = State::CHECK;
+            break;
+
+        case State::CHECK:
+            if (c == check_)
+                handle_frame();
+            else
+                bad_frames_++;
+            state_ = State::TEXT;
+            break;
+        }
+    }
+
+    static uint32_t get_u32(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static uint16_t get_u16(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    void handle_frame()
+    {
+        const uint8_t *p = payload_.data();
+
+        switch (frame_type_) {
+        case TELEMETRY_TICK:
+            if (frame_len_ != sizeof(struct telemetry_tick))
+                break;
+
+            handle_tick(get_u32(p), get_u16(p + 4));
+            return;
+
+        case TELEMETRY_LATENCY:
+            if (frame_len_ != sizeof(struct telemetry_latency))
+                break;
+
+            handle_latency(p[0], get_u32(p + 1), get_u32(p + 5));
+            return;
+        }
+
+        unknown_frames_++;
+    }
+
+    void handle_tick(uint32_t start_us, uint16_t work_us)
+    {
+        /* The firmware clock is 32-bit microseconds, so it wraps every ~71
+         * minutes. Unsigned subtraction takes care of that */
+        if (have_tick_) {
+            uint32_t period = start_us - last_tick_us_;
+            loop_period_.add(period);
+            fw_us_ += period;
+        }
+
+        have_tick_ = true;
+        last_tick_us_ = start_us;
+        loop_work_.add(work_us);
+        ticks_++;
+
+        event("tick", std::to_string(start_us) + ":" + std::to_string(work_us));
+    }
+
+    void handle_latency(uint8_t source, uint32_t input_us, uint32_t actuate_us)
+    {
+        latency_[source].add(actuate_us - input_us);
+        event("latency", source_name(source) + ":" + std::to_string(actuate_us - input_us));
+    }
+
+    /* Time of the current line or frame, or negative if unknown */
+    int64_t now_us() const
+    {
+        if (have_tick_)
+            return fw_us_;
+        return host_us_;
+    }
+
+    void handle_line()
+    {
+        if (line_.empty())
+            return;
+
+        size_t colon = line_.find(':');
+        std::string kind = line_.substr(0, colon);
+        std::string fields = colon == std::string::npos ? "" : line_.substr(colon + 1);
+
+        lines_[kind]++;
+
+        if (kind == "ult") {
+            /* ult:<sensor>:<readings>:<dropped>:<cm>, once a second */
+            unsigned sensor, readings, dropped;
+
+            if (sscanf(fields.c_str(), "%u:%u:%u:", &sensor, &readings, &dropped) == 3) {
+                UltStats &u = ult_[sensor];
+
+                u.reports++;
+                u.readings += readings;
+                u.dropped += dropped;
+            }
+        }
+
+        event(kind, fields);
+    }
+
+    void event(const std::string &kind, const std::string &fields)
+    {
+        if (!events_)
+            return;
+
+        int64_t t = now_us();
+        if (t >= 0)
+            fprintf(events_, "%" PRId64 ",%s,%s\n", t, kind.c_str(), fields.c_str());
+        else
+            fprintf(events_, ",%s,%s\n", kind.c_str(), fields.c_str());
+    }
+
+    struct UltStats {
+        uint64_t reports = 0, readings = 0, dropped = 0;
+
+        /* Each report covers one second */
+        double rate_hz() const { return reports ? (double)readings / reports : 0; }
+    };
+
+    FILE *events_;
+    int64_t host_us_ = -1;
+
+    State state_ = State::TEXT;
+    std::string line_;
+    uint8_t frame_type_ = 0, frame_len_ = 0, check_ = 0;
+    std::vector<uint8_t> payload_;
+    uint64_t bad_frames_ = 0, unknown_frames_ = 0;
+
+    /* Firmware time, rebuilt from the tick frames so it doesn't wrap */
+    bool have_tick_ = false;
+    uint32_t last_tick_us_ = 0;
+    int64_t fw_us_ = 0;
+    uint64_t ticks_ = 0;
+    Distribution loop_period_, loop_work_;
+
+    std::map<unsigned, UltStats> ult_;
+
+    std::map<uint8_t, Distribution> latency_;
+    std::map<std::string, uint64_t> lines_;
+};
+
+void print_summary_csv(FILE *out, const char *name, const Distribution &d)
+{
+    Summary s = d.summarize();
+
+    fprintf(out, "%s,%zu,%.1f,%u,%u,%u,%u,%u\n", name, s.count, s.mean,
+            s.min, s.p50, s.p90, s.p99, s.max);
+}
+
+void Decoder::print_csv(FILE *out) const
+{
+    fprintf(out, "metric,count,mean_us,min_us,p50_us,p90_us,p99_us,max_us\n");
+    print_summary_csv(out, "loop_period", loop_period_);
+    print_summary_csv(out, "loop_work", loop_work_);
+
+    for (auto &l : latency_) {
+        std::string name = "latency_" + source_name(l.first);
+        print_summary_csv(out, name.c_str(), l.second);
+    }
+
+    fprintf(out, "\ncounter,value\n");
+    fprintf(out, "ticks,%" PRIu64 "\n", ticks_);
+    for (auto &u : ult_) {
+        fprintf(out, "ult%u_readings,%" PRIu64 "\n", u.first, u.second.readings);
+        fprintf(out, "ult%u_dropped,%" PRIu64 "\n", u.first, u.second.dropped);
+        fprintf(out, "ult%u_rate_hz,%.2f\n", u.first, u.second.rate_hz());
+    }
+    fprintf(out, "bad_frames,%" PRIu64 "\n", bad_frames_);
+    fprintf(out, "unknown_frames,%" PRIu64 "\n", unknown_frames_);
+
+    for (auto &l : lines_)
+        fprintf(out, "lines_%s,%" PRIu64 "\n", l.first.c_str(), l.second);
+}
+
+void print_summary_json(FILE *out, const char *name, const Distribution &d, bool last)
+{
+    Summary s = d.summarize();
+
+    fprintf(out, "    \"%s\": { \"count\": %zu, \"mean_us\": %.1f, \"min_us\": %u, "
+            "\"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"max_us\": %u }%s\n",
+            name, s.count, s.mean, s.min, s.p50, s.p90, s.p99, s.max, last ? "" : ",");
+}
+
+void Decoder::print_json(FILE *out) const
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"loop_period\": {\n");
+    print_summary_json(out, "period", loop_period_, false);
+    print_summary_json(out, "work", loop_work_, true);
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"ultrasonic\": {\n");
+    size_t n = 0;
+    for (auto &u : ult_)
+        fprintf(out, "    \"%u\": { \"readings\": %" PRIu64 ", \"dropped\": %" PRIu64
+                ", \"rate_hz\": %.2f }%s\n", u.first, u.second.readings, u.second.dropped,
+                u.second.rate_hz(), ++n == ult_.size() ? "" : ",");
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"latency\": {\n");
+    n = 0;
+    for (auto &l : latency_) {
+        std::string name = source_name(l.first);
+        print_summary_json(out, name.c_str(), l.second, ++n == latency_.size());
+    }
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"lines\": {");
+    n = 0;
+    for (auto &l : lines_)
+        fprintf(out, "%s \"%s\": %" PRIu64, n++ ? "," : "", l.first.c_str(), l.second);
+    fprintf(out, " },\n");
+
+    fprintf(out, "  \"ticks\": %" PRIu64 ",\n", ticks_);
+    fprintf(out, "  \"bad_frames\": %" PRIu64 ",\n", bad_frames_);
+    fprintf(out, "  \"unknown_frames\": %" PRIu64 "\n", unknown_frames_);
+    fprintf(out, "}\n");
+}
+
+speed_t baud_to_speed(long baud)
+{
+    switch (baud) {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    }
+
+    return 0;
+}
+
+/* Puts a serial device or pty into raw mode. Returns false if it isn't a
+ * terminal, which means it is a plain file */
+bool setup_tty(int fd, long baud)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) != 0)
+        return false;
+
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+
+    speed_t speed = baud_to_speed(baud);
+    if (speed) {
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+
+    tcsetattr(fd, TCSANOW, &tio);
+    return true;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b baud] [-f csv|json] [-e events.csv] [-t seconds] <file|device|->\n", prog);
+    exit(2);
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+    long baud = 115200;
+    long seconds = 0;
+    bool json = false;
+    const char *events_path = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:f:e:t:")) != -1) {
+        switch (opt) {
+        case 'b':
+            baud = strtol(optarg, nullptr, 10);
+            if (!baud_to_speed(baud))
+                usage(argv[0]);
+            break;
+
+        case 'f':
+            if (strcmp(optarg, "json") == 0)
+                json = true;
+            else if (strcmp(optarg, "csv") != 0)
+                usage(argv[0]);
+            break;
+
+        case 'e':
+            events_path = optarg;
+            break;
+
+        case 't':
+            seconds = strtol(optarg, nullptr, 10);
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usage(argv[0]);
+
+    int fd = 0;
+    if (strcmp(argv[optind], "-") != 0) {
+        fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+            return 1;
+        }
+    }
+
+    bool live = setup_tty(fd, baud);
+
+    FILE *events = nullptr;
+    if (events_path) {
+        events = fopen(events_path, "w");
+        if (!events) {
+            fprintf(stderr, "%s: %s\n", events_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    Decoder decoder(events);
+
+    /* Big reads, so a capture file goes through in a few calls. A live
+     * 115200 baud stream is only ~11.5KB/s, which is no load at all */
+    static uint8_t buf[65536];
+    auto start = std::chrono::steady_clock::now();
+
+    while (1) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+
+        int64_t host_us = -1;
+        if (live) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            host_us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+            if (seconds && host_us >= seconds * 1000000)
+                break;
+        }
+
+        decoder.feed(buf, len, host_us);
+    }
+
+    if (json)
+        decoder.print_json(stdout);
+    else
+        decoder.print_csv(stdout);
+
+    if (events)
+        fclose(events);
+
+    return 0;
+}